@@ -0,0 +1,210 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#ifndef GUARD_2024_April_26_async_task
+#define GUARD_2024_April_26_async_task
+
+#include "common/task.hpp"
+#include "common/process.hpp"
+#include "common/scheduler.hpp"
+
+#include "boost/filesystem/path.hpp"
+
+#include <exception>
+#include <functional>
+#include <string>
+
+#ifdef __cpp_impl_coroutine
+
+#include <coroutine>
+
+namespace task
+{
+
+// AsyncTask
+//
+// Task whose body is a C++20 coroutine.  When the scheduler runs it the coroutine
+// suspends at each co_await of a process, file read or sub schedule and the worker
+// thread returns to the scheduler.  The coroutine resumes on a scheduler worker once
+// the awaited operation completes and the task completes when the coroutine returns.
+//
+// Outside a scheduler, such as through run(), every awaitable completes before
+// returning so the coroutine runs through on the calling thread.
+//
+//     AsyncTask::Coroutine runAsync( Progress& progress ) override
+//     {
+//         progress.start( ... );
+//         const common::CommandResult result = co_await awaitCmd( cmd );
+//         ...
+//         progress.succeeded();
+//     }
+class AsyncTask : public Task
+{
+public:
+    class Coroutine
+    {
+    public:
+        struct promise_type
+        {
+            Coroutine          get_return_object();
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            auto                final_suspend() noexcept;
+            void                return_void() {}
+            void                unhandled_exception() { m_pException = std::current_exception(); }
+
+            // null outside a scheduler
+            Scheduler*                                            m_pScheduler = nullptr;
+            std::function< Scheduler::Run::Ptr( Schedule::Ptr ) > m_scheduleSpawner;
+            std::exception_ptr                                    m_pException;
+            std::function< void( std::exception_ptr ) >           m_onComplete;
+        };
+        using Handle = std::coroutine_handle< promise_type >;
+
+        Coroutine( Coroutine&& other ) noexcept;
+        ~Coroutine();
+
+        Coroutine( const Coroutine& )            = delete;
+        Coroutine& operator=( const Coroutine& ) = delete;
+        Coroutine& operator=( Coroutine&& )      = delete;
+
+    private:
+        friend class AsyncTask;
+        explicit Coroutine( Handle handle )
+            : m_handle( handle )
+        {
+        }
+        Handle m_handle;
+    };
+
+    AsyncTask( const RawPtrSet& dependencies );
+
+    virtual Coroutine runAsync( Progress& progress ) = 0;
+
+    // runs a schedule awaited by the coroutine as a child run of the task's run
+    using ScheduleSpawner = std::function< Scheduler::Run::Ptr( Schedule::Ptr ) >;
+
+    // start the coroutine and call onComplete once it has returned.  The coroutine
+    // resumes through the scheduler after each suspension.  Progress must outlive it.
+    void start( Progress&                                   progress,
+                Scheduler*                                  pScheduler,
+                ScheduleSpawner                             scheduleSpawner,
+                std::function< void( std::exception_ptr ) > onComplete );
+
+    // runs the coroutine to completion on the calling thread
+    virtual void run( Progress& progress );
+};
+
+inline auto AsyncTask::Coroutine::promise_type::final_suspend() noexcept
+{
+    // the frame is destroyed before onComplete which may release the Progress it refers to
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend( Handle handle ) noexcept
+        {
+            std::function< void( std::exception_ptr ) > onComplete = std::move( handle.promise().m_onComplete );
+            std::exception_ptr                          pException = handle.promise().m_pException;
+            handle.destroy();
+            onComplete( pException );
+        }
+        void await_resume() const noexcept {}
+    };
+    return FinalAwaiter{};
+}
+
+// co_await awaitCmd( cmd ) - the result of running the command
+class CmdAwaitable
+{
+public:
+    explicit CmdAwaitable( const common::Command& cmd )
+        : m_cmd( cmd )
+    {
+    }
+
+    bool                  await_ready() const { return false; }
+    bool                  await_suspend( AsyncTask::Coroutine::Handle handle );
+    common::CommandResult await_resume() { return std::move( m_result ); }
+
+private:
+    common::Command       m_cmd;
+    common::CommandResult m_result;
+};
+inline CmdAwaitable awaitCmd( const common::Command& cmd )
+{
+    return CmdAwaitable( cmd );
+}
+
+// co_await awaitFile( filePath ) - the contents of the file read on the scheduler's
+// blocking I/O threads
+class FileAwaitable
+{
+public:
+    explicit FileAwaitable( const boost::filesystem::path& filePath )
+        : m_filePath( filePath )
+    {
+    }
+
+    bool        await_ready() const { return false; }
+    bool        await_suspend( AsyncTask::Coroutine::Handle handle );
+    std::string await_resume();
+
+private:
+    void read();
+
+    boost::filesystem::path m_filePath;
+    std::string             m_strContents;
+    std::exception_ptr      m_pException;
+};
+inline FileAwaitable awaitFile( const boost::filesystem::path& filePath )
+{
+    return FileAwaitable( filePath );
+}
+
+// co_await awaitSchedule( pSchedule ) - runs the schedule as a child run of the
+// awaiting task's run and resumes once it finishes.  The child shares the run's owner,
+// cancellation and trace and the task's admitted resources are released while it
+// waits.  Throws if a task in it failed and returns false if it was cancelled.
+class ScheduleAwaitable
+{
+public:
+    explicit ScheduleAwaitable( Schedule::Ptr pSchedule )
+        : m_pSchedule( pSchedule )
+    {
+    }
+
+    bool await_ready() const { return false; }
+    bool await_suspend( AsyncTask::Coroutine::Handle handle );
+    bool await_resume();
+
+private:
+    Schedule::Ptr       m_pSchedule;
+    Scheduler::Run::Ptr m_pRun;
+    bool                m_bResult = false;
+    std::exception_ptr  m_pException;
+};
+inline ScheduleAwaitable awaitSchedule( Schedule::Ptr pSchedule )
+{
+    return ScheduleAwaitable( pSchedule );
+}
+
+} // namespace task
+
+#endif // __cpp_impl_coroutine
+
+#endif // GUARD_2024_April_26_async_task
@@ -0,0 +1,150 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#ifndef GUARD_2024_April_02_content_hash
+#define GUARD_2024_April_02_content_hash
+
+#include "boost/filesystem/path.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <ostream>
+#include <functional>
+
+namespace common
+{
+
+// 128 bit content digest
+struct HashCode128
+{
+    std::uint64_t m_low  = 0U;
+    std::uint64_t m_high = 0U;
+
+    inline bool operator==( const HashCode128& cmp ) const { return m_low == cmp.m_low && m_high == cmp.m_high; }
+    inline bool operator!=( const HashCode128& cmp ) const { return !( *this == cmp ); }
+    inline bool operator<( const HashCode128& cmp ) const
+    {
+        return ( m_high != cmp.m_high ) ? ( m_high < cmp.m_high ) : ( m_low < cmp.m_low );
+    }
+
+    // fold to the legacy std::size_t width used by common::Hash
+    inline std::size_t fold() const { return static_cast< std::size_t >( m_low ); }
+
+    void        toHexString( std::ostream& os ) const;
+    std::string toHexString() const;
+
+    // parse the 32 character form written by toHexString - returns false if malformed
+    static bool fromHexString( const std::string& strHex, HashCode128& hash );
+
+    template < class Archive >
+    inline void serialize( Archive& archive, const unsigned int )
+    {
+        archive& m_low;
+        archive& m_high;
+    }
+};
+
+inline std::ostream& operator<<( std::ostream& os, const HashCode128& hash )
+{
+    hash.toHexString( os );
+    return os;
+}
+
+// ContentHash
+//
+// Stable 128 bit streaming content hash in the style of XXH3.  The output depends
+// ONLY on the input bytes - never on the process, the machine, the chunking used to
+// feed update() or on whether the SIMD path is compiled in - so it can be persisted
+// and used as a cache key across runs and machines.
+//
+// The algorithm:
+// 1. Input is consumed in 64 byte stripes. Each stripe is read as eight little endian
+//    64 bit lanes and accumulated into eight 64 bit accumulators:
+//        key          = lane[ i ] ^ secret[ stripe + i ]
+//        acc[ i ^ 1 ] += lane[ i ]
+//        acc[ i ]     += lo32( key ) * hi32( key )
+// 2. After every block of 16 stripes ( 1024 bytes ) the accumulators are scrambled:
+//        acc[ i ] = ( acc[ i ] ^ ( acc[ i ] >> 47 ) ^ secret[ 16 + i ] ) * PRIME32_1
+// 3. The final partial stripe, if any, is zero padded and accumulated as a normal stripe.
+// 4. The low and high halves are each formed by merging the accumulator pairs with a
+//    128 bit multiply fold against different secret words, seeded with the total length,
+//    followed by an avalanche.
+//
+// The secret is 24 64 bit words generated from a fixed splitmix64 sequence.
+// The accumulate and scramble steps have an SSE2 implementation that is bit for bit
+// identical to the scalar one.
+class ContentHash
+{
+public:
+    static constexpr std::size_t STRIPE_SIZE       = 64U;
+    static constexpr std::size_t STRIPES_PER_BLOCK = 16U;
+    static constexpr std::size_t BLOCK_SIZE        = STRIPE_SIZE * STRIPES_PER_BLOCK;
+    static constexpr std::size_t ACCUMULATORS      = 8U;
+
+    // size of chunks read when hashing files
+    static constexpr std::size_t FILE_CHUNK_SIZE = 1024U * 1024U;
+
+    ContentHash();
+
+    void        update( const void* pData, std::size_t szSize );
+    HashCode128 digest() const;
+
+    static HashCode128 hash( const void* pData, std::size_t szSize );
+
+    // widen a 64 bit hash code into a 128 bit digest - the low word is preserved
+    static HashCode128 widen( std::uint64_t hashCode );
+
+    // order dependant combination of two digests
+    static HashCode128 combine( const HashCode128& left, const HashCode128& right );
+
+private:
+    using Accumulators = std::array< std::uint64_t, ACCUMULATORS >;
+
+    static void accumulateStripe( Accumulators& acc, const std::uint8_t* pStripe, std::size_t szStripe );
+    static void scramble( Accumulators& acc );
+    static void processBlock( Accumulators& acc, const std::uint8_t* pBlock );
+
+    Accumulators                           m_accumulators;
+    std::array< std::uint8_t, BLOCK_SIZE > m_buffer;
+    std::size_t                            m_szBuffered  = 0U;
+    std::uint64_t                          m_totalLength = 0U;
+};
+
+namespace internal
+{
+// invoke the functor with successive chunks of at most ContentHash::FILE_CHUNK_SIZE bytes
+void readFileChunks( const boost::filesystem::path&                          file,
+                     const std::function< void( const void*, std::size_t ) >& functor );
+} // namespace internal
+
+// hash a file through any engine providing update( const void*, std::size_t ) and HashCode128 digest() const
+template < typename ContentHashEngine = ContentHash >
+inline HashCode128 hashFileContents( const boost::filesystem::path& file )
+{
+    ContentHashEngine engine;
+    internal::readFileChunks(
+        file, [ &engine ]( const void* pData, std::size_t szSize ) { engine.update( pData, szSize ); } );
+    return engine.digest();
+}
+
+} // namespace common
+
+#endif // GUARD_2024_April_02_content_hash
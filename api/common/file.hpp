@@ -27,6 +27,7 @@ Copyright Deighton Systems Limited (c) 2015
 #include <memory>
 #include <ostream>
 #include <string>
+#include <cstdint>
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -64,6 +65,25 @@ bool updateFileIfChanged( const boost::filesystem::path& filePath, const std::st
 bool compareFiles( const boost::filesystem::path& fileOne, const boost::filesystem::path& fileTwo );
 
 bool copyFileIfChanged( const boost::filesystem::path& from, const boost::filesystem::path& to );
+
+struct FileStat
+{
+    std::uint64_t m_device              = 0U;
+    std::uint64_t m_inode               = 0U;
+    std::uint64_t m_size                = 0U;
+    std::int64_t  m_modifiedNanoSeconds = 0;
+};
+
+// single stat call - returns false if the file does not exist
+// NOTE: device and inode are zero where the platform does not provide them
+bool getFileStat( const boost::filesystem::path& filePath, FileStat& fileStat );
+
+// create the new file to as a copy on write clone of from sharing its extents
+// returns false where the platform or filesystem does not support cloning
+bool cloneFile( const boost::filesystem::path& from, const boost::filesystem::path& to );
+
+// flush the contents of a file, or the entries of a directory, to stable storage
+void syncFile( const boost::filesystem::path& filePath );
 }
 }
 
@@ -23,7 +23,12 @@
 
 #include <boost/filesystem/path.hpp>
 
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace git
@@ -40,6 +45,54 @@ std::string getGitFile( const boost::filesystem::path& gitDirectory,
 
 void commit( const boost::filesystem::path& gitDirectory, const std::string& strMsg );
 
+// Session
+//
+// Long lived access to the history of one repository for callers which make many queries.
+// File contents are read through a single `git cat-file --batch` process which is started
+// on first use and kept open for the life of the session.  The history is read with one
+// `git log --name-only` over the whole repository on first use and indexed by file so that
+// each getFileGitHashes is a lookup.  Merge commits are not indexed.
+//
+// Commands run with `git -C` so the process working directory is never changed and the
+// session throws on construction if the directory is not within a repository.  The
+// session is thread safe.  Requests on the cat-file process are serialised so callers
+// fetching many files should prefer getGitFiles which pipelines them.
+class Session
+{
+public:
+    using FileRequest = std::pair< boost::filesystem::path, std::string >;
+
+    Session( const boost::filesystem::path& gitDirectory );
+    ~Session();
+
+    Session( const Session& )            = delete;
+    Session& operator=( const Session& ) = delete;
+
+    const boost::filesystem::path& getDirectory() const { return m_gitDirectory; }
+
+    // commits which changed the file most recent first
+    std::vector< std::string > getFileGitHashes( const boost::filesystem::path& filePath );
+
+    std::string                getGitFile( const boost::filesystem::path& filePath, const std::string& strGitHash );
+    std::vector< std::string > getGitFiles( const std::vector< FileRequest >& requests );
+
+    // reload the history on the next request to include later commits
+    void refresh();
+
+private:
+    struct CatFile;
+
+    std::string getObjectName( const FileRequest& request ) const;
+
+    const boost::filesystem::path m_gitDirectory;
+
+    std::mutex                                                           m_historyMutex;
+    std::optional< std::map< std::string, std::vector< std::string > > > m_history;
+
+    std::mutex                 m_catFileMutex;
+    std::unique_ptr< CatFile > m_pCatFile;
+};
+
 } // namespace git
 
 #endif // GUARD_2024_March_11_git
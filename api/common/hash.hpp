@@ -3,6 +3,7 @@
 #define COMMON_HASH_UTILS_28_OCT_2020
 
 #include "assert_verify.hpp"
+#include "content_hash.hpp"
 
 #include "boost/filesystem/path.hpp"
 
@@ -52,6 +53,8 @@ struct HashFunctor< T, typename std::enable_if< !std::is_base_of< HashCode, T >:
     inline HashCodeType operator()( const T& value ) const { return typename T::Hash{}( value ); }
 };
 
+// stable content hash of a file - see common::ContentHash
+HashCode128  hash_file128( const boost::filesystem::path& file );
 HashCodeType hash_file( const boost::filesystem::path& file );
 
 // NOTE: this specialisation was ONLY introduced due to vc++ issue - further investigation justified to
@@ -0,0 +1,93 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#ifndef GUARD_2024_April_04_hash_memo
+#define GUARD_2024_April_04_hash_memo
+
+#include "common/content_hash.hpp"
+#include "common/file.hpp"
+
+#include "boost/filesystem/path.hpp"
+
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+namespace common
+{
+
+// FileHashMemo
+//
+// Memo of file content digests keyed by the file path and its ( device, inode, size, mtime_ns )
+// stat tuple.  A file is only rehashed when its stat tuple differs from the memo entry.
+//
+// The process wide instance returned by get() is used by internal::hash_file so that
+// common::Hash( path ), task::FileHash and BuildHashCodes::hashAll all share it.  It only
+// persists between runs once open() has been called with a memo file.
+//
+// Files modified within RACY_NANOSECONDS of being hashed are not memoised since a further
+// write within the timestamp granularity of the filesystem could leave the stat tuple unchanged.
+class FileHashMemo
+{
+public:
+    static constexpr std::int64_t RACY_NANOSECONDS = 2000000000;
+
+    static FileHashMemo& get();
+
+    FileHashMemo();
+    ~FileHashMemo();
+
+    FileHashMemo( const FileHashMemo& )            = delete;
+    FileHashMemo& operator=( const FileHashMemo& ) = delete;
+
+    // load the memo file if it exists and save back to it on flush() or destruction
+    void open( const boost::filesystem::path& memoFile );
+    void flush();
+
+    void load( const boost::filesystem::path& memoFile );
+    void save( const boost::filesystem::path& memoFile ) const;
+
+    // lookup and record against an existing stat result
+    std::optional< HashCode128 > find( const boost::filesystem::path&     file,
+                                       const boost::filesystem::FileStat& fileStat ) const;
+    void                         insert( const boost::filesystem::path&     file,
+                                         const boost::filesystem::FileStat& fileStat,
+                                         const HashCode128&                 digest );
+
+    void        clear();
+    std::size_t size() const;
+
+private:
+    struct Entry
+    {
+        boost::filesystem::FileStat m_stat;
+        HashCode128                 m_digest;
+    };
+    using EntryMap = std::unordered_map< std::string, Entry >;
+
+    mutable std::shared_mutex                m_mutex;
+    EntryMap                                 m_entries;
+    std::optional< boost::filesystem::path > m_memoFile;
+    bool                                     m_bModified = false;
+};
+
+} // namespace common
+
+#endif // GUARD_2024_April_04_hash_memo
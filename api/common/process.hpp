@@ -20,9 +20,19 @@
 #ifndef GUARD_2023_November_13_process
 #define GUARD_2023_November_13_process
 
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <map>
 
+namespace boost::asio
+{
+class io_context;
+}
+
 namespace common
 {
 
@@ -40,6 +50,60 @@ struct Command
 
 int runCmd( const Command& cmd, std::string& strOutput, std::string& strError );
 
+// resources used by a command once it has exited - zero on Windows
+struct ResourceUsage
+{
+    double        m_userSeconds      = 0.0;
+    double        m_systemSeconds    = 0.0;
+    std::uint64_t m_maxResidentBytes = 0U;
+};
+
+struct CommandResult
+{
+    int           m_exitCode = EXIT_SUCCESS;
+    std::string   m_strOutput;
+    std::string   m_strError;
+    ResourceUsage m_usage;
+};
+
+// start the command without waiting for it.  onComplete is called from a thread running
+// the io_context once the process has exited and all of its output has been read.
+void runCmdAsync( boost::asio::io_context&               ioContext,
+                  const Command&                         cmd,
+                  std::function< void( CommandResult ) > onComplete );
+
+// handlers for startCmd which are never called concurrently for the same command.  When
+// m_onOutput or m_onError is set each chunk of that stream is passed to it as it is read
+// instead of being collected in the result.
+struct CommandCallbacks
+{
+    using ChunkFunctor = std::function< void( std::string_view ) >;
+
+    ChunkFunctor                           m_onOutput;
+    ChunkFunctor                           m_onError;
+    std::function< void( CommandResult ) > m_onComplete;
+};
+
+class CommandHandle
+{
+public:
+    using Ptr = std::shared_ptr< CommandHandle >;
+
+    virtual ~CommandHandle() = default;
+
+    virtual int  getPID() const       = 0;
+    virtual bool hasCompleted() const = 0;
+
+    // kill the process - m_onComplete is still called once it has exited
+    virtual void terminate() = 0;
+};
+
+// start the command driven entirely by the io_context so that a single thread running it
+// can supervise any number of commands.  The command is kept alive by its pending reads
+// so the handle need not be retained.  The result reports the real exit status - 128 plus
+// the signal number if the process was killed.
+CommandHandle::Ptr startCmd( boost::asio::io_context& ioContext, const Command& cmd, CommandCallbacks callbacks );
+
 } // namespace common
 
 #endif //GUARD_2023_November_13_process
@@ -3,32 +3,65 @@
 #define TASK_SCHEDULER_08_FEB_2021
 
 #include "task.hpp"
+#include "task_cost_model.hpp"
+#include "task_trace.hpp"
 
 #include "boost/asio.hpp"
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <vector>
 #include <thread>
 #include <atomic>
+#include <functional>
 #include <map>
+#include <queue>
 
 namespace task
 {
+class WorkStealingPool;
 
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
+// Schedule
+//
+// The tasks are compiled into a dependency graph on construction.  Each node records
+// how many dependencies its task has and the indices of the tasks which depend on it
+// so that a run only visits the successors of each task as it completes.
+//
+// Every dependency must be a task in the schedule and the graph must be acyclic.
 class Schedule
 {
 public:
     using Ptr = std::shared_ptr< Schedule >;
 
+    struct Node
+    {
+        Task::RawPtr               m_pTask           = nullptr;
+        std::size_t                m_dependencyCount = 0U;
+        std::vector< std::size_t > m_successors;
+    };
+    using NodeVector = std::vector< Node >;
+
     Schedule( const Task::PtrVector& tasks );
 
     const Task::PtrVector& getTasks() const { return m_tasks; }
 
+    // node per task in the order of getTasks()
+    const NodeVector&                 getNodes() const { return m_nodes; }
+    // tasks with no dependencies
+    const std::vector< std::size_t >& getRoots() const { return m_roots; }
+    // every task after all of its dependencies
+    const std::vector< std::size_t >& getOrder() const { return m_order; }
+
 private:
-    Task::PtrVector m_tasks;
+    Task::PtrVector            m_tasks;
+    NodeVector                 m_nodes;
+    std::vector< std::size_t > m_roots;
+    std::vector< std::size_t > m_order;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -44,31 +77,101 @@ public:
         using Owner = const void*;
         using Ptr   = std::shared_ptr< Run >;
 
-        Run( Scheduler& scheduler, Owner pOwner, Schedule::Ptr pSchedule );
+        // a run with a parent runs tasks spawned by one of the parent's tasks
+        Run( Scheduler& scheduler, Owner pOwner, Schedule::Ptr pSchedule, Ptr pParent = Ptr() );
 
         Owner getOwner() const { return m_pOwner; }
         bool  isCancelled() const;
 
+        // the timeline of the run when the scheduler is tracing
+        TaskTrace::Ptr getTrace() const { return m_pTrace; }
+
         bool wait();
         void cancel();
+        // called once the run finishes - immediately if it already has
+        void onFinished( std::function< void() > continuation );
 
         // private:
+        void setStarted();
         void complete();
         void finished();
-        void runTask( Task::RawPtr pTask );
+        void runTask( std::size_t szTask );
         void start();
-        void next();
+        // restore the cached tasks which are ready and schedule the rest
+        void release( std::vector< std::size_t > ready );
 
     private:
-        Scheduler&                          m_scheduler;
-        const Owner                         m_pOwner;
-        Schedule::Ptr                       m_pSchedule;
-        Task::RawPtrSet                     m_pending, m_active, m_finished;
-        mutable std::recursive_mutex        m_mutex;
-        std::promise< bool >                m_promise;
-        bool                                m_bStarted, m_bCancelled, m_bFinished, m_bComplete;
-        std::future< bool >                 m_future;
-        std::optional< std::exception_ptr > m_pExceptionPtr;
+        // a task from starting to completing - held by the coroutine of an AsyncTask
+        // while it is suspended and by the runs of the tasks it spawns
+        struct Execution : public std::enable_shared_from_this< Execution >
+        {
+            Execution( Run& run, std::size_t szTask );
+
+            std::size_t                           m_szTask;
+            Progress                              m_progress;
+            std::chrono::steady_clock::time_point m_startTime;
+            std::int64_t                          m_startNanoSeconds;
+            // the task itself and each spawned run yet to finish
+            std::atomic< std::size_t >            m_joins;
+            std::mutex                            m_joinMutex;
+            std::exception_ptr                    m_pJoinError;
+            bool                                  m_bJoinCancelled = false;
+            std::atomic< bool >                   m_bAdmissionReleased{ false };
+        };
+
+        std::vector< std::size_t > restore( std::vector< std::size_t > ready );
+        void                       spawn( Execution& execution, const Task::PtrVector& tasks );
+        Ptr                        spawnAwaited( Execution& execution, Schedule::Ptr pSchedule );
+        Ptr                        createChild( Schedule::Ptr pSchedule );
+        void                       startChild( const Ptr& pChild );
+        void                       returned( Execution& execution, std::exception_ptr pError );
+        void                       releaseAdmission( Execution& execution );
+        void                       join( Execution& execution, std::exception_ptr pError, bool bCancelled );
+        void                       completeTask( Execution& execution );
+        void                       traceTask( const Execution& execution );
+        const Task::Resources*     getAdmission( std::size_t szTask ) const;
+
+        // state flags are only ever set and the thread whose fetch_or first sets
+        // a flag performs that transition
+        enum State : std::uint32_t
+        {
+            eStarted   = 1U,
+            eCancelled = 2U,
+            eComplete  = 4U,
+            eFinished  = 8U
+        };
+
+        Scheduler&                                m_scheduler;
+        const Owner                               m_pOwner;
+        Schedule::Ptr                             m_pSchedule;
+        const Ptr                                 m_pParent;
+        // dependencies of each task yet to finish and the tasks yet to finish
+        std::vector< std::atomic< std::size_t > > m_dependencyCounts;
+        std::atomic< std::size_t >                m_remaining;
+        std::atomic< std::uint32_t >              m_state;
+        CancellationToken                         m_cancellationToken;
+        // with a cost model - the identity of each task and the expected time from
+        // starting it to the end of the longest path through its successors
+        std::vector< std::string >                m_identities;
+        std::vector< double >                     m_costs;
+        std::vector< double >                     m_ranks;
+        // with a resource budget - what each task must be admitted against
+        std::vector< Task::Resources >            m_resources;
+        // with a stash - the keys each task which has to run stashes its outputs against
+        std::shared_ptr< Stash >                  m_pStash;
+        std::vector< StashKeys >                  m_stashKeys;
+        // when tracing - when each task became ready
+        TaskTrace::Ptr                            m_pTrace;
+        std::uint32_t                             m_traceRun = 0U;
+        std::vector< std::int64_t >               m_readyNanoSeconds;
+        std::promise< bool >                      m_promise;
+        std::future< bool >                       m_future;
+        // only taken when a task fails and when the run finishes
+        std::mutex                                m_exceptionMutex;
+        std::optional< std::exception_ptr >       m_pExceptionPtr;
+        bool                                      m_bFinished = false;
+        std::vector< std::function< void() > >    m_continuations;
+        std::vector< std::weak_ptr< Run > >       m_children;
     };
 
 private:
@@ -82,29 +185,119 @@ public:
         return DEFAULT_ALIVE_RATE;
     }
     static const inline auto DEFAULT_KEEP_ALIVE = getDefaultAliveRate();
+    static constexpr std::size_t BLOCKING_THREADS = 4U;
+
+    // what runs the tasks
+    enum class Executor
+    {
+        eAsio,        // every thread runs the shared io_context queue
+        eWorkStealing // per thread work stealing deques - the io_context only runs the timer
+    };
 
     Scheduler( StatusFIFO&                   fifo,
                std::chrono::milliseconds     keepAliveRate = DEFAULT_KEEP_ALIVE,
-               std::optional< unsigned int > maxThreads    = std::optional< unsigned int >() );
+               std::optional< unsigned int > maxThreads    = std::optional< unsigned int >(),
+               Executor                      executor      = Executor::eAsio );
     ~Scheduler();
 
     Run::Ptr run( Run::Owner pOwner, Schedule::Ptr pSchedule );
     void     stop();
 
+    // learn task costs and start the ready task with the longest remaining path
+    // first rather than in the order tasks became ready.  Set before any run.
+    void setCostModel( TaskCostModel::Ptr pCostModel );
+
+    // only start a task once the resources it declares fit in what running tasks
+    // leave of the budget.  Waiting tasks are considered highest rank first and any
+    // which fit are started so cheap tasks backfill around a large one.  A task
+    // needing more than the whole budget runs once it is the only holder.
+    // Set before any run.
+    void setResourceBudget( const Task::Resources& budget );
+
+    // share the workers between owners in proportion to their weight which is one
+    // unless set.  Once any weight is set ready tasks are queued per owner and each
+    // worker starts a task of the owner which has had the least service for its weight
+    // so an interactive owner is not starved by a batch owner's backlog.
+    void setOwnerWeight( Run::Owner pOwner, double weight );
+
+    // record a TaskTrace for each run.  Set before any run.
+    void setTracing( bool bTracing );
+
+    // incremental runs - a ready task with Task::CacheInfo whose outputs are all in the
+    // stash is restored instead of run and the outputs of those which run are stashed.
+    // Ready tasks are restored in bulk on the thread which released them so a cached
+    // subgraph completes without dispatching any task to a worker.  Set before any run.
+    void setStash( std::shared_ptr< Stash > pStash );
+
+    // completion handlers such as those of common::runCmdAsync run on its threads
+    boost::asio::io_context& getIOContext() { return m_queue; }
+
+    // run blocking work such as file reads on threads other than the workers
+    void postBlocking( std::function< void() > job );
+
     // private:
     void OnKeepAlive( const boost::system::error_code& ec );
     void OnRunComplete( Run::Ptr pRun );
+    void post( std::function< void() > job );
+    void schedule( Run::Ptr pRun, std::size_t szTask );
+    void enqueue( Run::Ptr pRun, std::size_t szTask );
+    void dispatch();
+    // require m_resourceMutex
+    bool isAdmissible( const Task::Resources& resources ) const;
+    void acquire( const Task::Resources& resources );
+    void release( const Task::Resources& resources );
 
 private:
-    StatusFIFO&                m_fifo;
-    bool                       m_bStop;
-    std::recursive_mutex       m_mutex;
-    boost::asio::io_context    m_queue;
-    std::chrono::milliseconds  m_keepAliveRate;
-    boost::asio::steady_timer  m_keepAliveTimer;
-    std::vector< std::thread > m_threads;
-    ScheduleRunMap             m_runs;
-    ScheduleRunMap             m_pending;
+    struct ReadyTask
+    {
+        double        m_rank;
+        std::uint64_t m_sequence;
+        Run::Ptr      m_pRun;
+        std::size_t   m_szTask;
+
+        // highest rank first then first ready
+        bool operator<( const ReadyTask& other ) const
+        {
+            return ( m_rank != other.m_rank ) ? ( m_rank < other.m_rank ) : ( m_sequence > other.m_sequence );
+        }
+    };
+
+    StatusFIFO&                         m_fifo;
+    bool                                m_bStop;
+    std::recursive_mutex                m_mutex;
+    boost::asio::io_context             m_queue;
+    std::chrono::milliseconds           m_keepAliveRate;
+    boost::asio::steady_timer           m_keepAliveTimer;
+    std::vector< std::thread >          m_threads;
+    std::unique_ptr< WorkStealingPool > m_pPool;
+    boost::asio::thread_pool            m_blockingPool;
+    TaskCostModel::Ptr                  m_pCostModel;
+    std::shared_ptr< Stash >            m_pStash;
+    bool                                m_bTracing = false;
+
+    // ready tasks when ranked or fair queuing - a single queue unless fair queuing.
+    // Each owner's virtual time advances by the cost of the tasks it starts over its
+    // weight and starts from the current virtual time whenever it has a backlog again.
+    struct OwnerQueue
+    {
+        double                           m_virtualTime = 0.0;
+        std::priority_queue< ReadyTask > m_ready;
+    };
+    std::mutex                          m_readyMutex;
+    std::map< Run::Owner, OwnerQueue >  m_ownerQueues;
+    std::map< Run::Owner, double >      m_ownerWeights;
+    std::atomic< bool >                 m_bFairQueuing{ false };
+    double                              m_virtualTime   = 0.0;
+    std::uint64_t                       m_readySequence = 0U;
+
+    // resource admission
+    std::mutex                          m_resourceMutex;
+    std::optional< Task::Resources >    m_resourceBudget;
+    Task::Resources                     m_resourcesInUse;
+    std::vector< ReadyTask >            m_waiting;
+    std::uint64_t                       m_waitingSequence = 0U;
+    ScheduleRunMap                      m_runs;
+    ScheduleRunMap                      m_pending;
 };
 
 void run( task::Schedule::Ptr pSchedule, std::ostream& os );
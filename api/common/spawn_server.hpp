@@ -0,0 +1,95 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#ifndef GUARD_2024_April_29_spawn_server
+#define GUARD_2024_April_29_spawn_server
+
+#include "common/process.hpp"
+
+#ifndef _WIN32
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace common
+{
+
+// SpawnServer
+//
+// A helper process forked once while the parent is still small which launches
+// commands on its behalf with posix_spawn.  The parent sends each command over a
+// socket and a single reader thread completes the requests as the helper reports
+// them, so the parent never forks its own large address space nor creates an
+// io_service per command.  The helper keeps its environment from startup and reuses
+// the environment blocks built for recently used overrides.
+//
+// Commands are split into arguments and the program found as boost process does and
+// run with standard input from /dev/null.  Each command runs in the parent's working
+// directory at the time run is called rather than the helper's, which is fixed when it
+// forks.  A command which cannot be spawned throws boost::process::process_error from
+// run as boost process does.
+//
+// Once start() has installed the process wide server runCmd and runProcess use it
+// until stop().  Constructing a server forks so start() should be called before the
+// process creates any threads - typically at the top of main.
+class SpawnServer
+{
+public:
+    static void         start();
+    // once no commands are running - waits for the helper to exit
+    static void         stop();
+    static SpawnServer* get();
+
+    SpawnServer();
+    ~SpawnServer();
+
+    SpawnServer( const SpawnServer& )            = delete;
+    SpawnServer& operator=( const SpawnServer& ) = delete;
+
+    // from any thread - blocks until the command has exited
+    CommandResult run( const Command& cmd );
+
+private:
+    SpawnServer( std::pair< int, pid_t > helper );
+
+    void readResponses();
+
+    const int   m_socket;
+    const pid_t m_pid;
+    std::thread m_reader;
+
+    std::mutex                                               m_writeMutex;
+    std::mutex                                               m_pendingMutex;
+    std::map< std::uint64_t, std::promise< CommandResult > > m_pending;
+    std::uint64_t                                            m_nextID  = 0U;
+    bool                                                     m_bClosed = false;
+};
+
+} // namespace common
+
+#endif // _WIN32
+
+#endif // GUARD_2024_April_29_spawn_server
@@ -3,11 +3,14 @@
 #define STASH_9_FEB_2021
 
 #include "common/hash.hpp"
+#include "common/content_hash.hpp"
 
 #include "boost/filesystem/path.hpp"
 
 #include <memory>
 #include <map>
+#include <optional>
+#include <vector>
 
 namespace task
 {
@@ -20,48 +23,98 @@ class FileHash : public common::Hash
 public:
     FileHash() {}
     explicit FileHash( const boost::filesystem::path& file )
-        : Hash( file )
+        : m_digest( common::internal::hash_file128( file ) )
     {
+        set( m_digest.fold() );
     }
+    explicit FileHash( const common::HashCode128& digest )
+        : m_digest( digest )
+    {
+        set( m_digest.fold() );
+    }
+
+    // full width content digest - get() returns the folded legacy width
+    inline const common::HashCode128& getDigest() const { return m_digest; }
 
     template < class Archive >
     inline void serialize( Archive& archive, const unsigned int )
     {
         archive& m_data;
+        archive& m_digest;
     }
+
+private:
+    common::HashCode128 m_digest;
 };
 
 class DeterminantHash : public common::Hash
 {
 public:
     DeterminantHash() {}
-    DeterminantHash( const FileHash& fileHash ) { set( fileHash.get() ); }
+    DeterminantHash( const FileHash& fileHash )
+        : m_digest( fileHash.getDigest() )
+    {
+        set( fileHash.get() );
+    }
     template < typename... Args >
     DeterminantHash( Args const&... args )
         : Hash( args... )
+        , m_digest( getDigest( args... ) )
     {
     }
 
-    inline void operator^=( const Hash& code ) { m_data = common::internal::HashCombiner()( m_data, code.get() ); }
+    // full width digest - file content digests combined in retain their full width
+    inline const common::HashCode128& getDigest() const { return m_digest; }
+
+    inline void operator^=( const Hash& code )
+    {
+        m_data   = common::internal::HashCombiner()( m_data, code.get() );
+        m_digest = common::ContentHash::combine( m_digest, common::ContentHash::widen( code.get() ) );
+    }
     inline void operator^=( const FileHash& fileHash )
     {
-        m_data = common::internal::HashCombiner()( m_data, fileHash.get() );
+        m_data   = common::internal::HashCombiner()( m_data, fileHash.get() );
+        m_digest = common::ContentHash::combine( m_digest, fileHash.getDigest() );
     }
     inline void operator^=( const DeterminantHash& determinantHash )
     {
-        m_data = common::internal::HashCombiner()( m_data, determinantHash.get() );
+        m_data   = common::internal::HashCombiner()( m_data, determinantHash.get() );
+        m_digest = common::ContentHash::combine( m_digest, determinantHash.getDigest() );
     }
     template < typename... Args >
     inline void operator^=( Args const&... args )
     {
-        m_data = common::internal::HashCombiner()( m_data, common::internal::HashFunctorVariadic()( args... ) );
+        const common::HashCodeType hashCode = common::internal::HashFunctorVariadic()( args... );
+        m_data   = common::internal::HashCombiner()( m_data, hashCode );
+        m_digest = common::ContentHash::combine( m_digest, common::ContentHash::widen( hashCode ) );
     }
 
     template < class Archive >
     inline void serialize( Archive& archive, const unsigned int )
     {
         archive& m_data;
+        archive& m_digest;
     }
+
+private:
+    // the arguments combined as Hash combines them keeping the full width of file digests
+    static inline common::HashCode128 getDigest( const FileHash& fileHash ) { return fileHash.getDigest(); }
+    static inline common::HashCode128 getDigest( const DeterminantHash& determinantHash )
+    {
+        return determinantHash.getDigest();
+    }
+    template < typename T >
+    static inline common::HashCode128 getDigest( const T& value )
+    {
+        return common::ContentHash::widen( common::internal::HashFunctor< T >()( value ) );
+    }
+    template < typename Head, typename Next, typename... Tail >
+    static inline common::HashCode128 getDigest( const Head& head, const Next& next, const Tail&... tail )
+    {
+        return common::ContentHash::combine( getDigest( head ), getDigest( next, tail... ) );
+    }
+
+    common::HashCode128 m_digest;
 };
 
 class BuildHashCodes
@@ -90,23 +143,101 @@ public:
 
     inline void reset() { m_buildHashCodes.clear(); }
 
+    // hash all files concurrently ordering reads by device and inode and insert the results in one pass
+    void hashAll( const std::vector< boost::filesystem::path >& files,
+                  std::optional< unsigned int >                 threads = std::optional< unsigned int >() );
+
 private:
     HashCodeMap m_buildHashCodes;
 };
 
+class StashBackend;
+
+// a stashed file is identified by its path and the full width determinant digest
+struct StashKey
+{
+    boost::filesystem::path m_file;
+    common::HashCode128     m_determinant;
+};
+using StashKeys = std::vector< StashKey >;
+
 class Stash
 {
 public:
-    Stash( const boost::filesystem::path& stashDirectory );
+    // how restore materialises a stashed file
+    enum class RestoreMode
+    {
+        eCopy,  // always copy the bytes
+        eClone, // copy on write clone where the filesystem supports it otherwise copy
+        eLink   // clone where supported otherwise hard link to the read only stash object
+                // - a hard linked file keeps the stash time of the object as its modified time
+    };
+
+    // which stash objects are evicted first once over budget
+    enum class EvictionPolicy
+    {
+        eLRU, // least recently stashed or restored
+        eLFU  // least often restored then least recently used
+    };
+
+    // how stash objects are stored
+    enum class Compression
+    {
+        eNone,    // raw copies which restore can clone or hard link
+        eAdaptive // compressed with a fast level when stashed and recompressed with a dense
+                  // level once cold.  Restore decompresses into the file so always copies.
+    };
+
+    // local stash directory
+    Stash( const boost::filesystem::path& stashDirectory,
+           RestoreMode                    restoreMode = RestoreMode::eClone,
+           Compression                    compression = Compression::eNone );
+
+    // any other backend such as StashDaemonClient
+    Stash( std::shared_ptr< StashBackend > pBackend );
 
     void clear();
     void stash( const boost::filesystem::path& file, DeterminantHash code );
     bool restore( const boost::filesystem::path& file, DeterminantHash code );
 
+    // batched forms - a single request to the backend for many files
+    std::vector< bool > has( const StashKeys& keys );
+    void                stash( const StashKeys& keys );
+    std::vector< bool > restore( const StashKeys& keys );
+
+    // limit the bytes held by the stash - once exceeded a background pass evicts
+    // objects down to 90% of the budget.  No budget means the stash only grows.
+    // NOTE: ignored by backends which manage their own storage
+    void setBudget( std::optional< std::uint64_t > budget, EvictionPolicy policy = EvictionPolicy::eLRU );
+
+    // run an eviction pass on the calling thread.  With Compression::eAdaptive the
+    // pass also recompresses objects which have become cold.
+    void evict();
+
 private:
-    struct Pimpl;
-    std::shared_ptr< Pimpl > m_pPimpl;
+    std::shared_ptr< StashBackend > m_pBackend;
+};
+
+// StashBackend
+//
+// Storage behind a Stash.  Every operation is batched so that remote backends
+// can serve many files in one request.
+class StashBackend
+{
+public:
+    using Ptr = std::shared_ptr< StashBackend >;
+
+    virtual ~StashBackend() = default;
+
+    virtual std::vector< bool > has( const StashKeys& keys ) = 0;
+    virtual void                put( const StashKeys& keys ) = 0;
+    virtual std::vector< bool > get( const StashKeys& keys ) = 0;
+    virtual void                clear()                      = 0;
+
+    virtual void setBudget( std::optional< std::uint64_t >, Stash::EvictionPolicy ) {}
+    virtual void evict() {}
 };
+
 } // namespace task
 
 #endif // STASH_9_FEB_2021
@@ -0,0 +1,91 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#ifndef GUARD_2024_April_16_stash_daemon
+#define GUARD_2024_April_16_stash_daemon
+
+#include "common/stash.hpp"
+
+#include "boost/filesystem/path.hpp"
+
+#include <memory>
+
+namespace task
+{
+
+// StashDaemonClient
+//
+// StashBackend forwarding to a StashDaemon on the same host over a UNIX domain socket
+// so that every build on the host shares one warm stash.  The daemon reads and writes
+// the files named in each request directly so paths are sent as absolute paths.
+//
+// Each batch is split into requests of at most BATCH_SIZE keys which are pipelined with
+// up to PIPELINE_DEPTH requests in flight on one connection.  Concurrent callers use
+// separate pooled connections.
+class StashDaemonClient : public StashBackend
+{
+public:
+    static constexpr std::size_t BATCH_SIZE     = 256U;
+    static constexpr std::size_t PIPELINE_DEPTH = 16U;
+
+    StashDaemonClient( const boost::filesystem::path& socketPath );
+    ~StashDaemonClient();
+
+    std::vector< bool > has( const StashKeys& keys ) override;
+    void                put( const StashKeys& keys ) override;
+    std::vector< bool > get( const StashKeys& keys ) override;
+    void                clear() override;
+
+private:
+    struct Pimpl;
+    std::unique_ptr< Pimpl > m_pPimpl;
+};
+
+// StashDaemon
+//
+// Serves a local stash directory to StashDaemonClients until stopped or destroyed.
+// Up to PIPELINE_DEPTH requests on a connection run concurrently on a thread pool and
+// are answered in the order they were sent.
+//
+// The daemon reads and writes the files named in requests with its own privileges so
+// its socket is only accessible to its owner and connections from any other user are
+// closed.
+class StashDaemon
+{
+public:
+    StashDaemon( const boost::filesystem::path& socketPath,
+                 const boost::filesystem::path& stashDirectory,
+                 Stash::RestoreMode             restoreMode = Stash::RestoreMode::eClone,
+                 Stash::Compression             compression = Stash::Compression::eNone );
+    ~StashDaemon();
+
+    StashDaemon( const StashDaemon& )            = delete;
+    StashDaemon& operator=( const StashDaemon& ) = delete;
+
+    Stash& getStash();
+    void   stop();
+
+private:
+    struct Pimpl;
+    std::unique_ptr< Pimpl > m_pPimpl;
+};
+
+} // namespace task
+
+#endif // GUARD_2024_April_16_stash_daemon
@@ -3,6 +3,7 @@
 #define TASK_TOOLS_14_OCT_2020
 
 #include "common/hash.hpp"
+#include "common/stash.hpp"
 
 #include "boost/filesystem/path.hpp"
 #include "boost/timer/timer.hpp"
@@ -14,8 +15,11 @@
 #include <mutex>
 #include <ostream>
 #include <optional>
-#include <deque>
+#include <atomic>
+#include <functional>
 #include <variant>
+#include <map>
+#include <cstdint>
 
 namespace task
 {    
@@ -34,7 +38,7 @@ namespace task
             eFailed
         };
         
-        Status( Owner owner )
+        Status( Owner owner = nullptr )
             :   m_state( ePending ),
                 m_owner( owner )
         {}
@@ -54,41 +58,97 @@ namespace task
     std::ostream& operator<<( std::ostream& os, const Status::Subject& subject );
     std::ostream& operator<<( std::ostream& os, const Status& status );
     
+    // StatusFIFO
+    //
+    // Bounded lock free ring of Status records for any number of producers and a single
+    // consumer.  The slots are allocated once so a push only moves the Status into its
+    // slot and a drain moves them out again.  Each slot carries a sequence number which
+    // tells a producer when the slot is free and the consumer when it is published.
+    //
+    // When the ring is full eDrop discards the status and counts it and eBlock makes the
+    // producer yield until the consumer catches up.  Progress pushes the final status of
+    // every task so eBlock must only be chosen when the consumer drains concurrently
+    // with the run rather than after waiting for it.
     class StatusFIFO
     {
     public:
-        bool empty() const
-        {
-            std::lock_guard< std::mutex > lock( m_mutex );
-            return m_fifo.empty();
-        }
-    
-        void push( const Status& status )
+        static constexpr std::size_t DEFAULT_CAPACITY = 1024U;
+        
+        enum Overflow
         {
-            std::lock_guard< std::mutex > lock( m_mutex );
-            m_fifo.push_back( status );
-        }
+            eBlock,
+            eDrop
+        };
+        
+        StatusFIFO( std::size_t szCapacity = DEFAULT_CAPACITY, Overflow overflow = eDrop );
+        ~StatusFIFO();
+        
+        StatusFIFO( const StatusFIFO& ) = delete;
+        StatusFIFO& operator=( const StatusFIFO& ) = delete;
+        
+        std::size_t getCapacity() const { return m_szMask + 1U; }
+        std::size_t getDropped() const { return m_dropped.load( std::memory_order_relaxed ); }
+        
+        // from any thread - false if the status was dropped
+        bool push( Status&& status );
+        bool push( const Status& status ) { return push( Status( status ) ); }
         
-        Status pop()
+        // consumer only
+        bool empty() const;
+        Status pop();
+        // append every published status and return how many
+        std::size_t drain( std::vector< Status >& statuses );
+        
+    private:
+        struct alignas( 64 ) Slot
         {
-            std::lock_guard< std::mutex > lock( m_mutex );
-            Status front = m_fifo.front();
-            m_fifo.pop_front();
-            return front;
-        }
+            std::atomic< std::size_t > m_sequence;
+            Status m_status;
+        };
+        
+        const std::size_t m_szMask;
+        const Overflow m_overflow;
+        std::unique_ptr< Slot[] > m_pSlots;
+        
+        alignas( 64 ) std::atomic< std::size_t > m_tail;
+        alignas( 64 ) std::size_t m_head;
+        std::atomic< std::size_t > m_dropped;
+    };
+    
+    class Task;
+    
+    // shared by a scheduler run and the progress of each of its tasks.  A long running
+    // task polls it and returns early without finishing once the run is cancelled.
+    class CancellationToken
+    {
+    public:
+        CancellationToken()
+            :   m_pCancelled( std::make_shared< std::atomic< bool > >( false ) )
+        {}
+        
+        bool isCancelled() const { return m_pCancelled->load( std::memory_order_relaxed ); }
+        void cancel() { m_pCancelled->store( true, std::memory_order_relaxed ); }
         
     private:
-        mutable std::mutex m_mutex;
-        std::deque< Status > m_fifo;
+        std::shared_ptr< std::atomic< bool > > m_pCancelled;
     };
     
     class Progress
     {
     public:
-        Progress( StatusFIFO& fifo, Status::Owner owner );
+        Progress( StatusFIFO& fifo, Status::Owner owner, CancellationToken cancellationToken = CancellationToken() );
         
         const Status& getStatus() const { return m_status; }
         bool isFinished() const;
+        bool isCancelled() const { return m_cancellationToken.isCancelled(); }
+        const CancellationToken& getCancellationToken() const { return m_cancellationToken; }
+        
+        // add tasks discovered while running to the run.  The tasks may depend on each
+        // other but not on tasks outside them.  They start at once and the task only
+        // completes, releasing its successors, once they have all completed.
+        using Spawner = std::function< void( const std::vector< std::shared_ptr< Task > >& ) >;
+        void setSpawner( Spawner spawner ) { m_spawner = std::move( spawner ); }
+        void spawn( const std::vector< std::shared_ptr< Task > >& tasks );
         
         void start( const std::string& strTaskName, Status::Subject source, Status::Subject target );
         
@@ -103,6 +163,8 @@ namespace task
         
     private:
         StatusFIFO& m_fifo;
+        CancellationToken m_cancellationToken;
+        Spawner m_spawner;
         boost::timer::cpu_timer m_timer;
         Status m_status;
     };
@@ -115,10 +177,43 @@ namespace task
         using RawPtr = Task*;
         using RawPtrSet = std::set< RawPtr >;
         
+        // what the task holds while it runs.  As a Scheduler budget zero memory or I/O
+        // slots is unlimited and only the named semaphores listed are limited.
+        struct Resources
+        {
+            std::uint64_t m_memoryMB = 0U;
+            unsigned int m_ioSlots = 0U;
+            std::map< std::string, unsigned int > m_semaphores;
+            
+            bool empty() const { return m_memoryMB == 0U && m_ioSlots == 0U && m_semaphores.empty(); }
+        };
+        
+        // what a scheduler with a stash needs to restore the outputs of the task instead
+        // of running it.  Each output is stashed against the determinant combined with
+        // the hash of every input.
+        struct CacheInfo
+        {
+            DeterminantHash m_determinant;
+            std::vector< FileHash > m_inputs;
+            std::vector< boost::filesystem::path > m_outputs;
+        };
+        
         Task( const RawPtrSet& dependencies );
         virtual ~Task();
         
-        virtual bool isReady( const RawPtrSet& finished );
+        const RawPtrSet& getDependencies() const { return m_dependencies; }
+        
+        // identity which is stable between runs used to learn the cost of the task
+        // - empty if the task has none
+        virtual std::string getIdentity() const;
+        
+        // resources the scheduler must admit the task against - none by default
+        virtual Resources getResources() const;
+        
+        // asked once the dependencies have completed so inputs they produce exist
+        // - none if the task is never cached by the scheduler
+        virtual std::optional< CacheInfo > getCacheInfo() const;
+        
         virtual void run( Progress& taskProgress ) = 0;
         virtual void failed( Progress& taskProgress );
         
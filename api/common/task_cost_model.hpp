@@ -0,0 +1,88 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+
+#ifndef GUARD_2024_April_22_task_cost_model
+#define GUARD_2024_April_22_task_cost_model
+
+#include "boost/filesystem/path.hpp"
+
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+namespace task
+{
+
+// TaskCostModel
+//
+// Expected duration in seconds of each task keyed by Task::getIdentity().  Costs may
+// be set up front and are learnt from every run as an exponentially weighted moving
+// average so that a single slow or cached run does not dominate.
+//
+// Like common::FileHashMemo the model only persists between runs once open() has
+// been called with a model file.  It is thread safe.
+class TaskCostModel
+{
+public:
+    using Ptr = std::shared_ptr< TaskCostModel >;
+
+    // weight of the latest sample
+    static constexpr double SMOOTHING = 0.3;
+    // cost of unknown tasks before anything has been recorded
+    static constexpr double DEFAULT_COST = 1.0;
+
+    TaskCostModel();
+    ~TaskCostModel();
+
+    TaskCostModel( const TaskCostModel& )            = delete;
+    TaskCostModel& operator=( const TaskCostModel& ) = delete;
+
+    // load the model file if it exists and save back to it on flush() or destruction
+    void open( const boost::filesystem::path& modelFile );
+    void flush();
+
+    void load( const boost::filesystem::path& modelFile );
+    void save( const boost::filesystem::path& modelFile ) const;
+
+    std::optional< double > find( const std::string& strIdentity ) const;
+    // the learnt cost or the mean of all known costs for unknown tasks
+    double                  estimate( const std::string& strIdentity ) const;
+
+    void set( const std::string& strIdentity, double cost );
+    void record( const std::string& strIdentity, double duration );
+
+    void        clear();
+    std::size_t size() const;
+
+private:
+    using CostMap = std::unordered_map< std::string, double >;
+
+    mutable std::shared_mutex                m_mutex;
+    CostMap                                  m_costs;
+    double                                   m_totalCost = 0.0;
+    std::optional< boost::filesystem::path > m_modelFile;
+    bool                                     m_bModified = false;
+};
+
+} // namespace task
+
+#endif // GUARD_2024_April_22_task_cost_model
@@ -0,0 +1,107 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+
+#ifndef GUARD_2024_April_24_task_trace
+#define GUARD_2024_April_24_task_trace
+
+#include "common/task.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace task
+{
+
+// TaskTrace
+//
+// Timeline of the tasks of a Scheduler::Run.  Each thread appends events to its own
+// chunked buffer which it registers with the trace once.  Appending never locks and
+// never blocks a reader - an event is published by a release increment of the
+// chunk's count so the trace can be exported while stragglers are still running.
+//
+// writeChromeTrace writes the Chrome trace event JSON which chrome://tracing and
+// Perfetto load.  Each worker thread is a track and every task a complete event
+// with its run, queue wait and final state in the args.
+class TaskTrace
+{
+public:
+    using Ptr   = std::shared_ptr< TaskTrace >;
+    using Clock = std::chrono::steady_clock;
+
+    struct Event
+    {
+        // the run which recorded the event - spawned runs share the trace of their
+        // parent and number their tasks from zero so the task alone is ambiguous
+        std::uint32_t m_run    = 0U;
+        std::size_t   m_szTask = 0U;
+        std::string   m_strName;
+        std::string   m_strSource, m_strTarget;
+        Status::State m_state = Status::ePending;
+        // nanoseconds since the trace began
+        std::int64_t  m_enqueueNanoSeconds = 0;
+        std::int64_t  m_startNanoSeconds   = 0;
+        std::int64_t  m_endNanoSeconds     = 0;
+        // index of the recording thread in order of first event
+        std::uint32_t m_thread = 0U;
+    };
+
+    TaskTrace();
+    ~TaskTrace();
+
+    TaskTrace( const TaskTrace& )            = delete;
+    TaskTrace& operator=( const TaskTrace& ) = delete;
+
+    std::int64_t now() const;
+
+    // the id of a further run recording into this trace - the first run is zero
+    std::uint32_t addRun() { return ++m_runs; }
+
+    // from any thread - m_thread is set by the trace
+    void record( Event event );
+
+    // events published so far in no particular order
+    std::vector< Event > getEvents() const;
+
+    void writeChromeTrace( std::ostream& os ) const;
+
+private:
+    struct Chunk;
+    struct ThreadBuffer;
+
+    ThreadBuffer& getThreadBuffer();
+
+    const std::uint64_t     m_traceID;
+    const Clock::time_point m_startTime;
+    std::atomic< std::uint32_t > m_runs{ 0U };
+
+    // only locked when a thread records its first event or the trace is read
+    mutable std::mutex                             m_buffersMutex;
+    std::vector< std::unique_ptr< ThreadBuffer > > m_buffers;
+};
+
+} // namespace task
+
+#endif // GUARD_2024_April_24_task_trace
@@ -0,0 +1,192 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#include "common/async_task.hpp"
+#include "common/assert_verify.hpp"
+#include "common/file.hpp"
+
+#include "boost/asio/io_context.hpp"
+
+#ifdef __cpp_impl_coroutine
+
+namespace task
+{
+
+AsyncTask::Coroutine AsyncTask::Coroutine::promise_type::get_return_object()
+{
+    return Coroutine( Handle::from_promise( *this ) );
+}
+
+AsyncTask::Coroutine::Coroutine( Coroutine&& other ) noexcept
+    : m_handle( other.m_handle )
+{
+    other.m_handle = nullptr;
+}
+
+AsyncTask::Coroutine::~Coroutine()
+{
+    // only a coroutine which was never started is still owned
+    if( m_handle )
+    {
+        m_handle.destroy();
+    }
+}
+
+AsyncTask::AsyncTask( const RawPtrSet& dependencies )
+    : Task( dependencies )
+{
+}
+
+void AsyncTask::start( Progress&                                   progress,
+                       Scheduler*                                  pScheduler,
+                       ScheduleSpawner                             scheduleSpawner,
+                       std::function< void( std::exception_ptr ) > onComplete )
+{
+    Coroutine           coroutine = runAsync( progress );
+    Coroutine::Handle   handle    = coroutine.m_handle;
+    coroutine.m_handle = nullptr;
+    handle.promise().m_pScheduler      = pScheduler;
+    handle.promise().m_scheduleSpawner = std::move( scheduleSpawner );
+    handle.promise().m_onComplete      = std::move( onComplete );
+    handle.resume();
+}
+
+void AsyncTask::run( Progress& progress )
+{
+    std::exception_ptr pException;
+    bool               bComplete = false;
+    start( progress, nullptr, ScheduleSpawner(),
+           [ &pException, &bComplete ]( std::exception_ptr pError )
+           {
+               pException = pError;
+               bComplete  = true;
+           } );
+    VERIFY_RTE_MSG( bComplete, "Async task suspended outside of a scheduler" );
+    if( pException )
+    {
+        std::rethrow_exception( pException );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool CmdAwaitable::await_suspend( AsyncTask::Coroutine::Handle handle )
+{
+    Scheduler* pScheduler = handle.promise().m_pScheduler;
+    if( !pScheduler )
+    {
+        boost::asio::io_context ioContext;
+        common::runCmdAsync( ioContext, m_cmd, [ this ]( common::CommandResult result ) { m_result = std::move( result ); } );
+        ioContext.run();
+        return false;
+    }
+
+    common::runCmdAsync( pScheduler->getIOContext(), m_cmd,
+                         [ this, pScheduler, handle ]( common::CommandResult result )
+                         {
+                             m_result = std::move( result );
+                             pScheduler->post( [ handle ]() { handle.resume(); } );
+                         } );
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void FileAwaitable::read()
+{
+    try
+    {
+        VERIFY_RTE_MSG( boost::filesystem::exists( m_filePath ), "Failed to locate file: " << m_filePath.string() );
+        boost::filesystem::loadAsciiFile( m_filePath, m_strContents, false );
+    }
+    catch( std::exception& )
+    {
+        m_pException = std::current_exception();
+    }
+}
+
+bool FileAwaitable::await_suspend( AsyncTask::Coroutine::Handle handle )
+{
+    Scheduler* pScheduler = handle.promise().m_pScheduler;
+    if( !pScheduler )
+    {
+        read();
+        return false;
+    }
+
+    pScheduler->postBlocking(
+        [ this, pScheduler, handle ]()
+        {
+            read();
+            pScheduler->post( [ handle ]() { handle.resume(); } );
+        } );
+    return true;
+}
+
+std::string FileAwaitable::await_resume()
+{
+    if( m_pException )
+    {
+        std::rethrow_exception( m_pException );
+    }
+    return std::move( m_strContents );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool ScheduleAwaitable::await_suspend( AsyncTask::Coroutine::Handle handle )
+{
+    Scheduler* pScheduler = handle.promise().m_pScheduler;
+    if( !pScheduler )
+    {
+        StatusFIFO fifo;
+        Scheduler  scheduler( fifo );
+        try
+        {
+            m_bResult = scheduler.run( this, m_pSchedule )->wait();
+        }
+        catch( std::exception& )
+        {
+            m_pException = std::current_exception();
+        }
+        return false;
+    }
+
+    m_pRun = handle.promise().m_scheduleSpawner( m_pSchedule );
+    m_pRun->onFinished( [ pScheduler, handle ]() { pScheduler->post( [ handle ]() { handle.resume(); } ); } );
+    return true;
+}
+
+bool ScheduleAwaitable::await_resume()
+{
+    if( m_pException )
+    {
+        std::rethrow_exception( m_pException );
+    }
+    if( m_pRun )
+    {
+        Scheduler::Run::Ptr pRun = std::move( m_pRun );
+        m_bResult                = pRun->wait();
+    }
+    return m_bResult;
+}
+
+} // namespace task
+
+#endif // __cpp_impl_coroutine
@@ -0,0 +1,331 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#include "common/content_hash.hpp"
+#include "common/assert_verify.hpp"
+
+#include <boost/filesystem/fstream.hpp>
+
+#include <charconv>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define COMMON_CONTENT_HASH_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined( _MSC_VER ) && defined( _M_X64 )
+#include <intrin.h>
+#endif
+
+namespace common
+{
+
+void HashCode128::toHexString( std::ostream& os ) const
+{
+    const auto flags = os.flags();
+    os << std::hex << std::setfill( '0' ) << std::setw( 16 ) << m_high << std::setw( 16 ) << m_low;
+    os.flags( flags );
+}
+
+std::string HashCode128::toHexString() const
+{
+    std::ostringstream os;
+    toHexString( os );
+    return os.str();
+}
+
+bool HashCode128::fromHexString( const std::string& strHex, HashCode128& hash )
+{
+    if( strHex.size() != 32U )
+    {
+        return false;
+    }
+    const char* pBegin = strHex.data();
+    const char* pMid   = pBegin + 16;
+    const char* pEnd   = pBegin + 32;
+    const auto  high   = std::from_chars( pBegin, pMid, hash.m_high, 16 );
+    const auto  low    = std::from_chars( pMid, pEnd, hash.m_low, 16 );
+    return high.ec == std::errc() && high.ptr == pMid && low.ec == std::errc() && low.ptr == pEnd;
+}
+
+namespace
+{
+static constexpr std::uint64_t PRIME32_1 = 0x9E3779B1U;
+static constexpr std::uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static constexpr std::uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr std::uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+
+static constexpr std::size_t SECRET_WORDS       = 24U;
+static constexpr std::size_t SECRET_SCRAMBLE    = 16U;
+static constexpr std::size_t SECRET_MERGE_LOW   = 1U;
+static constexpr std::size_t SECRET_MERGE_HIGH  = 11U;
+static constexpr std::uint64_t SECRET_SEED      = 0x6A09E667F3BCC908ULL;
+
+using Secret = std::array< std::uint64_t, SECRET_WORDS >;
+
+constexpr Secret generateSecret()
+{
+    // splitmix64
+    Secret        secret{};
+    std::uint64_t state = SECRET_SEED;
+    for( std::size_t i = 0U; i != SECRET_WORDS; ++i )
+    {
+        state += 0x9E3779B97F4A7C15ULL;
+        std::uint64_t z = state;
+        z               = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+        z               = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+        secret[ i ]     = z ^ ( z >> 31 );
+    }
+    return secret;
+}
+
+alignas( 16 ) static constexpr Secret g_secret = generateSecret();
+
+inline std::uint64_t readLE64( const std::uint8_t* p )
+{
+    std::uint64_t value;
+    std::memcpy( &value, p, sizeof( value ) );
+#if defined( __BYTE_ORDER__ ) && ( __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__ )
+    value = __builtin_bswap64( value );
+#endif
+    return value;
+}
+
+inline std::uint64_t multiplyFold64( std::uint64_t left, std::uint64_t right )
+{
+#if defined( __SIZEOF_INT128__ )
+    const unsigned __int128 product = static_cast< unsigned __int128 >( left ) * right;
+    return static_cast< std::uint64_t >( product ) ^ static_cast< std::uint64_t >( product >> 64 );
+#elif defined( _MSC_VER ) && defined( _M_X64 )
+    std::uint64_t high = 0U;
+    const std::uint64_t low = _umul128( left, right, &high );
+    return low ^ high;
+#else
+    const std::uint64_t lo_lo = ( left & 0xFFFFFFFFU ) * ( right & 0xFFFFFFFFU );
+    const std::uint64_t hi_lo = ( left >> 32 ) * ( right & 0xFFFFFFFFU );
+    const std::uint64_t lo_hi = ( left & 0xFFFFFFFFU ) * ( right >> 32 );
+    const std::uint64_t hi_hi = ( left >> 32 ) * ( right >> 32 );
+    const std::uint64_t cross = ( lo_lo >> 32 ) + ( hi_lo & 0xFFFFFFFFU ) + lo_hi;
+    const std::uint64_t upper = ( hi_lo >> 32 ) + ( cross >> 32 ) + hi_hi;
+    const std::uint64_t lower = ( cross << 32 ) | ( lo_lo & 0xFFFFFFFFU );
+    return lower ^ upper;
+#endif
+}
+
+inline std::uint64_t avalanche( std::uint64_t h )
+{
+    h ^= h >> 37;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+inline std::uint64_t rotateLeft( std::uint64_t value, unsigned int bits )
+{
+    return ( value << bits ) | ( value >> ( 64U - bits ) );
+}
+} // namespace
+
+ContentHash::ContentHash()
+    : m_accumulators{ PRIME32_1, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_1 ^ PRIME64_2, PRIME64_2 ^ PRIME64_3,
+                      PRIME64_3 ^ PRIME32_1, PRIME64_1 ^ PRIME32_1 }
+{
+}
+
+void ContentHash::accumulateStripe( Accumulators& acc, const std::uint8_t* pStripe, std::size_t szStripe )
+{
+    const std::uint64_t* pSecret = g_secret.data() + szStripe;
+#ifdef COMMON_CONTENT_HASH_SSE2
+    for( std::size_t i = 0U; i != ACCUMULATORS; i += 2U )
+    {
+        __m128i*      pAcc    = reinterpret_cast< __m128i* >( acc.data() + i );
+        const __m128i data    = _mm_loadu_si128( reinterpret_cast< const __m128i* >( pStripe + i * 8U ) );
+        const __m128i key     = _mm_loadu_si128( reinterpret_cast< const __m128i* >( pSecret + i ) );
+        const __m128i dataKey = _mm_xor_si128( data, key );
+        // lo32( key ) * hi32( key ) for each 64 bit lane
+        const __m128i product = _mm_mul_epu32( dataKey, _mm_shuffle_epi32( dataKey, _MM_SHUFFLE( 0, 3, 0, 1 ) ) );
+        // swap the 64 bit lanes so acc[ i ^ 1 ] += lane[ i ]
+        const __m128i swapped = _mm_shuffle_epi32( data, _MM_SHUFFLE( 1, 0, 3, 2 ) );
+        _mm_storeu_si128(
+            pAcc, _mm_add_epi64( product, _mm_add_epi64( _mm_loadu_si128( pAcc ), swapped ) ) );
+    }
+#else
+    for( std::size_t i = 0U; i != ACCUMULATORS; ++i )
+    {
+        const std::uint64_t lane = readLE64( pStripe + i * 8U );
+        const std::uint64_t key  = lane ^ pSecret[ i ];
+        acc[ i ^ 1U ] += lane;
+        acc[ i ] += ( key & 0xFFFFFFFFU ) * ( key >> 32 );
+    }
+#endif
+}
+
+void ContentHash::scramble( Accumulators& acc )
+{
+    const std::uint64_t* pSecret = g_secret.data() + SECRET_SCRAMBLE;
+#ifdef COMMON_CONTENT_HASH_SSE2
+    const __m128i prime = _mm_set1_epi32( static_cast< int >( PRIME32_1 ) );
+    for( std::size_t i = 0U; i != ACCUMULATORS; i += 2U )
+    {
+        __m128i*      pAcc  = reinterpret_cast< __m128i* >( acc.data() + i );
+        __m128i       value = _mm_loadu_si128( pAcc );
+        value               = _mm_xor_si128( value, _mm_srli_epi64( value, 47 ) );
+        value = _mm_xor_si128( value, _mm_loadu_si128( reinterpret_cast< const __m128i* >( pSecret + i ) ) );
+        // 64 bit multiply by a 32 bit constant from two 32x32->64 products
+        const __m128i productLow  = _mm_mul_epu32( value, prime );
+        const __m128i productHigh = _mm_mul_epu32( _mm_srli_epi64( value, 32 ), prime );
+        _mm_storeu_si128( pAcc, _mm_add_epi64( productLow, _mm_slli_epi64( productHigh, 32 ) ) );
+    }
+#else
+    for( std::size_t i = 0U; i != ACCUMULATORS; ++i )
+    {
+        std::uint64_t value = acc[ i ];
+        value ^= value >> 47;
+        value ^= pSecret[ i ];
+        acc[ i ] = value * PRIME32_1;
+    }
+#endif
+}
+
+void ContentHash::processBlock( Accumulators& acc, const std::uint8_t* pBlock )
+{
+    for( std::size_t szStripe = 0U; szStripe != STRIPES_PER_BLOCK; ++szStripe )
+    {
+        accumulateStripe( acc, pBlock + szStripe * STRIPE_SIZE, szStripe );
+    }
+    scramble( acc );
+}
+
+void ContentHash::update( const void* pData, std::size_t szSize )
+{
+    const std::uint8_t* pInput = static_cast< const std::uint8_t* >( pData );
+    m_totalLength += szSize;
+
+    // complete any partially buffered block
+    if( m_szBuffered != 0U )
+    {
+        const std::size_t szCopy = std::min( szSize, BLOCK_SIZE - m_szBuffered );
+        std::memcpy( m_buffer.data() + m_szBuffered, pInput, szCopy );
+        m_szBuffered += szCopy;
+        pInput += szCopy;
+        szSize -= szCopy;
+
+        if( m_szBuffered != BLOCK_SIZE )
+        {
+            return;
+        }
+        processBlock( m_accumulators, m_buffer.data() );
+        m_szBuffered = 0U;
+    }
+
+    // process whole blocks directly from the input
+    for( ; szSize >= BLOCK_SIZE; pInput += BLOCK_SIZE, szSize -= BLOCK_SIZE )
+    {
+        processBlock( m_accumulators, pInput );
+    }
+
+    if( szSize != 0U )
+    {
+        std::memcpy( m_buffer.data(), pInput, szSize );
+        m_szBuffered = szSize;
+    }
+}
+
+HashCode128 ContentHash::digest() const
+{
+    Accumulators acc = m_accumulators;
+
+    // remaining whole stripes then the zero padded final stripe
+    std::size_t szStripe = 0U;
+    for( ; ( szStripe + 1U ) * STRIPE_SIZE <= m_szBuffered; ++szStripe )
+    {
+        accumulateStripe( acc, m_buffer.data() + szStripe * STRIPE_SIZE, szStripe );
+    }
+    const std::size_t szRemaining = m_szBuffered - szStripe * STRIPE_SIZE;
+    if( szRemaining != 0U )
+    {
+        std::array< std::uint8_t, STRIPE_SIZE > lastStripe{};
+        std::memcpy( lastStripe.data(), m_buffer.data() + szStripe * STRIPE_SIZE, szRemaining );
+        accumulateStripe( acc, lastStripe.data(), szStripe );
+    }
+
+    HashCode128 result;
+    result.m_low  = m_totalLength * PRIME64_1;
+    result.m_high = ~m_totalLength * PRIME64_2;
+    for( std::size_t i = 0U; i != ACCUMULATORS; i += 2U )
+    {
+        result.m_low += multiplyFold64(
+            acc[ i ] ^ g_secret[ SECRET_MERGE_LOW + i ], acc[ i + 1U ] ^ g_secret[ SECRET_MERGE_LOW + i + 1U ] );
+        result.m_high += multiplyFold64(
+            acc[ i ] ^ g_secret[ SECRET_MERGE_HIGH + i ], acc[ i + 1U ] ^ g_secret[ SECRET_MERGE_HIGH + i + 1U ] );
+    }
+    result.m_low  = avalanche( result.m_low );
+    result.m_high = avalanche( result.m_high );
+    return result;
+}
+
+HashCode128 ContentHash::hash( const void* pData, std::size_t szSize )
+{
+    ContentHash contentHash;
+    contentHash.update( pData, szSize );
+    return contentHash.digest();
+}
+
+HashCode128 ContentHash::widen( std::uint64_t hashCode )
+{
+    return HashCode128{ hashCode, avalanche( multiplyFold64( hashCode ^ g_secret[ 0 ], PRIME64_2 ) ^ PRIME64_1 ) };
+}
+
+HashCode128 ContentHash::combine( const HashCode128& left, const HashCode128& right )
+{
+    HashCode128 result;
+    result.m_low = avalanche(
+        multiplyFold64( left.m_low ^ g_secret[ 2 ], right.m_low ^ g_secret[ 3 ] ) + rotateLeft( left.m_high, 17 ) );
+    result.m_high = avalanche(
+        multiplyFold64( left.m_high ^ g_secret[ 4 ], right.m_high ^ g_secret[ 5 ] ) + rotateLeft( right.m_low, 29 ) );
+    return result;
+}
+
+namespace internal
+{
+void readFileChunks( const boost::filesystem::path&                          file,
+                     const std::function< void( const void*, std::size_t ) >& functor )
+{
+    boost::filesystem::ifstream inputFileStream( file, std::ios_base::in | std::ios_base::binary );
+    VERIFY_RTE_MSG( inputFileStream.good(), "Failed to open file: " << file.string() );
+
+    std::vector< char > buffer( ContentHash::FILE_CHUNK_SIZE );
+    while( inputFileStream )
+    {
+        inputFileStream.read( buffer.data(), buffer.size() );
+        const std::streamsize szRead = inputFileStream.gcount();
+        if( szRead > 0 )
+        {
+            functor( buffer.data(), static_cast< std::size_t >( szRead ) );
+        }
+    }
+    VERIFY_RTE_MSG( inputFileStream.eof(), "Error reading file: " << file.string() );
+}
+} // namespace internal
+
+} // namespace common
@@ -9,6 +9,22 @@ Copyright Deighton Systems Limited (c) 2016
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
 
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined( __linux__ )
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#elif defined( __APPLE__ )
+#include <sys/clonefile.h>
+#endif
+
 #include <exception>
 #include <list>
 #include <fstream>
@@ -315,5 +331,94 @@ bool copyFileIfChanged( const boost::filesystem::path& from, const boost::filesy
     return true;
 }
 
+bool getFileStat( const boost::filesystem::path& filePath, FileStat& fileStat )
+{
+#ifdef _WIN32
+    boost::system::error_code ec;
+    const auto                szSize = boost::filesystem::file_size( filePath, ec );
+    if( ec )
+    {
+        return false;
+    }
+    const std::time_t lastWriteTime = boost::filesystem::last_write_time( filePath, ec );
+    if( ec )
+    {
+        return false;
+    }
+    fileStat.m_device              = 0U;
+    fileStat.m_inode               = 0U;
+    fileStat.m_size                = szSize;
+    fileStat.m_modifiedNanoSeconds = static_cast< std::int64_t >( lastWriteTime ) * 1000000000;
+    return true;
+#else
+    struct stat statResult;
+    if( ::stat( filePath.c_str(), &statResult ) != 0 )
+    {
+        return false;
+    }
+    fileStat.m_device = static_cast< std::uint64_t >( statResult.st_dev );
+    fileStat.m_inode  = static_cast< std::uint64_t >( statResult.st_ino );
+    fileStat.m_size   = static_cast< std::uint64_t >( statResult.st_size );
+#ifdef __APPLE__
+    fileStat.m_modifiedNanoSeconds = static_cast< std::int64_t >( statResult.st_mtimespec.tv_sec ) * 1000000000
+                                     + statResult.st_mtimespec.tv_nsec;
+#else
+    fileStat.m_modifiedNanoSeconds
+        = static_cast< std::int64_t >( statResult.st_mtim.tv_sec ) * 1000000000 + statResult.st_mtim.tv_nsec;
+#endif
+    return true;
+#endif
+}
+
+bool cloneFile( const boost::filesystem::path& from, const boost::filesystem::path& to )
+{
+#if defined( __linux__ ) && defined( FICLONE )
+    const int iSource = ::open( from.c_str(), O_RDONLY | O_CLOEXEC );
+    if( iSource < 0 )
+    {
+        return false;
+    }
+    const int iTarget = ::open( to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666 );
+    if( iTarget < 0 )
+    {
+        ::close( iSource );
+        return false;
+    }
+    const bool bCloned = ::ioctl( iTarget, FICLONE, iSource ) == 0;
+    ::close( iTarget );
+    ::close( iSource );
+    if( !bCloned )
+    {
+        ::unlink( to.c_str() );
+    }
+    return bCloned;
+#elif defined( __APPLE__ )
+    return ::clonefile( from.c_str(), to.c_str(), 0 ) == 0;
+#else
+    return false;
+#endif
+}
+
+void syncFile( const boost::filesystem::path& filePath )
+{
+#ifdef _WIN32
+    // directories cannot be flushed on windows - renames are journaled by the filesystem
+    if( boost::filesystem::is_directory( filePath ) )
+    {
+        return;
+    }
+    const int iFile = ::_open( filePath.string().c_str(), _O_RDWR | _O_BINARY );
+    VERIFY_RTE_MSG( iFile >= 0, "Failed to open file: " << filePath.string() );
+    const int iResult = ::_commit( iFile );
+    ::_close( iFile );
+#else
+    const int iFile = ::open( filePath.c_str(), O_RDONLY | O_CLOEXEC );
+    VERIFY_RTE_MSG( iFile >= 0, "Failed to open file: " << filePath.string() );
+    const int iResult = ::fsync( iFile );
+    ::close( iFile );
+#endif
+    VERIFY_RTE_MSG( iResult == 0, "Failed to sync file: " << filePath.string() );
+}
+
 } // namespace filesystem
 } // namespace boost
\ No newline at end of file
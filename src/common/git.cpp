@@ -25,16 +25,71 @@
 #include "common/assert_verify.hpp"
 
 #include <boost/filesystem.hpp>
+#include <boost/process.hpp>
 
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+#include <iterator>
+#include <optional>
 #include <sstream>
+#include <thread>
 
 namespace git
 {
+namespace
+{
+// requests up to this size fit in the pipe to git however full its output is so are
+// written without a thread
+static constexpr std::size_t MAX_INLINE_REQUEST_BYTES = 4096U;
+
+#ifndef _WIN32
+// a write to a git which has exited fails with EPIPE instead of killing the process
+class BlockSigPipe
+{
+public:
+    BlockSigPipe()
+    {
+        sigset_t signals;
+        sigemptyset( &signals );
+        sigaddset( &signals, SIGPIPE );
+        ::pthread_sigmask( SIG_BLOCK, &signals, &m_previous );
+        sigset_t pending;
+        ::sigpending( &pending );
+        m_bWasPending = sigismember( &pending, SIGPIPE ) == 1;
+    }
+    ~BlockSigPipe()
+    {
+        // discard any SIGPIPE raised while blocked before restoring the mask
+        if( !m_bWasPending )
+        {
+            sigset_t signals;
+            sigemptyset( &signals );
+            sigaddset( &signals, SIGPIPE );
+            const timespec noWait{ 0, 0 };
+            while( ::sigtimedwait( &signals, nullptr, &noWait ) == SIGPIPE )
+            {
+            }
+        }
+        ::pthread_sigmask( SIG_SETMASK, &m_previous, nullptr );
+    }
+
+private:
+    sigset_t m_previous;
+    bool     m_bWasPending = false;
+};
+#else
+struct BlockSigPipe
+{
+};
+#endif
+} // namespace
 
 bool isGitRepo( const boost::filesystem::path& gitDirectory )
 {
     std::ostringstream os;
-    os << "git -C " << gitDirectory.string() << " rev-parse";
+    os << "git -C \"" << gitDirectory.string() << "\" rev-parse";
 
     std::string strOutput, strError;
     const auto  returnValue = common::runProcess( os.str(), strOutput, strError );
@@ -55,41 +110,23 @@ std::vector< std::string > getFileGitHashes( const boost::filesystem::path& gitD
     using namespace std::string_literals;
     static const std::string cmdArgs = R"(--pretty=tformat:"%H" )";
 
-    const auto currentPath = boost::filesystem::current_path();
-
     VERIFY_RTE( boost::filesystem::exists( gitDirectory ) );
     VERIFY_RTE( boost::filesystem::exists( filePath ) );
 
     const auto relPath = boost::filesystem::relative( filePath, gitDirectory );
 
-    std::vector< std::string > result;
-
-    boost::filesystem::current_path( gitDirectory );
-    try
-    {
-        VERIFY_RTE( boost::filesystem::exists( relPath ) );
-
-        std::ostringstream os;
-        os << "git log " << cmdArgs << relPath.string();
-
-        std::string strOutput, strError;
+    std::ostringstream os;
+    os << "git -C \"" << gitDirectory.string() << "\" log " << cmdArgs << "\"" << relPath.string() << "\"";
 
-        const auto returnValue = common::runProcess( os.str(), strOutput, strError );
+    std::string strOutput, strError;
 
-        VERIFY_RTE_MSG(
-            ( returnValue == EXIT_SUCCESS ) && strError.empty(), "Error performing git log command: " << strError );
+    const auto returnValue = common::runProcess( os.str(), strOutput, strError );
 
-        // command generates quotes for each line
-        result = common::simpleTokenise( strOutput, "\"\n" );
-    }
-    catch( std::exception& ex )
-    {
-        boost::filesystem::current_path( currentPath );
-        THROW_RTE( ex.what() );
-    }
-    boost::filesystem::current_path( currentPath );
+    VERIFY_RTE_MSG(
+        ( returnValue == EXIT_SUCCESS ) && strError.empty(), "Error performing git log command: " << strError );
 
-    return result;
+    // command generates quotes for each line
+    return common::simpleTokenise( strOutput, "\"\n" );
 }
 
 std::string getGitFile( const boost::filesystem::path& gitDirectory,
@@ -99,18 +136,116 @@ std::string getGitFile( const boost::filesystem::path& gitDirectory,
     VERIFY_RTE( boost::filesystem::exists( gitDirectory ) );
     VERIFY_RTE( boost::filesystem::exists( filePath ) );
 
-    const auto currentPath = boost::filesystem::current_path();
-    const auto relPath     = boost::filesystem::relative( filePath, gitDirectory );
+    const auto relPath = boost::filesystem::relative( filePath, gitDirectory );
+
+    std::ostringstream os;
+    os << "git -C \"" << gitDirectory.string() << "\" show \"" << strGitHash << ":" << relPath.string() << "\"";
 
-    std::string strContents;
+    std::string strOutput, strError;
 
-    boost::filesystem::current_path( gitDirectory );
-    try
+    const auto returnValue = common::runProcess( os.str(), strOutput, strError );
+
+    VERIFY_RTE_MSG(
+        ( returnValue == EXIT_SUCCESS ) && strError.empty(), "Error performing git show command: " << strError );
+
+    return strOutput;
+}
+
+void commit( const boost::filesystem::path& gitDirectory, const std::string& strMsg )
+{
+    VERIFY_RTE( boost::filesystem::exists( gitDirectory ) );
+
+    std::ostringstream os;
+    os << "git -C \"" << gitDirectory.string() << "\" commit . -m \"" << strMsg << "\"";
+
+    std::string strOutput, strError;
+
+    const auto returnValue = common::runProcess( os.str(), strOutput, strError );
+
+    VERIFY_RTE_MSG(
+        ( returnValue == EXIT_SUCCESS ) && strError.empty(), "Error performing git commit command: " << strError );
+}
+
+struct Session::CatFile
+{
+    CatFile( const boost::filesystem::path& gitDirectory )
+        : m_child( boost::process::search_path( "git" ), "-C", gitDirectory.string(), "cat-file", "--batch",
+                   boost::process::std_in < m_input, boost::process::std_out > m_output,
+                   boost::process::std_err > m_error )
+    {
+    }
+
+    ~CatFile()
     {
-        VERIFY_RTE( boost::filesystem::exists( relPath ) );
+        // git exits at the end of its input
+        m_input.pipe().close();
+        std::error_code ec;
+        m_child.wait( ec );
+    }
+
+    void request( const std::string& strObjectName ) { m_input << strObjectName << '\n'; }
 
+    // once the output has ended git has exited or is exiting so its error is complete
+    std::string getError()
+    {
+        return std::string( std::istreambuf_iterator< char >( m_error ), std::istreambuf_iterator< char >() );
+    }
+
+    // each response is "<object> <type> <size>" then the contents and a newline or
+    // "<object> missing"
+    std::string response( const std::string& strObjectName )
+    {
+        std::string strHeader;
+        VERIFY_RTE_MSG( std::getline( m_output, strHeader ),
+                        "git cat-file exited reading: " << strObjectName << ": " << getError() );
+
+        const auto szSize = strHeader.rfind( ' ' );
+        VERIFY_RTE_MSG( szSize != std::string::npos, "Unexpected git cat-file response: " << strHeader );
+        const std::string strSize = strHeader.substr( szSize + 1U );
+        VERIFY_RTE_MSG( strSize != "missing" && strSize != "ambiguous",
+                        "Could not find " << strObjectName << " in git: " << strSize );
+
+        std::string strContents( std::stoull( strSize ), '\0' );
+        m_output.read( strContents.data(), strContents.size() );
+        m_output.get();
+        VERIFY_RTE_MSG( m_output.good(), "git cat-file exited reading: " << strObjectName << ": " << getError() );
+        return strContents;
+    }
+
+    boost::process::opstream m_input;
+    boost::process::ipstream m_output;
+    boost::process::ipstream m_error;
+    boost::process::child    m_child;
+};
+
+Session::Session( const boost::filesystem::path& gitDirectory )
+    : m_gitDirectory( gitDirectory )
+{
+    VERIFY_RTE_MSG( boost::filesystem::exists( gitDirectory ), "Git directory does not exist: " << gitDirectory.string() );
+
+    std::ostringstream os;
+    os << "git -C \"" << m_gitDirectory.string() << "\" rev-parse --git-dir";
+
+    std::string strOutput, strError;
+
+    const auto returnValue = common::runProcess( os.str(), strOutput, strError );
+
+    VERIFY_RTE_MSG( ( returnValue == EXIT_SUCCESS ) && strError.empty(),
+                    "Not a git repository: " << m_gitDirectory.string() << ": " << strError );
+}
+
+Session::~Session() = default;
+
+std::vector< std::string > Session::getFileGitHashes( const boost::filesystem::path& filePath )
+{
+    std::lock_guard< std::mutex > lock( m_historyMutex );
+    if( !m_history.has_value() )
+    {
+        // every commit as a line of \x01 followed by its hash then the files it changed
+        // relative to the git directory
         std::ostringstream os;
-        os << "git show " << strGitHash << ":" << relPath.string();
+        os << "git -c core.quotePath=false -C \"" << m_gitDirectory.string()
+           << "\" log --relative --no-renames --name-only --pretty=format:%x01%H";
 
         std::string strOutput, strError;
 
@@ -119,43 +254,125 @@ std::string getGitFile( const boost::filesystem::path& gitDirectory,
         VERIFY_RTE_MSG(
             ( returnValue == EXIT_SUCCESS ) && strError.empty(), "Error performing git log command: " << strError );
 
-        // command generates quotes for each line
-        strContents = strOutput;
+        std::map< std::string, std::vector< std::string > > history;
+        std::istringstream                                 is( strOutput );
+        std::string                                        strLine, strCommit;
+        while( std::getline( is, strLine ) )
+        {
+            if( !strLine.empty() && strLine.front() == '\x01' )
+            {
+                strCommit = strLine.substr( 1U );
+            }
+            else if( !strLine.empty() )
+            {
+                history[ strLine ].push_back( strCommit );
+            }
+        }
+        m_history = std::move( history );
     }
-    catch( std::exception& ex )
+
+    auto iFind = m_history->find( boost::filesystem::relative( filePath, m_gitDirectory ).generic_string() );
+    if( iFind != m_history->end() )
     {
-        boost::filesystem::current_path( currentPath );
-        THROW_RTE( ex.what() );
+        return iFind->second;
     }
-    boost::filesystem::current_path( currentPath );
+    return {};
+}
 
-    return strContents;
+void Session::refresh()
+{
+    std::lock_guard< std::mutex > lock( m_historyMutex );
+    m_history.reset();
 }
 
-void commit( const boost::filesystem::path& gitDirectory, const std::string& strMsg )
+std::string Session::getObjectName( const FileRequest& request ) const
 {
-    VERIFY_RTE( boost::filesystem::exists( gitDirectory ) );
+    // ./ makes the path relative to the git directory rather than the top level
+    std::ostringstream os;
+    os << request.second << ":./" << boost::filesystem::relative( request.first, m_gitDirectory ).generic_string();
+    const std::string strObjectName = os.str();
+    VERIFY_RTE_MSG( strObjectName.find( '\n' ) == std::string::npos, "Invalid git object name: " << strObjectName );
+    return strObjectName;
+}
+
+std::string Session::getGitFile( const boost::filesystem::path& filePath, const std::string& strGitHash )
+{
+    return getGitFiles( { FileRequest{ filePath, strGitHash } } ).front();
+}
 
-    const auto currentPath = boost::filesystem::current_path();
-    boost::filesystem::current_path( gitDirectory );
-    try
+std::vector< std::string > Session::getGitFiles( const std::vector< FileRequest >& requests )
+{
+    std::vector< std::string > objectNames;
+    for( const FileRequest& request : requests )
     {
-        std::ostringstream os;
-        os << "git commit . -m \"" << strMsg << "\"";
+        objectNames.push_back( getObjectName( request ) );
+    }
 
-        std::string strOutput, strError;
+    std::lock_guard< std::mutex > lock( m_catFileMutex );
+    if( !m_pCatFile )
+    {
+        m_pCatFile = std::make_unique< CatFile >( m_gitDirectory );
+    }
 
-        const auto returnValue = common::runProcess( os.str(), strOutput, strError );
+    auto writeRequests = [ this, &objectNames ]()
+    {
+        BlockSigPipe blockSigPipe;
+        for( const std::string& strObjectName : objectNames )
+        {
+            m_pCatFile->request( strObjectName );
+        }
+        m_pCatFile->m_input.flush();
+    };
+
+    // a large batch is written from another thread so that git never blocks on a full
+    // output pipe while this thread is still writing
+    std::size_t szRequestBytes = 0U;
+    for( const std::string& strObjectName : objectNames )
+    {
+        szRequestBytes += strObjectName.size() + 1U;
+    }
+    std::optional< std::thread > writer;
+    if( szRequestBytes <= MAX_INLINE_REQUEST_BYTES )
+    {
+        writeRequests();
+    }
+    else
+    {
+        writer.emplace( writeRequests );
+    }
 
-        VERIFY_RTE_MSG(
-            ( returnValue == EXIT_SUCCESS ) && strError.empty(), "Error performing git commit command: " << strError );
+    // read every response to keep the process in step even when some fail
+    std::vector< std::string > results;
+    std::optional< std::string > error;
+    bool                         bFailed = false;
+    for( const std::string& strObjectName : objectNames )
+    {
+        try
+        {
+            results.push_back( bFailed ? std::string() : m_pCatFile->response( strObjectName ) );
+        }
+        catch( std::exception& ex )
+        {
+            if( !error.has_value() )
+            {
+                error = ex.what();
+            }
+            bFailed = !m_pCatFile->m_output.good();
+            results.push_back( std::string() );
+        }
     }
-    catch( std::exception& ex )
+    if( writer.has_value() )
+    {
+        writer->join();
+    }
+
+    if( bFailed )
     {
-        boost::filesystem::current_path( currentPath );
-        THROW_RTE( ex.what() );
+        // start a new process on the next request
+        m_pCatFile.reset();
     }
-    boost::filesystem::current_path( currentPath );
+    VERIFY_RTE_MSG( !error.has_value(), error.value() );
+    return results;
 }
 
-} // namespace git
\ No newline at end of file
+} // namespace git
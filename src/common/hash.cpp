@@ -1,47 +1,51 @@
 
 #include "common/hash.hpp"
+#include "common/content_hash.hpp"
+#include "common/hash_memo.hpp"
+#include "common/file.hpp"
 #include "common/assert_verify.hpp"
 
 #include "boost/filesystem.hpp"
-#include "boost/iostreams/device/mapped_file.hpp"
-#include <boost/functional/hash.hpp>
 
 namespace common
 {
 namespace internal
 {
-HashCodeType hash_file( const boost::filesystem::path& file )
+HashCode128 hash_file128( const boost::filesystem::path& file )
 {
-    if ( boost::filesystem::exists( file ) )
+    boost::filesystem::FileStat fileStat;
+    if ( boost::filesystem::getFileStat( file, fileStat ) )
     {
-        // error seems to occur if attempt to memory map an empty file
-        if ( boost::filesystem::is_empty( file ) )
+        FileHashMemo& memo = FileHashMemo::get();
+        if( const std::optional< HashCode128 > digest = memo.find( file, fileStat ) )
+        {
+            return digest.value();
+        }
+        try
         {
-            return boost::filesystem::hash_value( file );
+            const HashCode128 digest = hashFileContents< ContentHash >( file );
+            memo.insert( file, fileStat, digest );
+            return digest;
         }
-        else
+        catch ( std::ios_base::failure& ex )
         {
-            try
-            {
-                boost::iostreams::mapped_file_source fileData( file );
-                const std::string_view               dataView( fileData.data(), fileData.size() );
-                return std::hash< std::string_view >{}( dataView );
-            }
-            catch ( std::ios_base::failure& ex )
-            {
-                THROW_RTE( "File error hashing: " << file.string() << " exception: " << ex.what() );
-            }
-            catch ( std::exception& ex )
-            {
-                THROW_RTE( "File error hashing: " << file.string() << " exception: " << ex.what() );
-            }
-            catch( ... )
-            {
-                THROW_RTE( "File error hashing: " << file.string() << " exception: unknown" );
-            }
+            THROW_RTE( "File error hashing: " << file.string() << " exception: " << ex.what() );
+        }
+        catch ( std::exception& ex )
+        {
+            THROW_RTE( "File error hashing: " << file.string() << " exception: " << ex.what() );
+        }
+        catch( ... )
+        {
+            THROW_RTE( "File error hashing: " << file.string() << " exception: unknown" );
         }
     }
     THROW_RTE( "File does not exist: " << file.string() );
 }
+
+HashCodeType hash_file( const boost::filesystem::path& file )
+{
+    return hash_file128( file ).fold();
+}
 } // namespace internal
 } // namespace common
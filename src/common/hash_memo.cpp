@@ -0,0 +1,186 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#include "common/hash_memo.hpp"
+#include "common/assert_verify.hpp"
+
+#include "record_file.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <mutex>
+
+namespace common
+{
+namespace
+{
+// memo file records are each followed by their path
+static constexpr char          MEMO_MAGIC[ 8 ] = { 'E', 'D', 'S', 'H', 'M', 'E', 'M', 'O' };
+static constexpr std::uint32_t MEMO_VERSION    = 1U;
+
+struct Record
+{
+    std::uint64_t m_device;
+    std::uint64_t m_inode;
+    std::uint64_t m_size;
+    std::int64_t  m_modifiedNanoSeconds;
+    std::uint64_t m_digestLow;
+    std::uint64_t m_digestHigh;
+    std::uint32_t m_pathLength;
+    std::uint32_t m_reserved;
+};
+
+static_assert( sizeof( Record ) == 56U, "Unexpected memo record size" );
+
+inline bool operator==( const boost::filesystem::FileStat& left, const boost::filesystem::FileStat& right )
+{
+    return left.m_device == right.m_device && left.m_inode == right.m_inode && left.m_size == right.m_size
+           && left.m_modifiedNanoSeconds == right.m_modifiedNanoSeconds;
+}
+} // namespace
+
+FileHashMemo& FileHashMemo::get()
+{
+    static FileHashMemo memo;
+    return memo;
+}
+
+FileHashMemo::FileHashMemo() = default;
+
+FileHashMemo::~FileHashMemo()
+{
+    try
+    {
+        flush();
+    }
+    catch( std::exception& )
+    {
+        // the memo is only a cache
+    }
+}
+
+void FileHashMemo::open( const boost::filesystem::path& memoFile )
+{
+    load( memoFile );
+    std::unique_lock< std::shared_mutex > lock( m_mutex );
+    m_memoFile = memoFile;
+}
+
+void FileHashMemo::flush()
+{
+    std::optional< boost::filesystem::path > memoFile;
+    {
+        std::unique_lock< std::shared_mutex > lock( m_mutex );
+        if( !m_bModified )
+        {
+            return;
+        }
+        memoFile    = m_memoFile;
+        m_bModified = false;
+    }
+    if( memoFile.has_value() )
+    {
+        save( memoFile.value() );
+    }
+}
+
+void FileHashMemo::load( const boost::filesystem::path& memoFile )
+{
+    // an unknown, older or corrupt memo is rebuilt from scratch
+    RecordFileReader< Record > reader( memoFile, MEMO_MAGIC, MEMO_VERSION );
+
+    EntryMap entries;
+    entries.reserve( reader.getCount() );
+    for( std::uint64_t i = 0U; i != reader.getCount(); ++i )
+    {
+        Record      record;
+        std::string strPath;
+        if( !reader.read( record ) || !reader.readPadded( record.m_pathLength, strPath ) )
+        {
+            return;
+        }
+        Entry entry{ boost::filesystem::FileStat{
+                         record.m_device, record.m_inode, record.m_size, record.m_modifiedNanoSeconds },
+                     HashCode128{ record.m_digestLow, record.m_digestHigh } };
+        entries.insert( std::make_pair( std::move( strPath ), entry ) );
+    }
+
+    std::unique_lock< std::shared_mutex > lock( m_mutex );
+    m_entries.merge( entries );
+}
+
+void FileHashMemo::save( const boost::filesystem::path& memoFile ) const
+{
+    std::shared_lock< std::shared_mutex > lock( m_mutex );
+    RecordFileWriter                      writer( MEMO_MAGIC, MEMO_VERSION, m_entries.size(), sizeof( Record ) );
+    for( const auto& [ strPath, entry ] : m_entries )
+    {
+        writer.write( Record{ entry.m_stat.m_device,
+                              entry.m_stat.m_inode,
+                              entry.m_stat.m_size,
+                              entry.m_stat.m_modifiedNanoSeconds,
+                              entry.m_digest.m_low,
+                              entry.m_digest.m_high,
+                              static_cast< std::uint32_t >( strPath.size() ),
+                              0U } );
+        writer.writePadded( strPath );
+    }
+    lock.unlock();
+    writer.save( memoFile );
+}
+
+std::optional< HashCode128 > FileHashMemo::find( const boost::filesystem::path&     file,
+                                                 const boost::filesystem::FileStat& fileStat ) const
+{
+    std::shared_lock< std::shared_mutex > lock( m_mutex );
+    EntryMap::const_iterator              iFind = m_entries.find( file.string() );
+    if( iFind != m_entries.end() && iFind->second.m_stat == fileStat )
+    {
+        return iFind->second.m_digest;
+    }
+    return std::optional< HashCode128 >();
+}
+
+void FileHashMemo::insert( const boost::filesystem::path&     file,
+                           const boost::filesystem::FileStat& fileStat,
+                           const HashCode128&                 digest )
+{
+    if( nowNanoSeconds() - fileStat.m_modifiedNanoSeconds < RACY_NANOSECONDS )
+    {
+        return;
+    }
+    std::unique_lock< std::shared_mutex > lock( m_mutex );
+    m_entries[ file.string() ] = Entry{ fileStat, digest };
+    m_bModified                = true;
+}
+
+void FileHashMemo::clear()
+{
+    std::unique_lock< std::shared_mutex > lock( m_mutex );
+    m_entries.clear();
+    m_bModified = true;
+}
+
+std::size_t FileHashMemo::size() const
+{
+    std::shared_lock< std::shared_mutex > lock( m_mutex );
+    return m_entries.size();
+}
+
+} // namespace common
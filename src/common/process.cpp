@@ -19,11 +19,35 @@
 //  OF THE POSSIBILITY OF SUCH DAMAGES.
 
 #include "common/process.hpp"
+#include "common/spawn_server.hpp"
 
 #include <boost/process.hpp>
 
+#include <boost/asio/bind_executor.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
 
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+#ifdef __linux__
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <string>
 #include <future>
 #include <sstream>
@@ -34,6 +58,16 @@ namespace common
     
 int runProcess( const std::string& strCmd, std::string& strOutput, std::string& strError )
 {
+#ifndef _WIN32
+    if( SpawnServer* pServer = SpawnServer::get() )
+    {
+        CommandResult result = pServer->run( Command{ strCmd, {} } );
+        strOutput            = std::move( result.m_strOutput );
+        strError             = std::move( result.m_strError );
+        return strError.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+#endif
+
     namespace bp = boost::process;
 
     std::future< std::string > output, error;
@@ -81,6 +115,16 @@ std::string Command::str() const
 
 int runCmd( const Command& cmd, std::string& strOutput, std::string& strError )
 {
+#ifndef _WIN32
+    if( SpawnServer* pServer = SpawnServer::get() )
+    {
+        CommandResult result = pServer->run( cmd );
+        strOutput            = std::move( result.m_strOutput );
+        strError             = std::move( result.m_strError );
+        return strError.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+#endif
+
     namespace bp = boost::process;
 
     std::future< std::string > output, error;
@@ -129,4 +173,248 @@ int runCmd( const Command& cmd, std::string& strOutput, std::string& strError )
     }
 #endif
 }
-}
\ No newline at end of file
+
+namespace
+{
+class AsyncCommand : public CommandHandle, public std::enable_shared_from_this< AsyncCommand >
+{
+public:
+    using Ptr = std::shared_ptr< AsyncCommand >;
+
+    AsyncCommand( boost::asio::io_context& ioContext, CommandCallbacks callbacks )
+        : m_strand( boost::asio::make_strand( ioContext ) )
+        , m_output( ioContext, std::move( callbacks.m_onOutput ), m_result.m_strOutput )
+        , m_error( ioContext, std::move( callbacks.m_onError ), m_result.m_strError )
+        , m_timer( ioContext )
+#ifdef __linux__
+        , m_childExit( ioContext )
+#endif
+        , m_onComplete( std::move( callbacks.m_onComplete ) )
+    {
+    }
+
+    void start( const Command& cmd );
+
+    int  getPID() const override { return m_pid; }
+    bool hasCompleted() const override { return m_bCompleted.load( std::memory_order_acquire ); }
+    void terminate() override;
+
+private:
+    static constexpr std::size_t CHUNK_SIZE = 8192U;
+
+    // waiting for a child which has closed its output backs off up to this interval
+    // unless the exit can be waited for directly
+    static constexpr std::chrono::milliseconds MAX_POLL_INTERVAL{ 50 };
+
+    struct Stream
+    {
+        Stream( boost::asio::io_context& ioContext, CommandCallbacks::ChunkFunctor onChunk, std::string& strResult )
+            : m_pipe( ioContext )
+            , m_onChunk( std::move( onChunk ) )
+            , m_strResult( strResult )
+        {
+        }
+
+        boost::process::async_pipe     m_pipe;
+        std::array< char, CHUNK_SIZE > m_buffer;
+        CommandCallbacks::ChunkFunctor m_onChunk;
+        std::string&                   m_strResult;
+    };
+
+    void read( Stream& stream );
+    void reap();
+
+    using Strand = boost::asio::strand< boost::asio::io_context::executor_type >;
+
+    Strand                                 m_strand;
+    CommandResult                          m_result;
+    Stream                                 m_output;
+    Stream                                 m_error;
+    boost::asio::steady_timer              m_timer;
+    std::chrono::milliseconds              m_pollInterval{ 1 };
+#ifdef __linux__
+    // pidfd of the child which becomes readable once it exits - so only this command
+    // wakes and no process wide SIGCHLD handler is needed
+    boost::asio::posix::stream_descriptor  m_childExit;
+#endif
+    std::function< void( CommandResult ) > m_onComplete;
+    boost::process::child                  m_child;
+    int                                    m_pid        = 0;
+    int                                    m_openPipes  = 2;
+    bool                                   m_bReaped    = false;
+    std::atomic< bool >                    m_bCompleted = false;
+};
+
+void AsyncCommand::start( const Command& cmd )
+{
+    namespace bp = boost::process;
+
+    if( cmd.m_environmentVars.empty() )
+    {
+        m_child = bp::child( cmd.m_strCmd, bp::std_in.close(), bp::std_out > m_output.m_pipe, bp::std_err > m_error.m_pipe );
+    }
+    else
+    {
+        bp::environment env_ = boost::this_process::environment();
+        {
+            for( const auto& [ key, value ] : cmd.m_environmentVars )
+            {
+                env_[ key ] = value;
+            }
+        }
+        m_child = bp::child(
+            cmd.m_strCmd, env_, bp::std_in.close(), bp::std_out > m_output.m_pipe, bp::std_err > m_error.m_pipe );
+    }
+    m_pid = m_child.id();
+#ifndef _WIN32
+    // the child is reaped by wait4 to collect its resource usage
+    m_child.detach();
+#endif
+#ifdef __linux__
+    // the unreaped child keeps its pid so the pidfd refers to it even if it has exited
+    const int childExit = static_cast< int >( ::syscall( SYS_pidfd_open, m_pid, 0 ) );
+    if( childExit >= 0 )
+    {
+        m_childExit.assign( childExit );
+    }
+#endif
+
+    read( m_output );
+    read( m_error );
+}
+
+void AsyncCommand::read( Stream& stream )
+{
+    stream.m_pipe.async_read_some(
+        boost::asio::buffer( stream.m_buffer ),
+        boost::asio::bind_executor(
+            m_strand,
+            [ pThis = shared_from_this(), &stream ]( const boost::system::error_code& ec, std::size_t szRead )
+            {
+                if( szRead != 0U )
+                {
+                    if( stream.m_onChunk )
+                    {
+                        stream.m_onChunk( std::string_view( stream.m_buffer.data(), szRead ) );
+                    }
+                    else
+                    {
+                        stream.m_strResult.append( stream.m_buffer.data(), szRead );
+                    }
+                }
+                if( !ec )
+                {
+                    pThis->read( stream );
+                }
+                else if( --pThis->m_openPipes == 0 )
+                {
+                    // end of file on both pipes
+                    pThis->reap();
+                }
+            } ) );
+}
+
+void AsyncCommand::reap()
+{
+    bool bExited = true;
+#ifdef _WIN32
+    std::error_code ec;
+    if( m_child.running( ec ) )
+    {
+        bExited = false;
+    }
+    else
+    {
+        m_result.m_exitCode = m_child.exit_code();
+    }
+#else
+    int           status = 0;
+    struct rusage usage;
+    const pid_t   result = ::wait4( m_pid, &status, WNOHANG, &usage );
+    if( result == 0 )
+    {
+        bExited = false;
+    }
+    else if( result == m_pid )
+    {
+        m_result.m_exitCode = WIFEXITED( status ) ? WEXITSTATUS( status ) : 128 + WTERMSIG( status );
+        m_result.m_usage.m_userSeconds   = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0;
+        m_result.m_usage.m_systemSeconds = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+        // ru_maxrss is in kilobytes on linux
+        m_result.m_usage.m_maxResidentBytes = static_cast< std::uint64_t >( usage.ru_maxrss ) * 1024U;
+    }
+    else
+    {
+        m_result.m_exitCode = EXIT_FAILURE;
+    }
+#endif
+
+    if( !bExited )
+    {
+#ifdef __linux__
+        if( m_childExit.is_open() )
+        {
+            m_childExit.async_wait(
+                boost::asio::posix::stream_descriptor::wait_read,
+                boost::asio::bind_executor(
+                    m_strand, [ pThis = shared_from_this() ]( const boost::system::error_code& ) { pThis->reap(); } ) );
+            return;
+        }
+#endif
+        // without pidfd_open such as before linux 5.3
+        m_timer.expires_after( m_pollInterval );
+        m_pollInterval = std::min( m_pollInterval * 2, MAX_POLL_INTERVAL );
+        m_timer.async_wait( boost::asio::bind_executor(
+            m_strand, [ pThis = shared_from_this() ]( const boost::system::error_code& ) { pThis->reap(); } ) );
+        return;
+    }
+
+    m_bReaped = true;
+#ifdef __linux__
+    boost::system::error_code ec;
+    m_childExit.close( ec );
+#endif
+    m_bCompleted.store( true, std::memory_order_release );
+    if( m_onComplete )
+    {
+        m_onComplete( std::move( m_result ) );
+    }
+}
+
+void AsyncCommand::terminate()
+{
+    // on the strand so the process cannot have been reaped and its pid reused
+    boost::asio::post( m_strand,
+                       [ pThis = shared_from_this() ]()
+                       {
+                           if( !pThis->m_bReaped )
+                           {
+#ifdef _WIN32
+                               std::error_code ec;
+                               pThis->m_child.terminate( ec );
+#else
+                               ::kill( pThis->m_pid, SIGKILL );
+#endif
+                           }
+                       } );
+}
+
+} // namespace
+
+CommandHandle::Ptr startCmd( boost::asio::io_context& ioContext, const Command& cmd, CommandCallbacks callbacks )
+{
+    AsyncCommand::Ptr pCommand = std::make_shared< AsyncCommand >( ioContext, std::move( callbacks ) );
+    pCommand->start( cmd );
+    return pCommand;
+}
+
+void runCmdAsync( boost::asio::io_context&               ioContext,
+                  const Command&                         cmd,
+                  std::function< void( CommandResult ) > onComplete )
+{
+    CommandCallbacks callbacks;
+    callbacks.m_onComplete = std::move( onComplete );
+    startCmd( ioContext, cmd, std::move( callbacks ) );
+}
+
+} // namespace common
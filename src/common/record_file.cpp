@@ -0,0 +1,48 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#include "record_file.hpp"
+
+#include "common/file.hpp"
+#include "common/assert_verify.hpp"
+
+#include <boost/filesystem/operations.hpp>
+
+namespace common
+{
+
+boost::filesystem::path getTemporaryFile( const boost::filesystem::path& file )
+{
+    return file.string() + boost::filesystem::unique_path( ".%%%%-%%%%.tmp" ).string();
+}
+
+void replaceFile( const boost::filesystem::path& file, const std::string& strData )
+{
+    const boost::filesystem::path tempFile = getTemporaryFile( file );
+    boost::filesystem::ensureFoldersExist( tempFile );
+    {
+        std::unique_ptr< boost::filesystem::ofstream > pFileStream
+            = boost::filesystem::createBinaryOutputFileStream( tempFile );
+        pFileStream->write( strData.data(), strData.size() );
+        VERIFY_RTE_MSG( pFileStream->good(), "Failed to write file: " << tempFile.string() );
+    }
+    boost::filesystem::rename( tempFile, file );
+}
+
+} // namespace common
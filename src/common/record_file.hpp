@@ -0,0 +1,174 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#ifndef GUARD_2024_April_30_record_file
+#define GUARD_2024_April_30_record_file
+
+#include "boost/filesystem/operations.hpp"
+#include "boost/filesystem/path.hpp"
+#include "boost/iostreams/device/mapped_file.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace common
+{
+
+inline std::size_t padded( std::size_t szSize )
+{
+    return ( szSize + 7U ) & ~std::size_t( 7U );
+}
+
+inline std::int64_t nowNanoSeconds()
+{
+    return std::chrono::duration_cast< std::chrono::nanoseconds >(
+               std::chrono::system_clock::now().time_since_epoch() )
+        .count();
+}
+
+// a uniquely named temporary beside the file so concurrent writers never collide
+boost::filesystem::path getTemporaryFile( const boost::filesystem::path& file );
+
+// write the data to a temporary and rename it over the file so that neither a reader nor
+// a crash ever sees a partially written file
+void replaceFile( const boost::filesystem::path& file, const std::string& strData );
+
+// Record files
+//
+// Small binary files of host byte order used for caches which are loaded whole
+//
+//     RecordFileHeader
+//     Record optionally followed by bytes padded to 8 - repeated m_count times
+//
+// A file of a different magic or version is ignored so the cache is rebuilt.
+struct RecordFileHeader
+{
+    char          m_magic[ 8 ];
+    std::uint32_t m_version;
+    std::uint32_t m_reserved;
+    std::uint64_t m_count;
+};
+static_assert( sizeof( RecordFileHeader ) == 24U, "Unexpected record file header size" );
+
+class RecordFileWriter
+{
+public:
+    RecordFileWriter( const char ( &magic )[ 8 ], std::uint32_t version, std::uint64_t count, std::size_t szRecordSize )
+    {
+        RecordFileHeader header;
+        std::memcpy( header.m_magic, magic, sizeof( header.m_magic ) );
+        header.m_version  = version;
+        header.m_reserved = 0U;
+        header.m_count    = count;
+        m_strData.reserve( sizeof( RecordFileHeader ) + count * szRecordSize );
+        write( header );
+    }
+
+    template < typename Record >
+    void write( const Record& record )
+    {
+        m_strData.append( reinterpret_cast< const char* >( &record ), sizeof( Record ) );
+    }
+
+    void writePadded( const std::string& strBytes )
+    {
+        m_strData.append( strBytes );
+        m_strData.append( padded( strBytes.size() ) - strBytes.size(), '\0' );
+    }
+
+    void save( const boost::filesystem::path& file ) const { replaceFile( file, m_strData ); }
+
+private:
+    std::string m_strData;
+};
+
+// reads nothing unless the file has the magic and version and room for every record
+template < typename Record >
+class RecordFileReader
+{
+public:
+    RecordFileReader( const boost::filesystem::path& file, const char ( &magic )[ 8 ], std::uint32_t version )
+    {
+        boost::system::error_code ec;
+        if( !boost::filesystem::exists( file, ec ) || boost::filesystem::is_empty( file, ec ) )
+        {
+            return;
+        }
+        try
+        {
+            m_fileData.open( file );
+        }
+        catch( std::exception& )
+        {
+            return;
+        }
+        if( m_fileData.size() < sizeof( RecordFileHeader ) )
+        {
+            return;
+        }
+        std::memcpy( &m_header, m_fileData.data(), sizeof( RecordFileHeader ) );
+        m_pData = m_fileData.data() + sizeof( RecordFileHeader );
+        m_pEnd  = m_fileData.data() + m_fileData.size();
+        m_bValid
+            = std::memcmp( m_header.m_magic, magic, sizeof( m_header.m_magic ) ) == 0 && m_header.m_version == version
+              && m_header.m_count <= ( m_fileData.size() - sizeof( RecordFileHeader ) ) / sizeof( Record );
+    }
+
+    bool          isValid() const { return m_bValid; }
+    std::uint64_t getCount() const { return m_bValid ? m_header.m_count : 0U; }
+    bool          atEnd() const { return m_pData == m_pEnd; }
+
+    bool read( Record& record )
+    {
+        if( static_cast< std::size_t >( m_pEnd - m_pData ) < sizeof( Record ) )
+        {
+            return false;
+        }
+        std::memcpy( &record, m_pData, sizeof( Record ) );
+        m_pData += sizeof( Record );
+        return true;
+    }
+
+    // the padding of the final bytes may be missing
+    bool readPadded( std::size_t szLength, std::string& strBytes )
+    {
+        const std::size_t szRemaining = m_pEnd - m_pData;
+        if( szLength > szRemaining )
+        {
+            return false;
+        }
+        strBytes.assign( m_pData, szLength );
+        m_pData += std::min( padded( szLength ), szRemaining );
+        return true;
+    }
+
+private:
+    boost::iostreams::mapped_file_source m_fileData;
+    RecordFileHeader                     m_header;
+    const char*                          m_pData  = nullptr;
+    const char*                          m_pEnd   = nullptr;
+    bool                                 m_bValid = false;
+};
+
+} // namespace common
+
+#endif // GUARD_2024_April_30_record_file
@@ -1,13 +1,20 @@
 
 #include "common/scheduler.hpp"
+#include "common/async_task.hpp"
 #include "common/assert_verify.hpp"
 #include "common/terminal.hpp"
 
+#include "work_stealing_pool.hpp"
+
 #include "boost/current_function.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <functional>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
+#include <unordered_map>
 
 namespace task
 {
@@ -16,31 +23,130 @@ namespace task
 ///////////////////////////////////////////////////////////////////////////////
 Schedule::Schedule( const Task::PtrVector& tasks )
     : m_tasks( tasks )
+    , m_nodes( tasks.size() )
 {
+    std::unordered_map< Task::RawPtr, std::size_t > indices;
+    indices.reserve( m_tasks.size() );
+    for( std::size_t szIndex = 0U; szIndex != m_tasks.size(); ++szIndex )
+    {
+        m_nodes[ szIndex ].m_pTask = m_tasks[ szIndex ].get();
+        VERIFY_RTE_MSG( indices.insert( std::make_pair( m_tasks[ szIndex ].get(), szIndex ) ).second,
+                        "Duplicate task in schedule" );
+    }
+
+    for( std::size_t szIndex = 0U; szIndex != m_nodes.size(); ++szIndex )
+    {
+        Node& node = m_nodes[ szIndex ];
+        for( Task::RawPtr pDependency : node.m_pTask->getDependencies() )
+        {
+            auto iFind = indices.find( pDependency );
+            VERIFY_RTE_MSG( iFind != indices.end(), "Task dependency is not in the schedule" );
+            m_nodes[ iFind->second ].m_successors.push_back( szIndex );
+        }
+        node.m_dependencyCount = node.m_pTask->getDependencies().size();
+        if( node.m_dependencyCount == 0U )
+        {
+            m_roots.push_back( szIndex );
+        }
+    }
+
+    // a cycle would leave its tasks pending forever
+    {
+        std::vector< std::size_t > dependencyCounts( m_nodes.size() );
+        std::vector< std::size_t > ready     = m_roots;
+        std::size_t                szVisited = 0U;
+        m_order.reserve( m_nodes.size() );
+        for( std::size_t szIndex = 0U; szIndex != m_nodes.size(); ++szIndex )
+        {
+            dependencyCounts[ szIndex ] = m_nodes[ szIndex ].m_dependencyCount;
+        }
+        while( !ready.empty() )
+        {
+            const std::size_t szIndex = ready.back();
+            ready.pop_back();
+            m_order.push_back( szIndex );
+            ++szVisited;
+            for( std::size_t szSuccessor : m_nodes[ szIndex ].m_successors )
+            {
+                if( --dependencyCounts[ szSuccessor ] == 0U )
+                {
+                    ready.push_back( szSuccessor );
+                }
+            }
+        }
+        VERIFY_RTE_MSG( szVisited == m_nodes.size(), "Schedule contains a dependency cycle" );
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
-Scheduler::Run::Run( Scheduler& scheduler, Owner pOwner, Schedule::Ptr pSchedule )
+Scheduler::Run::Run( Scheduler& scheduler, Owner pOwner, Schedule::Ptr pSchedule, Ptr pParent )
     : m_scheduler( scheduler )
     , m_pOwner( pOwner )
     , m_pSchedule( pSchedule )
-    , m_bStarted( false )
-    , m_bCancelled( false )
-    , m_bFinished( false )
-    , m_bComplete( false )
+    , m_pParent( pParent )
+    , m_dependencyCounts( pSchedule->getNodes().size() )
+    , m_remaining( pSchedule->getNodes().size() )
+    , m_state( 0U )
     , m_future( m_promise.get_future() )
 {
-    for( Task::Ptr pTask : m_pSchedule->getTasks() )
+    const Schedule::NodeVector& nodes = m_pSchedule->getNodes();
+    for( std::size_t szIndex = 0U; szIndex != nodes.size(); ++szIndex )
     {
-        m_pending.insert( pTask.get() );
+        m_dependencyCounts[ szIndex ].store( nodes[ szIndex ].m_dependencyCount, std::memory_order_relaxed );
+    }
+
+    if( const TaskCostModel::Ptr pCostModel = m_scheduler.m_pCostModel )
+    {
+        // upward rank - each task's cost plus the highest rank of its successors
+        m_identities.resize( nodes.size() );
+        m_costs.resize( nodes.size() );
+        m_ranks.resize( nodes.size() );
+        const std::vector< std::size_t >& order = m_pSchedule->getOrder();
+        for( auto i = order.rbegin(), iEnd = order.rend(); i != iEnd; ++i )
+        {
+            const Schedule::Node& node = nodes[ *i ];
+            m_identities[ *i ]         = node.m_pTask->getIdentity();
+            double successorRank       = 0.0;
+            for( std::size_t szSuccessor : node.m_successors )
+            {
+                successorRank = std::max( successorRank, m_ranks[ szSuccessor ] );
+            }
+            m_costs[ *i ] = pCostModel->estimate( m_identities[ *i ] );
+            m_ranks[ *i ] = m_costs[ *i ] + successorRank;
+        }
+    }
+
+    bool bResourceBudget = false;
+    {
+        std::lock_guard< std::mutex > lock( m_scheduler.m_resourceMutex );
+        bResourceBudget = m_scheduler.m_resourceBudget.has_value();
+    }
+    if( m_scheduler.m_pStash )
+    {
+        m_pStash = m_scheduler.m_pStash;
+        m_stashKeys.resize( nodes.size() );
+    }
+    if( m_scheduler.m_bTracing )
+    {
+        // spawned tasks appear on the timeline of the run which spawned them
+        m_pTrace = m_pParent ? m_pParent->m_pTrace : std::make_shared< TaskTrace >();
+        m_traceRun = m_pParent ? m_pTrace->addRun() : 0U;
+        m_readyNanoSeconds.resize( nodes.size() );
+    }
+    if( bResourceBudget )
+    {
+        m_resources.reserve( nodes.size() );
+        for( const Schedule::Node& node : nodes )
+        {
+            m_resources.push_back( node.m_pTask->getResources() );
+        }
     }
 }
 
 bool Scheduler::Run::isCancelled() const
 {
-    std::lock_guard< std::recursive_mutex > lock( m_mutex );
-    return m_bCancelled;
+    return ( m_state.load( std::memory_order_acquire ) & eCancelled ) != 0U;
 }
 
 bool Scheduler::Run::wait()
@@ -55,28 +161,48 @@ bool Scheduler::Run::wait()
     }
 }
 
+void Scheduler::Run::setStarted()
+{
+    m_state.fetch_or( eStarted, std::memory_order_acq_rel );
+}
+
 void Scheduler::Run::complete()
 {
-    Run::Ptr pThis = shared_from_this();
+    if( ( m_state.fetch_or( eComplete, std::memory_order_acq_rel ) & eComplete ) == 0U )
     {
-        std::lock_guard< std::recursive_mutex > lock( m_mutex );
-        if( !m_bComplete )
+        if( m_pParent )
         {
-            m_bComplete = true;
-            m_scheduler.OnRunComplete( pThis );
+            // spawned runs are not one of the owner's runs
+            finished();
+        }
+        else
+        {
+            m_scheduler.OnRunComplete( shared_from_this() );
         }
     }
 }
 
 void Scheduler::Run::cancel()
 {
-    std::lock_guard< std::recursive_mutex > lock( m_mutex );
-    if( !m_bCancelled )
+    // tasks already queued see the flag and never start
+    const std::uint32_t previous = m_state.fetch_or( eCancelled, std::memory_order_acq_rel );
+    if( ( previous & eCancelled ) == 0U )
     {
-        m_pending.clear();
-        m_bCancelled = true;
-
-        if( m_bStarted )
+        // running tasks see the token through their progress
+        m_cancellationToken.cancel();
+        std::vector< std::weak_ptr< Run > > children;
+        {
+            std::lock_guard< std::mutex > lock( m_exceptionMutex );
+            children = m_children;
+        }
+        for( const std::weak_ptr< Run >& pWeakChild : children )
+        {
+            if( Run::Ptr pChild = pWeakChild.lock() )
+            {
+                pChild->cancel();
+            }
+        }
+        if( ( previous & eStarted ) != 0U )
         {
             complete();
         }
@@ -89,115 +215,434 @@ void Scheduler::Run::cancel()
 
 void Scheduler::Run::finished()
 {
-    std::lock_guard< std::recursive_mutex > lock( m_mutex );
-    if( !m_bFinished )
+    const std::uint32_t previous = m_state.fetch_or( eFinished, std::memory_order_acq_rel );
+    if( ( previous & eFinished ) == 0U )
     {
-        m_bFinished = true;
-        if( m_pExceptionPtr.has_value() )
+        std::vector< std::function< void() > > continuations;
         {
-            m_promise.set_exception( m_pExceptionPtr.value() );
+            std::lock_guard< std::mutex > lock( m_exceptionMutex );
+            if( m_pExceptionPtr.has_value() )
+            {
+                m_promise.set_exception( m_pExceptionPtr.value() );
+            }
+            else
+            {
+                m_promise.set_value( ( previous & eCancelled ) == 0U );
+            }
+            m_bFinished = true;
+            continuations.swap( m_continuations );
         }
-        else
+        for( std::function< void() >& continuation : continuations )
         {
-            m_promise.set_value( !m_bCancelled );
+            continuation();
         }
     }
 }
 
-void Scheduler::Run::runTask( Task::RawPtr pTask )
+void Scheduler::Run::onFinished( std::function< void() > continuation )
 {
-    Progress progress( m_scheduler.m_fifo, m_pOwner );
+    {
+        std::lock_guard< std::mutex > lock( m_exceptionMutex );
+        if( !m_bFinished )
+        {
+            m_continuations.push_back( std::move( continuation ) );
+            return;
+        }
+    }
+    continuation();
+}
 
+Scheduler::Run::Execution::Execution( Run& run, std::size_t szTask )
+    : m_szTask( szTask )
+    , m_progress( run.m_scheduler.m_fifo, run.m_pOwner, run.m_cancellationToken )
+    , m_startTime( std::chrono::steady_clock::now() )
+    , m_startNanoSeconds( run.m_pTrace ? run.m_pTrace->now() : 0 )
+    , m_joins( 1U )
+{
+}
+
+const Task::Resources* Scheduler::Run::getAdmission( std::size_t szTask ) const
+{
+    return ( !m_resources.empty() && !m_resources[ szTask ].empty() ) ? &m_resources[ szTask ] : nullptr;
+}
+
+void Scheduler::Run::runTask( std::size_t szTask )
+{
+    if( isCancelled() )
+    {
+        if( const Task::Resources* pResources = getAdmission( szTask ) )
+        {
+            m_scheduler.release( *pResources );
+        }
+        return;
+    }
+
+    const Schedule::Node& node = m_pSchedule->getNodes()[ szTask ];
+
+    auto pExecution = std::make_shared< Execution >( *this, szTask );
+    {
+        // only called while the task runs when both the run and execution are held
+        Execution* pSpawning = pExecution.get();
+        pExecution->m_progress.setSpawner( [ this, pSpawning ]( const Task::PtrVector& tasks )
+                                           { spawn( *pSpawning, tasks ); } );
+    }
+
+#ifdef __cpp_impl_coroutine
+    if( AsyncTask* pAsyncTask = dynamic_cast< AsyncTask* >( node.m_pTask ) )
+    {
+        // the worker returns as soon as the coroutine first suspends
+        Run::Ptr   pRun      = shared_from_this();
+        Execution* pAwaiting = pExecution.get();
+        pAsyncTask->start( pExecution->m_progress, &m_scheduler,
+                           [ this, pAwaiting ]( Schedule::Ptr pSchedule )
+                           { return spawnAwaited( *pAwaiting, pSchedule ); },
+                           [ pRun, pExecution ]( std::exception_ptr pError )
+                           { pRun->returned( *pExecution, pError ); } );
+        return;
+    }
+#endif
+
+    std::exception_ptr pError;
     try
     {
-        pTask->run( progress );
+        node.m_pTask->run( pExecution->m_progress );
+    }
+    catch( std::exception& )
+    {
+        pError = std::current_exception();
+    }
+    returned( *pExecution, pError );
+}
+
+void Scheduler::Run::returned( Execution& execution, std::exception_ptr pError )
+{
+    releaseAdmission( execution );
+    join( execution, pError, false );
+}
 
-        if( !progress.isFinished() )
+void Scheduler::Run::releaseAdmission( Execution& execution )
+{
+    // admitted resources cover the task itself and not the tasks it spawned which are
+    // admitted in their own right - holding them until those finish could deadlock
+    if( const Task::Resources* pResources = getAdmission( execution.m_szTask ) )
+    {
+        if( !execution.m_bAdmissionReleased.exchange( true, std::memory_order_acq_rel ) )
+        {
+            m_scheduler.release( *pResources );
+        }
+    }
+}
+
+Scheduler::Run::Ptr Scheduler::Run::createChild( Schedule::Ptr pSchedule )
+{
+    Run::Ptr pChild( new Run( m_scheduler, m_pOwner, pSchedule, shared_from_this() ) );
+    {
+        std::lock_guard< std::mutex > lock( m_exceptionMutex );
+        m_children.push_back( pChild );
+    }
+    return pChild;
+}
+
+void Scheduler::Run::startChild( const Run::Ptr& pChild )
+{
+    pChild->setStarted();
+    pChild->start();
+    if( isCancelled() )
+    {
+        pChild->cancel();
+    }
+}
+
+Scheduler::Run::Ptr Scheduler::Run::spawnAwaited( Execution& execution, Schedule::Ptr pSchedule )
+{
+    // the awaiting task is suspended until the child finishes and reports its result
+    // so the child is not joined to the task
+    releaseAdmission( execution );
+    Run::Ptr pChild = createChild( pSchedule );
+    startChild( pChild );
+    return pChild;
+}
+
+void Scheduler::Run::spawn( Execution& execution, const Task::PtrVector& tasks )
+{
+    if( tasks.empty() )
+    {
+        return;
+    }
+
+    // the spawned tasks run as a child run of their own which the task joins
+    Run::Ptr pChild = createChild( Schedule::Ptr( new Schedule( tasks ) ) );
+    execution.m_joins.fetch_add( 1U, std::memory_order_relaxed );
+
+    Run::Ptr                     pRun       = shared_from_this();
+    std::shared_ptr< Execution > pExecution = execution.shared_from_this();
+    Run*                         pChildRun  = pChild.get();
+    pChild->onFinished(
+        [ pRun, pExecution, pChildRun ]()
+        {
+            std::exception_ptr pError;
+            {
+                std::lock_guard< std::mutex > lock( pChildRun->m_exceptionMutex );
+                if( pChildRun->m_pExceptionPtr.has_value() )
+                {
+                    pError = pChildRun->m_pExceptionPtr.value();
+                }
+            }
+            pRun->join( *pExecution, pError, !pError && pChildRun->isCancelled() );
+        } );
+
+    startChild( pChild );
+}
+
+void Scheduler::Run::join( Execution& execution, std::exception_ptr pError, bool bCancelled )
+{
+    if( pError || bCancelled )
+    {
+        std::lock_guard< std::mutex > lock( execution.m_joinMutex );
+        if( pError && !execution.m_pJoinError )
+        {
+            execution.m_pJoinError = pError;
+        }
+        execution.m_bJoinCancelled = execution.m_bJoinCancelled || bCancelled;
+    }
+    if( execution.m_joins.fetch_sub( 1U, std::memory_order_acq_rel ) == 1U )
+    {
+        completeTask( execution );
+    }
+}
+
+void Scheduler::Run::traceTask( const Execution& execution )
+{
+    const Status&      status = execution.m_progress.getStatus();
+    TaskTrace::Event   event;
+    std::ostringstream osSource, osTarget;
+    if( status.m_source.has_value() )
+        osSource << status.m_source.value();
+    if( status.m_target.has_value() )
+        osTarget << status.m_target.value();
+    event.m_run                = m_traceRun;
+    event.m_szTask             = execution.m_szTask;
+    event.m_strName            = status.m_strTaskName;
+    event.m_strSource          = osSource.str();
+    event.m_strTarget          = osTarget.str();
+    event.m_state              = status.m_state;
+    event.m_enqueueNanoSeconds = m_readyNanoSeconds[ execution.m_szTask ];
+    event.m_startNanoSeconds   = execution.m_startNanoSeconds;
+    event.m_endNanoSeconds     = m_pTrace->now();
+    m_pTrace->record( std::move( event ) );
+}
+
+void Scheduler::Run::completeTask( Execution& execution )
+{
+    const std::size_t szTask = execution.m_szTask;
+
+    const Schedule::Node& node    = m_pSchedule->getNodes()[ szTask ];
+    Progress&             progress = execution.m_progress;
+    bool                  bTraced  = false;
+
+    try
+    {
+        if( execution.m_pJoinError )
+        {
+            std::rethrow_exception( execution.m_pJoinError );
+        }
+        if( m_pTrace )
+        {
+            traceTask( execution );
+            bTraced = true;
+        }
+
+        if( !progress.isFinished() || execution.m_bJoinCancelled )
         {
-            std::lock_guard< std::recursive_mutex > lock( m_mutex );
             cancel();
             return;
         }
 
-        bool bRemaining = true;
+        if( !m_identities.empty() && !m_identities[ szTask ].empty() )
         {
-            std::lock_guard< std::recursive_mutex > lock( m_mutex );
-
-            Task::RawPtrSet::iterator iFind = m_active.find( pTask );
-            VERIFY_RTE_MSG( iFind != m_active.end(), "Failed to find task in active set" );
-            m_active.erase( iFind );
-            m_finished.insert( pTask );
+            m_scheduler.m_pCostModel->record(
+                m_identities[ szTask ],
+                std::chrono::duration< double >( std::chrono::steady_clock::now() - execution.m_startTime ).count() );
+        }
 
-            if( m_pending.empty() && m_active.empty() )
+        if( !m_stashKeys.empty() && !m_stashKeys[ szTask ].empty() )
+        {
+            try
+            {
+                m_pStash->stash( m_stashKeys[ szTask ] );
+            }
+            catch( std::exception& )
             {
-                bRemaining = false;
+                // the stash is only a cache - the task still succeeded
             }
         }
 
-        if( bRemaining )
+        // the last dependency to finish releases each successor
+        std::vector< std::size_t > ready;
+        for( std::size_t szSuccessor : node.m_successors )
         {
-            m_scheduler.m_queue.post( std::bind( &Scheduler::Run::next, shared_from_this() ) );
+            if( m_dependencyCounts[ szSuccessor ].fetch_sub( 1U, std::memory_order_acq_rel ) == 1U )
+            {
+                ready.push_back( szSuccessor );
+            }
         }
-        else
+        release( std::move( ready ) );
+
+        if( m_remaining.fetch_sub( 1U, std::memory_order_acq_rel ) == 1U )
         {
             complete();
         }
     }
     catch( std::exception& ex )
     {
-        pTask->failed( progress );
-
-        std::lock_guard< std::recursive_mutex > lock( m_mutex );
-        m_pExceptionPtr = std::current_exception();
+        node.m_pTask->failed( progress );
+        if( m_pTrace && !bTraced )
+        {
+            traceTask( execution );
+        }
+        {
+            // the first failure is reported
+            std::lock_guard< std::mutex > lock( m_exceptionMutex );
+            if( !m_pExceptionPtr.has_value() )
+            {
+                m_pExceptionPtr = std::current_exception();
+            }
+        }
         cancel();
     }
 }
 
-void Scheduler::Run::start()
+void Scheduler::Run::release( std::vector< std::size_t > ready )
 {
-    std::lock_guard< std::recursive_mutex > lock( m_mutex );
-    if( !m_bCancelled )
+    if( m_pStash )
     {
-        if( !m_pending.empty() )
-        {
-            next();
-        }
-        else
-        {
-            complete();
-        }
+        ready = restore( std::move( ready ) );
+    }
+    for( std::size_t szTask : ready )
+    {
+        m_scheduler.schedule( shared_from_this(), szTask );
     }
 }
 
-void Scheduler::Run::next()
+std::vector< std::size_t > Scheduler::Run::restore( std::vector< std::size_t > ready )
 {
-    Task::RawPtrSet ready;
+    const Schedule::NodeVector& nodes = m_pSchedule->getNodes();
+    std::vector< std::size_t >  uncached;
+
+    // each wave restores every ready task in one stash request.  Restored tasks
+    // complete here and release their successors into the next wave.
+    while( !ready.empty() && !isCancelled() )
     {
-        std::lock_guard< std::recursive_mutex > lock( m_mutex );
-        if( !m_bCancelled )
+        std::vector< std::size_t > candidates;
+        StashKeys                  keys;
+        for( std::size_t szTask : ready )
+        {
+            std::optional< Task::CacheInfo > cacheInfo;
+            try
+            {
+                cacheInfo = nodes[ szTask ].m_pTask->getCacheInfo();
+            }
+            catch( std::exception& )
+            {
+                // such as a missing input - the task reports it when it runs
+            }
+            if( !cacheInfo.has_value() || cacheInfo->m_outputs.empty() )
+            {
+                uncached.push_back( szTask );
+                continue;
+            }
+
+            DeterminantHash determinant = cacheInfo->m_determinant;
+            for( const FileHash& input : cacheInfo->m_inputs )
+            {
+                determinant ^= input;
+            }
+            StashKeys& taskKeys = m_stashKeys[ szTask ];
+            taskKeys.clear();
+            for( const boost::filesystem::path& output : cacheInfo->m_outputs )
+            {
+                taskKeys.push_back( StashKey{ output, determinant.getDigest() } );
+            }
+            keys.insert( keys.end(), taskKeys.begin(), taskKeys.end() );
+            candidates.push_back( szTask );
+        }
+        ready.clear();
+        if( candidates.empty() )
+        {
+            break;
+        }
+
+        std::vector< bool > restored;
+        try
         {
-            for( Task::RawPtrSet::iterator i = m_pending.begin(), iEnd = m_pending.end(); i != iEnd; ++i )
+            restored = m_pStash->restore( keys );
+        }
+        catch( std::exception& )
+        {
+            // the stash is only a cache - run the tasks instead
+            restored.assign( keys.size(), false );
+        }
+        auto iRestored = restored.begin();
+        for( std::size_t szTask : candidates )
+        {
+            const auto iEnd = iRestored + m_stashKeys[ szTask ].size();
+            const bool bCached = std::all_of( iRestored, iEnd, []( bool bRestored ) { return bRestored; } );
+            iRestored = iEnd;
+            if( !bCached )
+            {
+                // any outputs which were restored are simply overwritten
+                uncached.push_back( szTask );
+                continue;
+            }
+
+            {
+                // restored tasks never run so report them here
+                Status status( m_pOwner );
+                status.m_state       = Status::eCached;
+                status.m_strTaskName = nodes[ szTask ].m_pTask->getIdentity();
+                status.m_target      = m_stashKeys[ szTask ].front().m_file;
+                m_scheduler.m_fifo.push( std::move( status ) );
+            }
+            m_stashKeys[ szTask ].clear();
+            if( m_pTrace )
+            {
+                TaskTrace::Event event;
+                event.m_run                = m_traceRun;
+                event.m_szTask             = szTask;
+                event.m_strName            = nodes[ szTask ].m_pTask->getIdentity();
+                event.m_state              = Status::eCached;
+                event.m_enqueueNanoSeconds = m_pTrace->now();
+                event.m_startNanoSeconds   = event.m_enqueueNanoSeconds;
+                event.m_endNanoSeconds     = event.m_enqueueNanoSeconds;
+                m_pTrace->record( std::move( event ) );
+            }
+            for( std::size_t szSuccessor : nodes[ szTask ].m_successors )
             {
-                Task::RawPtr pTask = *i;
-                if( pTask->isReady( m_finished ) )
+                if( m_dependencyCounts[ szSuccessor ].fetch_sub( 1U, std::memory_order_acq_rel ) == 1U )
                 {
-                    ready.insert( pTask );
-                    m_active.insert( pTask );
+                    ready.push_back( szSuccessor );
                 }
             }
-            for( Task::RawPtr pTask : ready )
+            if( m_remaining.fetch_sub( 1U, std::memory_order_acq_rel ) == 1U )
             {
-                m_pending.erase( pTask );
+                complete();
             }
         }
     }
+    return uncached;
+}
 
-    // schedule tasks
-    if( !ready.empty() )
+void Scheduler::Run::start()
+{
+    if( !isCancelled() )
     {
-        for( Task::RawPtr pTask : ready )
+        if( !m_pSchedule->getRoots().empty() )
+        {
+            release( m_pSchedule->getRoots() );
+        }
+        else
         {
-            m_scheduler.m_queue.post( std::bind( &Scheduler::Run::runTask, shared_from_this(), pTask ) );
+            complete();
         }
     }
 }
@@ -205,11 +650,12 @@ void Scheduler::Run::next()
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 Scheduler::Scheduler( StatusFIFO& fifo, std::chrono::milliseconds keepAliveRate,
-                      std::optional< unsigned int > maxThreads )
+                      std::optional< unsigned int > maxThreads, Executor executor )
     : m_fifo( fifo )
     , m_bStop( false )
     , m_keepAliveRate( keepAliveRate )
     , m_keepAliveTimer( m_queue, keepAliveRate )
+    , m_blockingPool( BLOCKING_THREADS )
 {
     {
         using namespace std::placeholders;
@@ -220,9 +666,20 @@ Scheduler::Scheduler( StatusFIFO& fifo, std::chrono::milliseconds keepAliveRate,
     VERIFY_RTE( nMaxThreads > 0U );
 
     boost::asio::io_context* pQueue = &m_queue;
-    for( auto i = 0U; i < nMaxThreads; ++i )
+    switch( executor )
     {
-        m_threads.emplace_back( [ pQueue ]() { pQueue->run(); } );
+        case Executor::eAsio:
+            for( auto i = 0U; i < nMaxThreads; ++i )
+            {
+                m_threads.emplace_back( [ pQueue ]() { pQueue->run(); } );
+            }
+            break;
+        case Executor::eWorkStealing:
+            m_pPool = std::make_unique< WorkStealingPool >( nMaxThreads );
+            m_threads.emplace_back( [ pQueue ]() { pQueue->run(); } );
+            break;
+        default:
+            THROW_RTE( "Unknown scheduler executor" );
     }
 }
 
@@ -233,6 +690,218 @@ Scheduler::~Scheduler()
     {
         thread.join();
     }
+    // runs whatever is still queued
+    m_pPool.reset();
+    m_blockingPool.join();
+}
+
+void Scheduler::postBlocking( std::function< void() > job )
+{
+    boost::asio::post( m_blockingPool, std::move( job ) );
+}
+
+void Scheduler::post( std::function< void() > job )
+{
+    if( m_pPool )
+    {
+        m_pPool->post( std::move( job ) );
+    }
+    else
+    {
+        m_queue.post( std::move( job ) );
+    }
+}
+
+void Scheduler::schedule( Run::Ptr pRun, std::size_t szTask )
+{
+    if( pRun->m_pTrace )
+    {
+        // queue wait includes any wait for resources
+        pRun->m_readyNanoSeconds[ szTask ] = pRun->m_pTrace->now();
+    }
+    if( !pRun->m_resources.empty() && !pRun->m_resources[ szTask ].empty() )
+    {
+        const Task::Resources&        resources = pRun->m_resources[ szTask ];
+        std::lock_guard< std::mutex > lock( m_resourceMutex );
+        if( !isAdmissible( resources ) )
+        {
+            // waiting tasks are kept highest rank first
+            const ReadyTask waiting{
+                pRun->m_ranks.empty() ? 0.0 : pRun->m_ranks[ szTask ], m_waitingSequence++, pRun, szTask };
+            m_waiting.insert( std::upper_bound( m_waiting.begin(), m_waiting.end(), waiting,
+                                                []( const ReadyTask& left, const ReadyTask& right )
+                                                { return right < left; } ),
+                              waiting );
+            return;
+        }
+        acquire( resources );
+    }
+    enqueue( pRun, szTask );
+}
+
+void Scheduler::enqueue( Run::Ptr pRun, std::size_t szTask )
+{
+    const bool bFairQueuing = m_bFairQueuing.load( std::memory_order_relaxed );
+    if( pRun->m_ranks.empty() && !bFairQueuing )
+    {
+        post( std::bind( &Scheduler::Run::runTask, pRun, szTask ) );
+    }
+    else
+    {
+        // each queued dispatch starts whichever ready task then comes first
+        {
+            std::lock_guard< std::mutex > lock( m_readyMutex );
+            auto ibOwner = m_ownerQueues.try_emplace( bFairQueuing ? pRun->getOwner() : nullptr );
+            if( ibOwner.second )
+            {
+                ibOwner.first->second.m_virtualTime = m_virtualTime;
+            }
+            ibOwner.first->second.m_ready.push(
+                ReadyTask{ pRun->m_ranks.empty() ? 0.0 : pRun->m_ranks[ szTask ], m_readySequence++, pRun, szTask } );
+        }
+        post( std::bind( &Scheduler::dispatch, this ) );
+    }
+}
+
+void Scheduler::dispatch()
+{
+    Run::Ptr    pRun;
+    std::size_t szTask = 0U;
+    {
+        std::lock_guard< std::mutex > lock( m_readyMutex );
+        VERIFY_RTE_MSG( !m_ownerQueues.empty(), "Error in scheduler" );
+
+        auto iOwner = std::min_element( m_ownerQueues.begin(), m_ownerQueues.end(),
+                                        []( const auto& left, const auto& right )
+                                        { return left.second.m_virtualTime < right.second.m_virtualTime; } );
+        OwnerQueue& ownerQueue = iOwner->second;
+        pRun                   = ownerQueue.m_ready.top().m_pRun;
+        szTask                 = ownerQueue.m_ready.top().m_szTask;
+        ownerQueue.m_ready.pop();
+
+        // tasks of a cancelled run return at once so cost the owner nothing
+        if( !pRun->isCancelled() )
+        {
+            m_virtualTime = ownerQueue.m_virtualTime;
+            auto iWeight  = m_ownerWeights.find( iOwner->first );
+            ownerQueue.m_virtualTime += ( pRun->m_costs.empty() ? 1.0 : pRun->m_costs[ szTask ] )
+                                        / ( iWeight == m_ownerWeights.end() ? 1.0 : iWeight->second );
+        }
+        if( ownerQueue.m_ready.empty() )
+        {
+            m_ownerQueues.erase( iOwner );
+        }
+    }
+    pRun->runTask( szTask );
+}
+
+void Scheduler::setOwnerWeight( Run::Owner pOwner, double weight )
+{
+    VERIFY_RTE_MSG( weight > 0.0, "Owner weight must be positive" );
+    std::lock_guard< std::mutex > lock( m_readyMutex );
+    m_ownerWeights[ pOwner ] = weight;
+    m_bFairQueuing.store( true, std::memory_order_relaxed );
+}
+
+void Scheduler::setResourceBudget( const Task::Resources& budget )
+{
+    std::lock_guard< std::mutex > lock( m_resourceMutex );
+    m_resourceBudget = budget;
+}
+
+bool Scheduler::isAdmissible( const Task::Resources& resources ) const
+{
+    // a requirement beyond the budget is admitted once nothing else holds the resource
+    auto fits = []( std::uint64_t required, std::uint64_t inUse, std::uint64_t budget )
+    { return budget == 0U || required == 0U || inUse == 0U || inUse + required <= budget; };
+
+    const Task::Resources& budget = m_resourceBudget.value();
+    if( !fits( resources.m_memoryMB, m_resourcesInUse.m_memoryMB, budget.m_memoryMB )
+        || !fits( resources.m_ioSlots, m_resourcesInUse.m_ioSlots, budget.m_ioSlots ) )
+    {
+        return false;
+    }
+    for( const auto& [ strName, count ] : resources.m_semaphores )
+    {
+        auto iBudget = budget.m_semaphores.find( strName );
+        if( iBudget != budget.m_semaphores.end() )
+        {
+            auto iInUse = m_resourcesInUse.m_semaphores.find( strName );
+            if( !fits( count, iInUse == m_resourcesInUse.m_semaphores.end() ? 0U : iInUse->second, iBudget->second ) )
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void Scheduler::acquire( const Task::Resources& resources )
+{
+    m_resourcesInUse.m_memoryMB += resources.m_memoryMB;
+    m_resourcesInUse.m_ioSlots += resources.m_ioSlots;
+    for( const auto& [ strName, count ] : resources.m_semaphores )
+    {
+        m_resourcesInUse.m_semaphores[ strName ] += count;
+    }
+}
+
+void Scheduler::release( const Task::Resources& resources )
+{
+    std::vector< ReadyTask > admitted;
+    {
+        std::lock_guard< std::mutex > lock( m_resourceMutex );
+        m_resourcesInUse.m_memoryMB -= resources.m_memoryMB;
+        m_resourcesInUse.m_ioSlots -= resources.m_ioSlots;
+        for( const auto& [ strName, count ] : resources.m_semaphores )
+        {
+            m_resourcesInUse.m_semaphores[ strName ] -= count;
+        }
+
+        // admit every waiting task which now fits - not just the first
+        for( auto i = m_waiting.begin(); i != m_waiting.end(); )
+        {
+            if( i->m_pRun->isCancelled() )
+            {
+                // would only be skipped once admitted
+                i = m_waiting.erase( i );
+                continue;
+            }
+            const Task::Resources& required = i->m_pRun->m_resources[ i->m_szTask ];
+            if( isAdmissible( required ) )
+            {
+                acquire( required );
+                admitted.push_back( std::move( *i ) );
+                i = m_waiting.erase( i );
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+    for( ReadyTask& readyTask : admitted )
+    {
+        enqueue( readyTask.m_pRun, readyTask.m_szTask );
+    }
+}
+
+void Scheduler::setTracing( bool bTracing )
+{
+    std::lock_guard< std::recursive_mutex > lock( m_mutex );
+    m_bTracing = bTracing;
+}
+
+void Scheduler::setStash( std::shared_ptr< Stash > pStash )
+{
+    std::lock_guard< std::recursive_mutex > lock( m_mutex );
+    m_pStash = pStash;
+}
+
+void Scheduler::setCostModel( TaskCostModel::Ptr pCostModel )
+{
+    std::lock_guard< std::recursive_mutex > lock( m_mutex );
+    m_pCostModel = pCostModel;
 }
 
 void Scheduler::OnKeepAlive( const boost::system::error_code& ec )
@@ -272,8 +941,8 @@ void Scheduler::OnRunComplete( Run::Ptr pRun )
 
         auto ibResult = m_runs.insert( std::make_pair( pRunOwner, pPendingRun ) );
         VERIFY_RTE( ibResult.second );
-        pPendingRun->m_bStarted = true;
-        m_queue.post( std::bind( &Scheduler::Run::start, pPendingRun ) );
+        pPendingRun->setStarted();
+        post( std::bind( &Scheduler::Run::start, pPendingRun ) );
     }
 }
 
@@ -306,8 +975,8 @@ Scheduler::Run::Ptr Scheduler::run( Run::Owner pOwner, Schedule::Ptr pSchedule )
         {
             auto ibResult = m_runs.insert( std::make_pair( pOwner, pScheduleRun ) );
             VERIFY_RTE( ibResult.second );
-            pScheduleRun->m_bStarted = true;
-            m_queue.post( std::bind( &Scheduler::Run::start, pScheduleRun ) );
+            pScheduleRun->setStarted();
+            post( std::bind( &Scheduler::Run::start, pScheduleRun ) );
         }
     }
 
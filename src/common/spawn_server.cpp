@@ -0,0 +1,655 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#include "common/spawn_server.hpp"
+#include "common/assert_verify.hpp"
+
+#ifndef _WIN32
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/process/exception.hpp>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <string>
+#include <vector>
+
+extern char** environ;
+
+namespace common
+{
+namespace
+{
+// each message is its payload length followed by the payload
+//
+//     request  - id, working directory, command, override count, ( key, value ) per override
+//     response - id, spawn errno or zero, exit code, output, error
+class MessageWriter
+{
+public:
+    MessageWriter() { m_str.resize( sizeof( std::uint64_t ) ); }
+
+    void write( std::uint64_t value ) { m_str.append( reinterpret_cast< const char* >( &value ), sizeof( value ) ); }
+    void write( const std::string& str )
+    {
+        write( static_cast< std::uint64_t >( str.size() ) );
+        m_str.append( str );
+    }
+
+    // the framed message
+    const std::string& get()
+    {
+        const std::uint64_t length = m_str.size() - sizeof( std::uint64_t );
+        std::memcpy( m_str.data(), &length, sizeof( length ) );
+        return m_str;
+    }
+
+private:
+    std::string m_str;
+};
+
+class MessageReader
+{
+public:
+    MessageReader( const std::string& strPayload )
+        : m_pData( strPayload.data() )
+        , m_pEnd( strPayload.data() + strPayload.size() )
+    {
+    }
+
+    std::uint64_t readValue()
+    {
+        std::uint64_t value = 0U;
+        VERIFY_RTE_MSG( m_pData + sizeof( value ) <= m_pEnd, "Corrupt spawn server message" );
+        std::memcpy( &value, m_pData, sizeof( value ) );
+        m_pData += sizeof( value );
+        return value;
+    }
+    std::string readString()
+    {
+        const std::uint64_t length = readValue();
+        VERIFY_RTE_MSG( length <= static_cast< std::uint64_t >( m_pEnd - m_pData ), "Corrupt spawn server message" );
+        std::string str( m_pData, length );
+        m_pData += length;
+        return str;
+    }
+
+private:
+    const char* m_pData;
+    const char* m_pEnd;
+};
+
+bool sendAll( int socket, const std::string& str )
+{
+    const char* pData = str.data();
+    std::size_t szRemaining = str.size();
+    while( szRemaining != 0U )
+    {
+        const ssize_t szSent = ::send( socket, pData, szRemaining, MSG_NOSIGNAL );
+        if( szSent < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            return false;
+        }
+        pData += szSent;
+        szRemaining -= szSent;
+    }
+    return true;
+}
+
+bool readAll( int fd, char* pData, std::size_t szSize )
+{
+    while( szSize != 0U )
+    {
+        const ssize_t szRead = ::read( fd, pData, szSize );
+        if( szRead < 0 && errno == EINTR )
+            continue;
+        if( szRead <= 0 )
+            return false;
+        pData += szRead;
+        szSize -= szRead;
+    }
+    return true;
+}
+
+// split on spaces outside of double quotes which are removed - as boost process does
+std::vector< std::string > splitArguments( const std::string& strCmd )
+{
+    std::vector< std::string > arguments;
+    std::string                strArgument;
+    bool                       bQuoted = false, bArgument = false;
+    for( const char c : strCmd )
+    {
+        if( c == '"' )
+        {
+            bQuoted   = !bQuoted;
+            bArgument = true;
+        }
+        else if( c == ' ' && !bQuoted )
+        {
+            if( bArgument )
+            {
+                arguments.push_back( std::move( strArgument ) );
+                strArgument.clear();
+                bArgument = false;
+            }
+        }
+        else
+        {
+            strArgument.push_back( c );
+            bArgument = true;
+        }
+    }
+    if( bArgument )
+    {
+        arguments.push_back( std::move( strArgument ) );
+    }
+    return arguments;
+}
+
+// written to by the helper's SIGCHLD handler so poll wakes when a command exits
+int g_childSignalPipe = -1;
+
+void onChildSignal( int )
+{
+    const int  savedErrno = errno;
+    const char c          = 0;
+    [[maybe_unused]] const ssize_t szWritten = ::write( g_childSignalPipe, &c, 1U );
+    errno = savedErrno;
+}
+
+// runs in the forked helper process
+class Helper
+{
+public:
+    Helper( int socket )
+        : m_socket( socket )
+    {
+        for( char** ppEnvironment = environ; *ppEnvironment; ++ppEnvironment )
+        {
+            m_environment.emplace_back( *ppEnvironment );
+        }
+    }
+
+    int run();
+
+private:
+    struct Child
+    {
+        std::uint64_t m_id;
+        pid_t         m_pid;
+        int           m_output;
+        int           m_error;
+        std::string   m_strOutput;
+        std::string   m_strError;
+    };
+
+    struct EnvironmentBlock
+    {
+        std::vector< std::string > m_strings;
+        std::vector< char* >       m_pointers;
+    };
+
+    static constexpr std::size_t MAX_ENVIRONMENT_BLOCKS = 16U;
+
+    char* const* getEnvironment( const Command::EnvironmentMap& overrides );
+    void         spawn( const std::string& strPayload );
+    void         respond( std::uint64_t id, int spawnErrno, int exitCode, const std::string& strOutput,
+                          const std::string& strError );
+
+    const int                                 m_socket;
+    std::vector< std::string >                m_environment;
+    std::map< std::string, EnvironmentBlock > m_environmentBlocks;
+    std::list< Child >                        m_children;
+};
+
+char* const* Helper::getEnvironment( const Command::EnvironmentMap& overrides )
+{
+    std::string strKey;
+    for( const auto& [ key, value ] : overrides )
+    {
+        strKey.append( key ).append( 1U, '=' ).append( value ).append( 1U, '\0' );
+    }
+
+    auto iFind = m_environmentBlocks.find( strKey );
+    if( iFind == m_environmentBlocks.end() )
+    {
+        if( m_environmentBlocks.size() == MAX_ENVIRONMENT_BLOCKS )
+        {
+            m_environmentBlocks.clear();
+        }
+        EnvironmentBlock block;
+        for( const std::string& strVariable : m_environment )
+        {
+            if( overrides.find( strVariable.substr( 0U, strVariable.find( '=' ) ) ) == overrides.end() )
+            {
+                block.m_strings.push_back( strVariable );
+            }
+        }
+        for( const auto& [ key, value ] : overrides )
+        {
+            block.m_strings.push_back( key + "=" + value );
+        }
+        for( std::string& strVariable : block.m_strings )
+        {
+            block.m_pointers.push_back( strVariable.data() );
+        }
+        block.m_pointers.push_back( nullptr );
+        iFind = m_environmentBlocks.insert( std::make_pair( strKey, std::move( block ) ) ).first;
+    }
+    return iFind->second.m_pointers.data();
+}
+
+void Helper::spawn( const std::string& strPayload )
+{
+    MessageReader       reader( strPayload );
+    const std::uint64_t id               = reader.readValue();
+    const std::string   strWorkingFolder = reader.readString();
+    const std::string   strCmd           = reader.readString();
+    Command::EnvironmentMap overrides;
+    for( std::uint64_t i = 0U, count = reader.readValue(); i != count; ++i )
+    {
+        std::string strKey     = reader.readString();
+        overrides[ strKey ]    = reader.readString();
+    }
+
+    int output[ 2 ], error[ 2 ];
+    if( ::pipe2( output, O_CLOEXEC ) != 0 )
+    {
+        respond( id, errno, 127, std::string(), "Failed to create pipe for: " + strCmd );
+        return;
+    }
+    if( ::pipe2( error, O_CLOEXEC ) != 0 )
+    {
+        const int iError = errno;
+        ::close( output[ 0 ] );
+        ::close( output[ 1 ] );
+        respond( id, iError, 127, std::string(), "Failed to create pipe for: " + strCmd );
+        return;
+    }
+
+    posix_spawn_file_actions_t actions;
+    ::posix_spawn_file_actions_init( &actions );
+    // the helper's own working directory is whatever the parent's was when it forked
+    ::posix_spawn_file_actions_addchdir_np( &actions, strWorkingFolder.c_str() );
+    ::posix_spawn_file_actions_addopen( &actions, 0, "/dev/null", O_RDONLY, 0 );
+    ::posix_spawn_file_actions_adddup2( &actions, output[ 1 ], 1 );
+    ::posix_spawn_file_actions_adddup2( &actions, error[ 1 ], 2 );
+
+    // commands see default signal handling whatever the parent had
+    posix_spawnattr_t attributes;
+    ::posix_spawnattr_init( &attributes );
+    sigset_t signals;
+    sigemptyset( &signals );
+    ::posix_spawnattr_setsigmask( &attributes, &signals );
+    sigaddset( &signals, SIGPIPE );
+    ::posix_spawnattr_setsigdefault( &attributes, &signals );
+    ::posix_spawnattr_setflags( &attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF );
+
+    std::vector< std::string > arguments = splitArguments( strCmd );
+    std::vector< char* >       argv;
+    for( std::string& strArgument : arguments )
+    {
+        argv.push_back( strArgument.data() );
+    }
+    argv.push_back( nullptr );
+
+    // resolve the program as boost process does - relative to the parent's working
+    // directory if it is there otherwise by searching the path
+    pid_t     pid     = 0;
+    int       iResult = ENOENT;
+    if( !arguments.empty() )
+    {
+        const std::string& strProgram = arguments.front();
+        if( strProgram.find( '/' ) != std::string::npos
+            || ::access( ( strWorkingFolder + '/' + strProgram ).c_str(), X_OK ) == 0 )
+        {
+            iResult = ::posix_spawn(
+                &pid, strProgram.c_str(), &actions, &attributes, argv.data(), getEnvironment( overrides ) );
+        }
+        else
+        {
+            iResult = ::posix_spawnp(
+                &pid, strProgram.c_str(), &actions, &attributes, argv.data(), getEnvironment( overrides ) );
+        }
+    }
+
+    ::posix_spawnattr_destroy( &attributes );
+    ::posix_spawn_file_actions_destroy( &actions );
+    ::close( output[ 1 ] );
+    ::close( error[ 1 ] );
+
+    if( iResult != 0 )
+    {
+        ::close( output[ 0 ] );
+        ::close( error[ 0 ] );
+        respond( id, iResult, 127, std::string(), "Failed to spawn: " + strCmd );
+        return;
+    }
+    m_children.push_back( Child{ id, pid, output[ 0 ], error[ 0 ], std::string(), std::string() } );
+}
+
+void Helper::respond( std::uint64_t id, int spawnErrno, int exitCode, const std::string& strOutput,
+                      const std::string& strError )
+{
+    MessageWriter writer;
+    writer.write( id );
+    writer.write( static_cast< std::uint64_t >( spawnErrno ) );
+    writer.write( static_cast< std::uint64_t >( static_cast< std::int64_t >( exitCode ) ) );
+    writer.write( strOutput );
+    writer.write( strError );
+    if( !sendAll( m_socket, writer.get() ) )
+    {
+        // the parent has gone
+        ::_exit( 1 );
+    }
+}
+
+int Helper::run()
+{
+    // a command may close its output before it exits so poll until SIGCHLD
+    int childSignal[ 2 ];
+    if( ::pipe2( childSignal, O_CLOEXEC | O_NONBLOCK ) != 0 )
+    {
+        return 1;
+    }
+    g_childSignalPipe = childSignal[ 1 ];
+    struct sigaction action;
+    std::memset( &action, 0, sizeof( action ) );
+    action.sa_handler = &onChildSignal;
+    action.sa_flags   = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset( &action.sa_mask );
+    ::sigaction( SIGCHLD, &action, nullptr );
+    sigset_t signals;
+    sigemptyset( &signals );
+    sigaddset( &signals, SIGCHLD );
+    ::sigprocmask( SIG_UNBLOCK, &signals, nullptr );
+
+    std::string strBuffer;
+    bool        bOpen = true;
+    char        buffer[ 65536 ];
+
+    while( bOpen || !m_children.empty() )
+    {
+        std::vector< pollfd > fds{ pollfd{ childSignal[ 0 ], POLLIN, 0 } };
+        std::vector< int* >   fdSlots{ nullptr };
+        std::vector< Child* > fdChildren{ nullptr };
+        if( bOpen )
+        {
+            fds.push_back( pollfd{ m_socket, POLLIN, 0 } );
+            fdSlots.push_back( nullptr );
+            fdChildren.push_back( nullptr );
+        }
+        for( Child& child : m_children )
+        {
+            for( int* pFD : { &child.m_output, &child.m_error } )
+            {
+                if( *pFD >= 0 )
+                {
+                    fds.push_back( pollfd{ *pFD, POLLIN, 0 } );
+                    fdSlots.push_back( pFD );
+                    fdChildren.push_back( &child );
+                }
+            }
+        }
+
+        if( ::poll( fds.data(), fds.size(), -1 ) < 0 && errno != EINTR )
+        {
+            return 1;
+        }
+
+        for( std::size_t i = 0U; i != fds.size(); ++i )
+        {
+            if( ( fds[ i ].revents & ( POLLIN | POLLHUP | POLLERR ) ) == 0 )
+            {
+                continue;
+            }
+            const ssize_t szRead = ::read( fds[ i ].fd, buffer, sizeof( buffer ) );
+            if( szRead < 0 && ( errno == EINTR || errno == EAGAIN ) )
+            {
+                continue;
+            }
+            if( i == 0U )
+            {
+                // drained - the children are reaped below
+                continue;
+            }
+            if( !fdSlots[ i ] )
+            {
+                if( szRead <= 0 )
+                {
+                    // the parent has finished with the server
+                    bOpen = false;
+                    continue;
+                }
+                strBuffer.append( buffer, szRead );
+                while( strBuffer.size() >= sizeof( std::uint64_t ) )
+                {
+                    std::uint64_t length = 0U;
+                    std::memcpy( &length, strBuffer.data(), sizeof( length ) );
+                    if( strBuffer.size() < sizeof( length ) + length )
+                    {
+                        break;
+                    }
+                    spawn( strBuffer.substr( sizeof( length ), length ) );
+                    strBuffer.erase( 0U, sizeof( length ) + length );
+                }
+            }
+            else if( szRead <= 0 )
+            {
+                ::close( *fdSlots[ i ] );
+                *fdSlots[ i ] = -1;
+            }
+            else
+            {
+                Child& child = *fdChildren[ i ];
+                ( fdSlots[ i ] == &child.m_output ? child.m_strOutput : child.m_strError ).append( buffer, szRead );
+            }
+        }
+
+        for( auto i = m_children.begin(); i != m_children.end(); )
+        {
+            int status = 0;
+            if( i->m_output < 0 && i->m_error < 0 && ::waitpid( i->m_pid, &status, WNOHANG ) == i->m_pid )
+            {
+                const int exitCode = WIFEXITED( status ) ? WEXITSTATUS( status ) : 128 + WTERMSIG( status );
+                respond( i->m_id, 0, exitCode, i->m_strOutput, i->m_strError );
+                i = m_children.erase( i );
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+    return 0;
+}
+
+std::unique_ptr< SpawnServer > g_pSpawnServer;
+
+std::pair< int, pid_t > forkHelper()
+{
+    int sockets[ 2 ];
+    VERIFY_RTE_MSG( ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets ) == 0,
+                    "Failed to create spawn server socket: " << std::strerror( errno ) );
+
+    const pid_t pid = ::fork();
+    if( pid < 0 )
+    {
+        ::close( sockets[ 0 ] );
+        ::close( sockets[ 1 ] );
+        THROW_RTE( "Failed to fork spawn server: " << std::strerror( errno ) );
+    }
+    if( pid == 0 )
+    {
+        // commands must not inherit whatever the parent had open
+        const long maxFDs = std::min( ::sysconf( _SC_OPEN_MAX ), 65536L );
+        for( int fd = 3; fd < maxFDs; ++fd )
+        {
+            if( fd != sockets[ 1 ] )
+            {
+                ::close( fd );
+            }
+        }
+        int iResult = 1;
+        try
+        {
+            iResult = Helper( sockets[ 1 ] ).run();
+        }
+        catch( ... )
+        {
+        }
+        // never run the parent's static destructors
+        ::_exit( iResult );
+    }
+
+    ::close( sockets[ 1 ] );
+    return { sockets[ 0 ], pid };
+}
+
+} // namespace
+
+void SpawnServer::start()
+{
+    if( !g_pSpawnServer )
+    {
+        g_pSpawnServer = std::make_unique< SpawnServer >();
+    }
+}
+
+void SpawnServer::stop()
+{
+    g_pSpawnServer.reset();
+}
+
+SpawnServer* SpawnServer::get()
+{
+    return g_pSpawnServer.get();
+}
+
+SpawnServer::SpawnServer()
+    : SpawnServer( forkHelper() )
+{
+}
+
+SpawnServer::SpawnServer( std::pair< int, pid_t > helper )
+    : m_socket( helper.first )
+    , m_pid( helper.second )
+{
+    m_reader = std::thread( [ this ]() { readResponses(); } );
+}
+
+SpawnServer::~SpawnServer()
+{
+    // the helper exits once its running commands have completed
+    ::shutdown( m_socket, SHUT_WR );
+    m_reader.join();
+    ::close( m_socket );
+    int status = 0;
+    ::waitpid( m_pid, &status, 0 );
+}
+
+CommandResult SpawnServer::run( const Command& cmd )
+{
+    std::future< CommandResult > result;
+    MessageWriter                writer;
+    {
+        std::lock_guard< std::mutex > lock( m_pendingMutex );
+        VERIFY_RTE_MSG( !m_bClosed, "Spawn server has exited" );
+        writer.write( m_nextID );
+        result = m_pending[ m_nextID++ ].get_future();
+    }
+    writer.write( boost::filesystem::current_path().string() );
+    writer.write( cmd.m_strCmd );
+    writer.write( static_cast< std::uint64_t >( cmd.m_environmentVars.size() ) );
+    for( const auto& [ key, value ] : cmd.m_environmentVars )
+    {
+        writer.write( key );
+        writer.write( value );
+    }
+    {
+        std::lock_guard< std::mutex > lock( m_writeMutex );
+        VERIFY_RTE_MSG( sendAll( m_socket, writer.get() ), "Failed to send command to spawn server: " << cmd.str() );
+    }
+    return result.get();
+}
+
+void SpawnServer::readResponses()
+{
+    while( true )
+    {
+        std::uint64_t length = 0U;
+        if( !readAll( m_socket, reinterpret_cast< char* >( &length ), sizeof( length ) ) )
+        {
+            break;
+        }
+        std::string strPayload( length, '\0' );
+        if( !readAll( m_socket, strPayload.data(), length ) )
+        {
+            break;
+        }
+
+        MessageReader       reader( strPayload );
+        const std::uint64_t id         = reader.readValue();
+        const int           spawnErrno = static_cast< int >( reader.readValue() );
+        CommandResult       result;
+        result.m_exitCode  = static_cast< int >( static_cast< std::int64_t >( reader.readValue() ) );
+        result.m_strOutput = reader.readString();
+        result.m_strError  = reader.readString();
+
+        std::lock_guard< std::mutex > lock( m_pendingMutex );
+        auto                          iFind = m_pending.find( id );
+        if( iFind != m_pending.end() )
+        {
+            if( spawnErrno != 0 )
+            {
+                iFind->second.set_exception( std::make_exception_ptr( boost::process::process_error(
+                    std::error_code( spawnErrno, std::system_category() ), result.m_strError ) ) );
+            }
+            else
+            {
+                iFind->second.set_value( std::move( result ) );
+            }
+            m_pending.erase( iFind );
+        }
+    }
+
+    std::lock_guard< std::mutex > lock( m_pendingMutex );
+    m_bClosed = true;
+    for( auto& [ id, promise ] : m_pending )
+    {
+        promise.set_exception( std::make_exception_ptr( std::runtime_error( "Spawn server exited" ) ) );
+    }
+    m_pending.clear();
+}
+
+} // namespace common
+
+#endif // _WIN32
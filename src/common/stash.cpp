@@ -3,12 +3,25 @@
 #include "common/assert_verify.hpp"
 #include "common/file.hpp"
 #include "common/hash.hpp"
+#include "common/content_hash.hpp"
+#include "common/hash_memo.hpp"
+
+#include "stash_manifest.hpp"
+#include "stash_objects.hpp"
+#include "stash_access.hpp"
 
-#include "boost/tokenizer.hpp"
-#include "boost/lexical_cast.hpp"
 #include <boost/filesystem/operations.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <shared_mutex>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <set>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <exception>
 
 #include <map>
 #include <istream>
@@ -16,208 +29,575 @@
 
 namespace task
 {
-
-//////////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////
-
-struct Stash::Pimpl
+namespace
 {
-    const boost::filesystem::path m_stashDirectory;
+// invoke functor( index ) for every index in [ 0, szCount ) across nThreads threads
+// rethrowing the first exception once all threads have finished.  The calling thread
+// works alongside helpers taken from pPool or otherwise started for the call.
+template < typename Functor >
+void parallelFor( std::size_t szCount, unsigned int nThreads, Functor&& functor,
+                  boost::asio::thread_pool* pPool = nullptr )
+{
+    std::atomic< std::size_t > szNext( 0U );
+    std::atomic< bool >        bFailed( false );
+    std::exception_ptr         pException;
+    std::mutex                 exceptionMutex;
 
-    struct FileDeterminant
+    auto worker = [ & ]()
     {
-        boost::filesystem::path file;
-        DeterminantHash         determinant;
-        inline bool             operator<( const FileDeterminant& hash ) const
+        for( std::size_t szIndex = szNext++; szIndex < szCount && !bFailed; szIndex = szNext++ )
         {
-            return ( file != hash.file )                 ? ( file < hash.file )
-                   : ( determinant != hash.determinant ) ? ( determinant < hash.determinant )
-                                                         : false;
+            try
+            {
+                functor( szIndex );
+            }
+            catch( ... )
+            {
+                std::lock_guard< std::mutex > lock( exceptionMutex );
+                if( !bFailed.exchange( true ) )
+                {
+                    pException = std::current_exception();
+                }
+            }
         }
     };
-    struct StashItem
-    {
-        boost::filesystem::path filePath;
-        std::time_t             fileTime;
-    };
-    using Manifest = std::map< FileDeterminant, StashItem >;
-
-    mutable std::shared_mutex m_manifestMutex;
-    using WriteLock = std::unique_lock< std::shared_mutex >;
-    using ReadLock  = std::shared_lock< std::shared_mutex >;
-
-    Manifest m_manifest;
 
-    inline static const char* pszManifestFileName = "stash_manifest.txt";
+    nThreads = std::max( 1U, static_cast< unsigned int >( std::min< std::size_t >( nThreads, szCount ) ) );
 
-    static void load( std::istream& inStream, Manifest& output )
+    if( pPool )
     {
-        std::string strLine;
-        while ( std::getline( inStream, strLine ) )
+        std::mutex              helpersMutex;
+        std::condition_variable helpersCondition;
+        unsigned int            nHelpers = nThreads - 1U;
+        for( unsigned int i = 1U; i < nThreads; ++i )
         {
-            using Tokeniser = boost::tokenizer< boost::char_separator< char > >;
-            boost::char_separator< char > sep( "," );
-            Tokeniser                     tokens( strLine, sep );
-            for ( Tokeniser::iterator i = tokens.begin(); i != tokens.end(); ++i )
-            {
-                FileDeterminant fileHash;
-                fileHash.file = *i;
+            boost::asio::post( *pPool,
+                               [ & ]()
+                               {
+                                   worker();
+                                   std::lock_guard< std::mutex > lock( helpersMutex );
+                                   --nHelpers;
+                                   helpersCondition.notify_one();
+                               } );
+        }
+        worker();
+        std::unique_lock< std::mutex > lock( helpersMutex );
+        helpersCondition.wait( lock, [ &nHelpers ]() { return nHelpers == 0U; } );
+    }
+    else
+    {
+        std::vector< std::thread > threads;
+        for( unsigned int i = 1U; i < nThreads; ++i )
+        {
+            threads.emplace_back( worker );
+        }
+        worker();
+        for( std::thread& thread : threads )
+        {
+            thread.join();
+        }
+    }
 
-                if ( ++i == tokens.end() )
-                    THROW_RTE( "Error in stash manifest" );
-                fileHash.determinant = boost::lexical_cast< common::Hash >( *i );
+    if( pException )
+    {
+        std::rethrow_exception( pException );
+    }
+}
+} // namespace
 
-                if ( ++i == tokens.end() )
-                    THROW_RTE( "Error in stash manifest" );
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+void BuildHashCodes::hashAll( const std::vector< boost::filesystem::path >& files,
+                              std::optional< unsigned int >                 threads )
+{
+    struct Item
+    {
+        const boost::filesystem::path*       pFile;
+        boost::filesystem::FileStat          stat;
+        bool                                 bExists;
+        std::optional< common::HashCode128 > digest;
+    };
 
-                const boost::filesystem::path filePath = *i;
+    const unsigned int nThreads
+        = threads.has_value() ? threads.value() : std::max( 1U, std::thread::hardware_concurrency() );
+
+    std::vector< Item > items( files.size() );
+    parallelFor( files.size(), nThreads,
+                 [ &files, &items ]( std::size_t szIndex )
+                 {
+                     Item& item   = items[ szIndex ];
+                     item.pFile   = &files[ szIndex ];
+                     item.bExists = boost::filesystem::getFileStat( *item.pFile, item.stat );
+                     if( item.bExists )
+                     {
+                         item.digest = common::FileHashMemo::get().find( *item.pFile, item.stat );
+                     }
+                 } );
+
+    // read files in on disk order so the device sees ascending inode / extent order
+    std::sort( items.begin(), items.end(),
+               []( const Item& left, const Item& right )
+               {
+                   return ( left.stat.m_device != right.stat.m_device ) ? ( left.stat.m_device < right.stat.m_device )
+                                                                        : ( left.stat.m_inode < right.stat.m_inode );
+               } );
+
+    parallelFor( items.size(), nThreads,
+                 [ &items ]( std::size_t szIndex )
+                 {
+                     Item& item = items[ szIndex ];
+                     VERIFY_RTE_MSG( item.bExists, "File does not exist: " << item.pFile->string() );
+                     if( !item.digest.has_value() )
+                     {
+                         item.digest = common::hashFileContents< common::ContentHash >( *item.pFile );
+                         common::FileHashMemo::get().insert( *item.pFile, item.stat, item.digest.value() );
+                     }
+                 } );
+
+    for( const Item& item : items )
+    {
+        m_buildHashCodes.insert( std::make_pair( *item.pFile, FileHash( item.digest.value() ) ) );
+    }
+}
 
-                if ( ++i == tokens.end() )
-                    THROW_RTE( "Error in stash manifest" );
+namespace
+{
+// local stash directory of content addressed objects
+struct DirectoryBackend : public StashBackend
+{
+    const boost::filesystem::path m_stashDirectory;
+    const Stash::RestoreMode      m_restoreMode;
+    const Stash::Compression      m_compression;
 
-                const std::time_t fileTime = boost::lexical_cast< std::time_t >( *i );
+    // exclusive only to clear the stash
+    mutable std::shared_mutex m_manifestMutex;
+    using WriteLock = std::unique_lock< std::shared_mutex >;
+    using ReadLock  = std::shared_lock< std::shared_mutex >;
 
-                output.insert( std::make_pair( fileHash, StashItem{ filePath, fileTime } ) );
-            }
+    std::unique_ptr< StashManifest > m_pManifest;
+    StashObjects                     m_objects;
+    StashAccess                      m_access;
+
+    // eviction
+    std::mutex                     m_evictionMutex;
+    std::mutex                     m_evictionPassMutex;
+    std::condition_variable        m_evictionCondition;
+    std::optional< std::uint64_t > m_budget;
+    Stash::EvictionPolicy          m_evictionPolicy     = Stash::EvictionPolicy::eLRU;
+    bool                           m_bEvictionRequested = false;
+    bool                           m_bStopEviction      = false;
+    std::thread                    m_evictionThread;
+    std::atomic< std::uint64_t >   m_storedBytes;
+
+    // helpers for batched puts and gets - declared last so they are joined first
+    std::once_flag                              m_batchPoolOnce;
+    std::unique_ptr< boost::asio::thread_pool > m_pBatchPool;
+
+    inline static const char* pszManifestFileName = "stash_manifest.bin";
+    inline static const char* pszObjectsFolder    = "objects";
+    inline static const char* pszAccessFileName   = "stash_access.bin";
+
+    // objects not stashed or restored for this long are recompressed densely
+    static constexpr std::int64_t COLD_NANOSECONDS = 24LL * 60LL * 60LL * 1000000000LL;
+
+    DirectoryBackend( const boost::filesystem::path& stashDirectory,
+                      Stash::RestoreMode             restoreMode,
+                      Stash::Compression             compression )
+        : m_stashDirectory( stashDirectory )
+        , m_restoreMode( restoreMode )
+        , m_compression( compression )
+        , m_pManifest( std::make_unique< StashManifest >( m_stashDirectory / pszManifestFileName ) )
+        , m_objects( m_stashDirectory / pszObjectsFolder, compression )
+        , m_access( m_stashDirectory / pszAccessFileName )
+        , m_storedBytes( 0U )
+    {
+        if( m_compression == Stash::Compression::eAdaptive )
+        {
+            // recompress whatever became cold since the stash was last opened
+            std::lock_guard< std::mutex > lock( m_evictionMutex );
+            requestPass();
         }
     }
 
-    static void save( const Manifest& input, std::ostream& outStream )
+    ~DirectoryBackend()
     {
-        for ( Manifest::const_iterator i = input.begin(), iEnd = input.end(); i != iEnd; ++i )
         {
-            outStream << i->first.file.string() << ',' << i->first.determinant << ',' << i->second.filePath.string()
-                      << ',' << i->second.fileTime << '\n';
+            std::lock_guard< std::mutex > lock( m_evictionMutex );
+            m_bStopEviction = true;
+        }
+        m_evictionCondition.notify_all();
+        if( m_evictionThread.joinable() )
+        {
+            m_evictionThread.join();
+        }
+        try
+        {
+            saveAccess();
+        }
+        catch( std::exception& )
+        {
+            // losing access history only makes eviction less accurate
         }
     }
 
-    void saveManifest()
+    // merge with the access saved by every other process sharing the stash
+    void saveAccess()
     {
-        const boost::filesystem::path manifestFile = m_stashDirectory / pszManifestFileName;
-        boost::filesystem::ensureFoldersExist( manifestFile );
-        std::unique_ptr< boost::filesystem::ofstream > pFileStream
-            = boost::filesystem::createNewFileStream( manifestFile );
-        save( m_manifest, *pFileStream );
+        m_pManifest->exclusive( [ this ]() { m_access.save(); } );
     }
 
-    Pimpl( const boost::filesystem::path& stashDirectory )
-        : m_stashDirectory( stashDirectory )
+    void clear() override
     {
-        const boost::filesystem::path manifestFile = m_stashDirectory / pszManifestFileName;
-        if ( boost::filesystem::exists( manifestFile ) )
+        WriteLock lock( m_manifestMutex );
+        m_pManifest.reset();
+        // read only objects cannot be removed on windows
+        const boost::filesystem::path objectsDirectory = m_stashDirectory / pszObjectsFolder;
+        if( boost::filesystem::exists( objectsDirectory ) )
         {
-            std::ifstream inputFileStream( manifestFile.native().c_str(), std::ios::in );
-            if ( !inputFileStream.good() )
+            for( boost::filesystem::recursive_directory_iterator i( objectsDirectory ), iEnd; i != iEnd; ++i )
             {
-                THROW_RTE( "Failed to open file: " << manifestFile.string() );
+                boost::filesystem::permissions(
+                    i->path(), boost::filesystem::add_perms | boost::filesystem::owner_write );
             }
-            load( inputFileStream, m_manifest );
         }
-        else
+        boost::filesystem::remove_all( m_stashDirectory );
+        m_pManifest = std::make_unique< StashManifest >( m_stashDirectory / pszManifestFileName );
+        m_access.clear();
+        m_storedBytes = 0U;
+    }
+
+    std::vector< bool > has( const StashKeys& keys ) override
+    {
+        std::vector< bool > result;
+        result.reserve( keys.size() );
+        ReadLock lock( m_manifestMutex );
+        for( const StashKey& key : keys )
         {
-            m_manifest.clear();
+            const std::optional< StashManifest::Value > stashItem = m_pManifest->find( key.m_file, key.m_determinant );
+            result.push_back( stashItem.has_value() && m_objects.has( stashItem->m_object ) );
         }
+        return result;
     }
 
-    void clear()
+    void put( const StashKeys& keys ) override
     {
-        WriteLock lock( m_manifestMutex );
-        boost::filesystem::remove_all( m_stashDirectory );
-        m_manifest.clear();
+        parallelFor(
+            keys.size(), getBatchThreads(),
+            [ this, &keys ]( std::size_t szIndex ) { stash( keys[ szIndex ].m_file, keys[ szIndex ].m_determinant ); },
+            getBatchPool( keys.size() ) );
+    }
+
+    std::vector< bool > get( const StashKeys& keys ) override
+    {
+        std::vector< unsigned char > restored( keys.size(), 0U );
+        parallelFor(
+            keys.size(), getBatchThreads(),
+            [ this, &keys, &restored ]( std::size_t szIndex )
+            { restored[ szIndex ] = restore( keys[ szIndex ].m_file, keys[ szIndex ].m_determinant ); },
+            getBatchPool( keys.size() ) );
+        return std::vector< bool >( restored.begin(), restored.end() );
+    }
+
+    static unsigned int getBatchThreads() { return std::max( 1U, std::thread::hardware_concurrency() ); }
+
+    // started by the first batch of more than one file and shared by every batch after
+    // so concurrent batches never run more than one helper per core between them
+    boost::asio::thread_pool* getBatchPool( std::size_t szBatch )
+    {
+        if( szBatch < 2U || getBatchThreads() < 2U )
+        {
+            return nullptr;
+        }
+        std::call_once( m_batchPoolOnce,
+                        [ this ]() { m_pBatchPool = std::make_unique< boost::asio::thread_pool >( getBatchThreads() - 1U ); } );
+        return m_pBatchPool.get();
     }
 
-    void stash( const boost::filesystem::path& file, DeterminantHash determinant )
+    void stash( const boost::filesystem::path& file, const common::HashCode128& determinant )
     {
         VERIFY_RTE_MSG( boost::filesystem::exists( file ), "File not found: " << file.string() );
 
-        boost::filesystem::path stashFile;
+        // store the object before publishing so a restore never sees a partial object
+        const std::time_t         fileTime      = boost::filesystem::last_write_time( file );
+        std::uint64_t             szStoredBytes = 0U;
+        const common::HashCode128 object        = m_objects.put( file, szStoredBytes );
+        m_access.touch( object, false );
+
         {
-            WriteLock lock( m_manifestMutex );
+            // the manifest group commits concurrent inserts
+            ReadLock lock( m_manifestMutex );
+            m_pManifest->insert( file, determinant, StashManifest::Value{ object, fileTime } );
+        }
 
-            const boost::filesystem::path manifestFile = m_stashDirectory / pszManifestFileName;
-            boost::filesystem::ensureFoldersExist( manifestFile );
+        if( szStoredBytes != 0U )
+        {
+            const std::uint64_t szTotal = m_storedBytes += szStoredBytes;
+            std::lock_guard< std::mutex > lock( m_evictionMutex );
+            if( m_budget.has_value() && szTotal > m_budget.value() )
+            {
+                m_bEvictionRequested = true;
+                m_evictionCondition.notify_all();
+            }
+        }
+    }
 
-            // determine a new stash file
-            for ( std::size_t szFileID = m_manifest.size();; ++szFileID )
+    // is the file a hard link to the stash object from an earlier restore
+    bool isLinkedObject( const boost::filesystem::path& file, const common::HashCode128& object ) const
+    {
+        boost::system::error_code ec;
+        return boost::filesystem::equivalent( file, m_objects.getObjectFile( object ), ec ) && !ec;
+    }
+
+    bool restore( const boost::filesystem::path& file, const common::HashCode128& determinant )
+    {
+        std::optional< StashManifest::Value > stashItem;
+        {
+            ReadLock lock( m_manifestMutex );
+            stashItem = m_pManifest->find( file, determinant );
+        }
+
+        if( stashItem.has_value() && m_objects.has( stashItem->m_object ) )
+        {
+            const std::time_t fileTime = stashItem->m_fileTime;
+
+            if( boost::filesystem::exists( file ) )
             {
-                std::ostringstream osFileName;
-                osFileName << "stash_" << szFileID << ".st";
-                const boost::filesystem::path tryFile = m_stashDirectory / osFileName.str();
-                if ( !boost::filesystem::exists( tryFile ) )
+                // attempt to re-use existing file
+                if( FileHash( file ).getDigest() == stashItem->m_object )
                 {
-                    stashFile = tryFile;
-                    break;
+                    if( last_write_time( file ) != fileTime && !isLinkedObject( file, stashItem->m_object ) )
+                        last_write_time( file, fileTime );
+                    m_access.touch( stashItem->m_object, true );
+                    return true;
                 }
+                boost::filesystem::remove( file );
             }
+            ensureFoldersExist( file );
 
-            m_manifest[ FileDeterminant{ file, determinant } ]
-                = StashItem{ stashFile, boost::filesystem::last_write_time( file ) };
-
-            saveManifest();
+            bool bLinked = false;
+            if( m_objects.materialise( stashItem->m_object, file, m_restoreMode, bLinked ) )
+            {
+                // the modified time of a hard link is the stash time of the object
+                if( !bLinked )
+                    last_write_time( file, fileTime );
+                m_access.touch( stashItem->m_object, true );
+                return true;
+            }
         }
+        return false;
+    }
 
-        boost::filesystem::copy( file, stashFile );
+    void setBudget( std::optional< std::uint64_t > budget, Stash::EvictionPolicy policy ) override
+    {
+        {
+            std::lock_guard< std::mutex > lock( m_evictionMutex );
+            m_budget         = budget;
+            m_evictionPolicy = policy;
+            if( !budget.has_value() )
+            {
+                return;
+            }
+            // the first pass measures the stash
+            requestPass();
+        }
+        m_evictionCondition.notify_all();
     }
 
-    bool restore( const boost::filesystem::path& file, DeterminantHash determinant )
+    // requires m_evictionMutex
+    void requestPass()
     {
-        const StashItem* pStashItem = nullptr;
+        m_bEvictionRequested = true;
+        if( !m_evictionThread.joinable() )
+        {
+            m_evictionThread = std::thread( [ this ]() { evictionThread(); } );
+        }
+    }
 
+    void evictionThread()
+    {
+        std::unique_lock< std::mutex > lock( m_evictionMutex );
+        while( !m_bStopEviction )
         {
-            ReadLock                 lock( m_manifestMutex );
-            Manifest::const_iterator iFind = m_manifest.find( FileDeterminant{ file, determinant } );
-            if ( iFind != m_manifest.end() )
+            m_evictionCondition.wait( lock, [ this ]() { return m_bEvictionRequested || m_bStopEviction; } );
+            if( m_bStopEviction )
             {
-                pStashItem = &iFind->second;
+                break;
             }
+            m_bEvictionRequested = false;
+            lock.unlock();
+            try
+            {
+                evict();
+            }
+            catch( std::exception& )
+            {
+                // the stash is a cache - a failed pass is retried when next over budget
+            }
+            lock.lock();
+        }
+    }
+
+    void evict() override
+    {
+        std::optional< std::uint64_t > budget;
+        Stash::EvictionPolicy          policy;
+        {
+            std::lock_guard< std::mutex > lock( m_evictionMutex );
+            budget = m_budget;
+            policy = m_evictionPolicy;
         }
 
-        if ( pStashItem )
+        // one pass at a time so that concurrent passes cannot both evict down to the target
+        std::lock_guard< std::mutex > passLock( m_evictionPassMutex );
+        ReadLock                      lock( m_manifestMutex );
+
+        // order eviction by the access of every process sharing the stash
+        saveAccess();
+
+        struct Candidate
+        {
+            StashObjects::ObjectInfo m_info;
+            StashAccess::Access      m_access;
+        };
+        std::vector< Candidate > candidates;
+        std::uint64_t            szTotal = 0U;
+        for( const StashObjects::ObjectInfo& info : m_objects.list() )
         {
-            const StashItem& stashItem = *pStashItem;
+            szTotal += info.m_size;
+            // objects with no recorded access are aged by when they were stashed
+            const std::optional< StashAccess::Access > access = m_access.find( info.m_digest );
+            candidates.push_back( Candidate{
+                info,
+                access.has_value() ? access.value()
+                                   : StashAccess::Access{ static_cast< std::int64_t >( info.m_stashTime ) * 1000000000,
+                                                          0U } } );
+        }
+        m_storedBytes = szTotal;
 
-            if ( boost::filesystem::exists( stashItem.filePath ) )
+        if( budget.has_value() && szTotal > budget.value() )
+        {
+            switch( policy )
             {
-                if ( boost::filesystem::exists( file ) )
+                case Stash::EvictionPolicy::eLRU:
+                    std::sort( candidates.begin(), candidates.end(),
+                               []( const Candidate& left, const Candidate& right )
+                               {
+                                   return left.m_access.m_lastAccessNanoSeconds
+                                          < right.m_access.m_lastAccessNanoSeconds;
+                               } );
+                    break;
+                case Stash::EvictionPolicy::eLFU:
+                    std::sort( candidates.begin(), candidates.end(),
+                               []( const Candidate& left, const Candidate& right )
+                               {
+                                   return ( left.m_access.m_restoreCount != right.m_access.m_restoreCount )
+                                              ? ( left.m_access.m_restoreCount < right.m_access.m_restoreCount )
+                                              : ( left.m_access.m_lastAccessNanoSeconds
+                                                  < right.m_access.m_lastAccessNanoSeconds );
+                               } );
+                    break;
+            }
+
+            // evict below the budget so that passes are not triggered by every stash
+            const std::uint64_t szTarget = budget.value() - budget.value() / 10U;
+
+            std::set< common::HashCode128 > evicted;
+            for( const Candidate& candidate : candidates )
+            {
+                if( szTotal <= szTarget )
+                {
+                    break;
+                }
+                // a restore racing with removal simply misses
+                if( m_objects.remove( candidate.m_info.m_digest ) )
+                {
+                    szTotal -= candidate.m_info.m_size;
+                    evicted.insert( candidate.m_info.m_digest );
+                }
+            }
+            m_storedBytes = szTotal;
+
+            m_pManifest->eraseObjects( evicted );
+            m_access.erase( evicted );
+        }
+
+        if( m_compression == Stash::Compression::eAdaptive )
+        {
+            const std::int64_t coldNanoSeconds = std::chrono::duration_cast< std::chrono::nanoseconds >(
+                                                     std::chrono::system_clock::now().time_since_epoch() )
+                                                     .count()
+                                                 - COLD_NANOSECONDS;
+            for( const Candidate& candidate : candidates )
+            {
+                if( candidate.m_info.m_level != 0 && candidate.m_info.m_level < StashObjects::DENSE_LEVEL
+                    && candidate.m_access.m_lastAccessNanoSeconds < coldNanoSeconds )
                 {
-                    // attempt to re-use existing file
-                    if ( common::Hash( file ) == common::Hash( stashItem.filePath ) )
+                    // evicted objects have gone so are skipped
+                    const std::optional< std::uint64_t > szSize
+                        = m_objects.recompress( candidate.m_info.m_digest, StashObjects::DENSE_LEVEL );
+                    if( szSize.has_value() )
                     {
-                        if ( last_write_time( file ) != stashItem.fileTime )
-                            last_write_time( file, stashItem.fileTime );
-                        return true;
+                        m_storedBytes -= candidate.m_info.m_size - std::min( candidate.m_info.m_size, szSize.value() );
                     }
-                    boost::filesystem::remove( file );
                 }
-                ensureFoldersExist( file );
-
-                boost::filesystem::copy( stashItem.filePath, file );
-                last_write_time( file, stashItem.fileTime );
-                return true;
             }
         }
-        return false;
+
+        saveAccess();
     }
 };
 
-Stash::Stash( const boost::filesystem::path& stashDirectory )
-    : m_pPimpl( std::make_shared< Pimpl >( stashDirectory ) )
+} // namespace
+
+Stash::Stash( const boost::filesystem::path& stashDirectory, RestoreMode restoreMode, Compression compression )
+    : m_pBackend( std::make_shared< DirectoryBackend >( stashDirectory, restoreMode, compression ) )
 {
 }
 
+Stash::Stash( std::shared_ptr< StashBackend > pBackend )
+    : m_pBackend( pBackend )
+{
+    VERIFY_RTE_MSG( m_pBackend, "Invalid stash backend" );
+}
+
 void Stash::clear()
 {
-    m_pPimpl->clear();
+    m_pBackend->clear();
 }
 
 void Stash::stash( const boost::filesystem::path& file, const DeterminantHash determinant )
 {
-    m_pPimpl->stash( file, determinant );
+    m_pBackend->put( StashKeys{ StashKey{ file, determinant.getDigest() } } );
 }
 
 bool Stash::restore( const boost::filesystem::path& file, const DeterminantHash determinant )
 {
-    return m_pPimpl->restore( file, determinant );
+    return m_pBackend->get( StashKeys{ StashKey{ file, determinant.getDigest() } } ).front();
+}
+
+std::vector< bool > Stash::has( const StashKeys& keys )
+{
+    return m_pBackend->has( keys );
+}
+
+void Stash::stash( const StashKeys& keys )
+{
+    m_pBackend->put( keys );
+}
+
+std::vector< bool > Stash::restore( const StashKeys& keys )
+{
+    return m_pBackend->get( keys );
+}
+
+void Stash::setBudget( std::optional< std::uint64_t > budget, EvictionPolicy policy )
+{
+    m_pBackend->setBudget( budget, policy );
+}
+
+void Stash::evict()
+{
+    m_pBackend->evict();
 }
 
 } // namespace task
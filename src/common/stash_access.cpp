@@ -0,0 +1,191 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#include "stash_access.hpp"
+#include "record_file.hpp"
+
+#include "common/assert_verify.hpp"
+
+namespace task
+{
+namespace
+{
+static constexpr char          ACCESS_MAGIC[ 8 ] = { 'E', 'D', 'S', 'S', 'A', 'C', 'C', 'S' };
+static constexpr std::uint32_t ACCESS_VERSION    = 1U;
+
+struct Record
+{
+    std::uint64_t m_objectLow;
+    std::uint64_t m_objectHigh;
+    std::int64_t  m_lastAccessNanoSeconds;
+    std::uint64_t m_restoreCount;
+};
+
+static_assert( sizeof( Record ) == 32U, "Unexpected stash access record size" );
+
+std::map< common::HashCode128, StashAccess::Access > readAccessFile( const boost::filesystem::path& accessFile )
+{
+    // an invalid access file has no records so history starts again
+    common::RecordFileReader< Record > reader( accessFile, ACCESS_MAGIC, ACCESS_VERSION );
+
+    std::map< common::HashCode128, StashAccess::Access > access;
+    Record                                               record;
+    for( std::uint64_t i = 0U; i != reader.getCount() && reader.read( record ); ++i )
+    {
+        access[ common::HashCode128{ record.m_objectLow, record.m_objectHigh } ]
+            = StashAccess::Access{ record.m_lastAccessNanoSeconds, record.m_restoreCount };
+    }
+    return access;
+}
+} // namespace
+
+StashAccess::StashAccess( const boost::filesystem::path& accessFile )
+    : m_accessFile( accessFile )
+{
+    try
+    {
+        load();
+    }
+    catch( std::exception& )
+    {
+        // access history is advisory - start again
+        clear();
+    }
+}
+
+void StashAccess::touch( const common::HashCode128& object, bool bRestore )
+{
+    const std::int64_t            now = common::nowNanoSeconds();
+    std::lock_guard< std::mutex > lock( m_mutex );
+    Access&                       access = m_access[ object ];
+    access.m_lastAccessNanoSeconds       = std::max( access.m_lastAccessNanoSeconds, now );
+    if( bRestore )
+    {
+        ++access.m_restoreCount;
+        ++m_unsavedRestores[ object ];
+    }
+    m_erased.erase( object );
+    m_bModified = true;
+}
+
+std::optional< StashAccess::Access > StashAccess::find( const common::HashCode128& object ) const
+{
+    std::lock_guard< std::mutex > lock( m_mutex );
+    auto                          iFind = m_access.find( object );
+    if( iFind != m_access.end() )
+    {
+        return iFind->second;
+    }
+    return std::optional< Access >();
+}
+
+void StashAccess::erase( const std::set< common::HashCode128 >& objects )
+{
+    std::lock_guard< std::mutex > lock( m_mutex );
+    for( const common::HashCode128& object : objects )
+    {
+        m_access.erase( object );
+        m_unsavedRestores.erase( object );
+        m_erased.insert( object );
+    }
+    m_bModified = true;
+}
+
+void StashAccess::clear()
+{
+    std::lock_guard< std::mutex > lock( m_mutex );
+    m_access.clear();
+    m_unsavedRestores.clear();
+    m_erased.clear();
+    m_bCleared  = true;
+    m_bModified = true;
+}
+
+void StashAccess::load()
+{
+    std::map< common::HashCode128, Access > access = readAccessFile( m_accessFile );
+
+    std::lock_guard< std::mutex > lock( m_mutex );
+    m_access = std::move( access );
+    m_unsavedRestores.clear();
+    m_erased.clear();
+    m_bCleared = false;
+}
+
+void StashAccess::save()
+{
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        if( !m_bModified )
+        {
+            return;
+        }
+    }
+
+    // read without blocking touch - the caller's lock keeps other processes out
+    std::map< common::HashCode128, Access > merged;
+    try
+    {
+        merged = readAccessFile( m_accessFile );
+    }
+    catch( std::exception& )
+    {
+        // access history is advisory - replace what cannot be read
+    }
+
+    std::unique_lock< std::mutex > lock( m_mutex );
+    if( m_bCleared )
+    {
+        merged.clear();
+    }
+    for( const common::HashCode128& object : m_erased )
+    {
+        merged.erase( object );
+    }
+    for( const auto& [ object, access ] : m_access )
+    {
+        auto iFind = merged.find( object );
+        if( iFind == merged.end() )
+        {
+            merged.insert( { object, access } );
+        }
+        else
+        {
+            auto iRestores = m_unsavedRestores.find( object );
+            iFind->second.m_lastAccessNanoSeconds
+                = std::max( iFind->second.m_lastAccessNanoSeconds, access.m_lastAccessNanoSeconds );
+            iFind->second.m_restoreCount += iRestores != m_unsavedRestores.end() ? iRestores->second : 0U;
+        }
+    }
+    m_access = merged;
+    m_unsavedRestores.clear();
+    m_erased.clear();
+    m_bCleared  = false;
+    m_bModified = false;
+
+    common::RecordFileWriter writer( ACCESS_MAGIC, ACCESS_VERSION, m_access.size(), sizeof( Record ) );
+    for( const auto& [ object, access ] : m_access )
+    {
+        writer.write( Record{ object.m_low, object.m_high, access.m_lastAccessNanoSeconds, access.m_restoreCount } );
+    }
+    lock.unlock();
+    writer.save( m_accessFile );
+}
+
+} // namespace task
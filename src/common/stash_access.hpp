@@ -0,0 +1,81 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#ifndef GUARD_2024_April_12_stash_access
+#define GUARD_2024_April_12_stash_access
+
+#include "common/content_hash.hpp"
+
+#include "boost/filesystem/path.hpp"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+
+namespace task
+{
+
+// StashAccess
+//
+// Last access time and restore count of each stash object used to order eviction.
+// Access is recorded in memory and only persisted by save() - losing recent access
+// after a crash only makes the next eviction pass slightly less accurate.
+//
+// Every process sharing a stash saves to the same file so save() merges with what
+// the others have saved, taking the latest access and adding the restores made since
+// the last save, and must be called holding the stash's cross process writer lock.
+class StashAccess
+{
+public:
+    struct Access
+    {
+        std::int64_t  m_lastAccessNanoSeconds = 0;
+        std::uint64_t m_restoreCount          = 0U;
+    };
+
+    StashAccess( const boost::filesystem::path& accessFile );
+
+    // record a stash or restore of the object
+    void touch( const common::HashCode128& object, bool bRestore );
+
+    std::optional< Access > find( const common::HashCode128& object ) const;
+    void                    erase( const std::set< common::HashCode128 >& objects );
+    void                    clear();
+
+    void load();
+    void save();
+
+private:
+    const boost::filesystem::path m_accessFile;
+
+    mutable std::mutex                      m_mutex;
+    std::map< common::HashCode128, Access > m_access;
+    bool                                    m_bModified = false;
+
+    // what is merged into the saved access by the next save
+    std::map< common::HashCode128, std::uint64_t > m_unsavedRestores;
+    std::set< common::HashCode128 >                m_erased;
+    bool                                           m_bCleared = false;
+};
+
+} // namespace task
+
+#endif // GUARD_2024_April_12_stash_access
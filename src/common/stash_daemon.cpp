@@ -0,0 +1,560 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#include "common/stash_daemon.hpp"
+#include "common/file.hpp"
+#include "common/assert_verify.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace task
+{
+namespace
+{
+// every message is a MessageHeader followed by m_bodySize bytes
+//
+// request body  - per key a KeyHeader followed by the path bytes
+// response body - m_count result bytes or the error message when m_status is not eOK
+static constexpr std::uint32_t PROTOCOL_MAGIC    = 0x31534445U; // "EDS1"
+static constexpr std::uint32_t MAXIMUM_BODY_SIZE = 64U * 1024U * 1024U;
+
+enum class RequestType : std::uint32_t
+{
+    eHas = 1U,
+    eGet,
+    ePut,
+    eClear
+};
+
+enum class ResponseStatus : std::uint32_t
+{
+    eOK = 0U,
+    eError
+};
+
+struct MessageHeader
+{
+    std::uint32_t m_magic;
+    std::uint32_t m_type;
+    std::uint32_t m_count;
+    std::uint32_t m_bodySize;
+};
+
+struct KeyHeader
+{
+    std::uint64_t m_determinantLow;
+    std::uint64_t m_determinantHigh;
+    std::uint32_t m_pathLength;
+    std::uint32_t m_reserved;
+};
+
+static_assert( sizeof( MessageHeader ) == 16U, "Unexpected stash daemon message header size" );
+static_assert( sizeof( KeyHeader ) == 24U, "Unexpected stash daemon key header size" );
+
+void encodeMessage( std::uint32_t type, std::uint32_t count, const std::string& strBody, std::string& strMessage )
+{
+    VERIFY_RTE_MSG( strBody.size() <= MAXIMUM_BODY_SIZE, "Stash daemon message too large" );
+    const MessageHeader header{ PROTOCOL_MAGIC, type, count, static_cast< std::uint32_t >( strBody.size() ) };
+    strMessage.append( reinterpret_cast< const char* >( &header ), sizeof( MessageHeader ) );
+    strMessage.append( strBody );
+}
+
+void encodeRequest( RequestType type, StashKeys::const_iterator iBegin, StashKeys::const_iterator iEnd,
+                    std::string& strMessage )
+{
+    std::string strBody;
+    for( StashKeys::const_iterator i = iBegin; i != iEnd; ++i )
+    {
+        // the daemon does not share the working directory of the client
+        const std::string strPath = boost::filesystem::absolute( i->m_file ).string();
+        const KeyHeader   keyHeader{
+            i->m_determinant.m_low, i->m_determinant.m_high, static_cast< std::uint32_t >( strPath.size() ), 0U };
+        strBody.append( reinterpret_cast< const char* >( &keyHeader ), sizeof( KeyHeader ) );
+        strBody.append( strPath );
+    }
+    encodeMessage(
+        static_cast< std::uint32_t >( type ), static_cast< std::uint32_t >( iEnd - iBegin ), strBody, strMessage );
+}
+
+StashKeys decodeRequest( const MessageHeader& header, const std::string& strBody )
+{
+    StashKeys   keys;
+    std::size_t szOffset = 0U;
+    for( std::uint32_t i = 0U; i != header.m_count; ++i )
+    {
+        KeyHeader keyHeader;
+        VERIFY_RTE_MSG( szOffset + sizeof( KeyHeader ) <= strBody.size(), "Malformed stash daemon request" );
+        std::memcpy( &keyHeader, strBody.data() + szOffset, sizeof( KeyHeader ) );
+        szOffset += sizeof( KeyHeader );
+        VERIFY_RTE_MSG( szOffset + keyHeader.m_pathLength <= strBody.size(), "Malformed stash daemon request" );
+        keys.push_back( StashKey{ boost::filesystem::path( strBody.substr( szOffset, keyHeader.m_pathLength ) ),
+                                  common::HashCode128{ keyHeader.m_determinantLow, keyHeader.m_determinantHigh } } );
+        szOffset += keyHeader.m_pathLength;
+    }
+    VERIFY_RTE_MSG( szOffset == strBody.size(), "Malformed stash daemon request" );
+    return keys;
+}
+} // namespace
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+
+using Socket = boost::asio::local::stream_protocol::socket;
+
+namespace
+{
+// the daemon reads and writes files with its own privileges so only serves its own user
+bool isDaemonUser( Socket& socket )
+{
+#ifdef SO_PEERCRED
+    ucred     credentials;
+    socklen_t szLength = sizeof( credentials );
+    return ::getsockopt( socket.native_handle(), SOL_SOCKET, SO_PEERCRED, &credentials, &szLength ) == 0
+           && credentials.uid == ::geteuid();
+#else
+    uid_t uid = 0;
+    gid_t gid = 0;
+    return ::getpeereid( socket.native_handle(), &uid, &gid ) == 0 && uid == ::geteuid();
+#endif
+}
+} // namespace
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+struct StashDaemonClient::Pimpl
+{
+    const boost::filesystem::path            m_socketPath;
+    boost::asio::io_context                  m_ioContext;
+    std::mutex                               m_mutex;
+    std::vector< std::unique_ptr< Socket > > m_idle;
+
+    Pimpl( const boost::filesystem::path& socketPath )
+        : m_socketPath( socketPath )
+    {
+        // fail early if there is no daemon
+        release( connect() );
+    }
+
+    std::unique_ptr< Socket > connect()
+    {
+        auto                      pSocket = std::make_unique< Socket >( m_ioContext );
+        boost::system::error_code ec;
+        pSocket->connect( boost::asio::local::stream_protocol::endpoint( m_socketPath.string() ), ec );
+        VERIFY_RTE_MSG( !ec, "Failed to connect to stash daemon: " << m_socketPath.string() << " : " << ec.message() );
+        return pSocket;
+    }
+
+    std::unique_ptr< Socket > acquire()
+    {
+        {
+            std::lock_guard< std::mutex > lock( m_mutex );
+            if( !m_idle.empty() )
+            {
+                std::unique_ptr< Socket > pSocket = std::move( m_idle.back() );
+                m_idle.pop_back();
+                return pSocket;
+            }
+        }
+        return connect();
+    }
+
+    void release( std::unique_ptr< Socket > pSocket )
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        m_idle.push_back( std::move( pSocket ) );
+    }
+
+    // returns the result bytes of every request in order
+    std::vector< unsigned char > call( RequestType type, const StashKeys& keys )
+    {
+        const std::size_t szRequests = std::max< std::size_t >( 1U, ( keys.size() + BATCH_SIZE - 1U ) / BATCH_SIZE );
+
+        std::vector< unsigned char > results;
+        results.reserve( keys.size() );
+
+        // a connection with a failed request in flight is discarded rather than released
+        std::unique_ptr< Socket > pSocket = acquire();
+        std::size_t               szSent = 0U, szReceived = 0U;
+        while( szReceived != szRequests )
+        {
+            while( szSent != szRequests && szSent - szReceived < PIPELINE_DEPTH )
+            {
+                const std::size_t szBegin = std::min( szSent * BATCH_SIZE, keys.size() );
+                const std::size_t szEnd   = std::min( szBegin + BATCH_SIZE, keys.size() );
+                std::string       strMessage;
+                encodeRequest( type, keys.begin() + szBegin, keys.begin() + szEnd, strMessage );
+                boost::asio::write( *pSocket, boost::asio::buffer( strMessage ) );
+                ++szSent;
+            }
+
+            MessageHeader header;
+            boost::asio::read( *pSocket, boost::asio::buffer( &header, sizeof( MessageHeader ) ) );
+            VERIFY_RTE_MSG( header.m_magic == PROTOCOL_MAGIC && header.m_bodySize <= MAXIMUM_BODY_SIZE,
+                            "Malformed stash daemon response" );
+            std::string strBody( header.m_bodySize, '\0' );
+            boost::asio::read( *pSocket, boost::asio::buffer( strBody.data(), strBody.size() ) );
+            VERIFY_RTE_MSG( header.m_type == static_cast< std::uint32_t >( ResponseStatus::eOK ),
+                            "Stash daemon error: " << strBody );
+            results.insert( results.end(), strBody.begin(), strBody.end() );
+            ++szReceived;
+        }
+        release( std::move( pSocket ) );
+        return results;
+    }
+
+    std::vector< bool > callForResults( RequestType type, const StashKeys& keys )
+    {
+        const std::vector< unsigned char > results = call( type, keys );
+        VERIFY_RTE_MSG( results.size() == keys.size(), "Malformed stash daemon response" );
+        return std::vector< bool >( results.begin(), results.end() );
+    }
+};
+
+StashDaemonClient::StashDaemonClient( const boost::filesystem::path& socketPath )
+    : m_pPimpl( std::make_unique< Pimpl >( socketPath ) )
+{
+}
+
+StashDaemonClient::~StashDaemonClient() = default;
+
+std::vector< bool > StashDaemonClient::has( const StashKeys& keys )
+{
+    return m_pPimpl->callForResults( RequestType::eHas, keys );
+}
+
+void StashDaemonClient::put( const StashKeys& keys )
+{
+    m_pPimpl->call( RequestType::ePut, keys );
+}
+
+std::vector< bool > StashDaemonClient::get( const StashKeys& keys )
+{
+    return m_pPimpl->callForResults( RequestType::eGet, keys );
+}
+
+void StashDaemonClient::clear()
+{
+    m_pPimpl->call( RequestType::eClear, StashKeys{} );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+struct StashDaemon::Pimpl
+{
+    const boost::filesystem::path                 m_socketPath;
+    Stash                                         m_stash;
+    boost::asio::io_context                       m_ioContext;
+    boost::asio::local::stream_protocol::acceptor m_acceptor;
+    boost::asio::thread_pool                      m_workers;
+    std::thread                                   m_ioThread;
+    bool                                          m_bStopped = false;
+
+    // one connection - up to PIPELINE_DEPTH requests are processed on the workers at
+    // once and answered in the order they were read.  Everything but process runs on
+    // the io thread.
+    struct Session : public std::enable_shared_from_this< Session >
+    {
+        Pimpl&        m_daemon;
+        Socket        m_socket;
+        MessageHeader m_header;
+        std::string   m_strBody;
+
+        std::uint64_t                          m_nextRequest  = 0U;
+        std::uint64_t                          m_nextResponse = 0U;
+        std::map< std::uint64_t, std::string > m_responses;
+        bool                                   m_bWriting     = false;
+        bool                                   m_bReadPaused  = false;
+
+        Session( Pimpl& daemon, Socket socket )
+            : m_daemon( daemon )
+            , m_socket( std::move( socket ) )
+        {
+        }
+
+        void readNext()
+        {
+            if( m_nextRequest - m_nextResponse < StashDaemonClient::PIPELINE_DEPTH )
+            {
+                readHeader();
+            }
+            else
+            {
+                m_bReadPaused = true;
+            }
+        }
+
+        void readHeader()
+        {
+            auto pSession = shared_from_this();
+            boost::asio::async_read( m_socket, boost::asio::buffer( &m_header, sizeof( MessageHeader ) ),
+                                     [ pSession ]( boost::system::error_code ec, std::size_t )
+                                     {
+                                         if( !ec && pSession->m_header.m_magic == PROTOCOL_MAGIC
+                                             && pSession->m_header.m_bodySize <= MAXIMUM_BODY_SIZE )
+                                         {
+                                             pSession->readBody();
+                                         }
+                                     } );
+        }
+
+        void readBody()
+        {
+            auto pSession = shared_from_this();
+            m_strBody.resize( m_header.m_bodySize );
+            boost::asio::async_read( m_socket, boost::asio::buffer( m_strBody.data(), m_strBody.size() ),
+                                     [ pSession ]( boost::system::error_code ec, std::size_t )
+                                     {
+                                         if( !ec )
+                                         {
+                                             boost::asio::post( pSession->m_daemon.m_workers,
+                                                                [ pSession, request = pSession->m_nextRequest++,
+                                                                  header  = pSession->m_header,
+                                                                  strBody = std::move( pSession->m_strBody ) ]()
+                                                                { pSession->process( request, header, strBody ); } );
+                                             pSession->readNext();
+                                         }
+                                     } );
+        }
+
+        void process( std::uint64_t request, const MessageHeader& header, const std::string& strRequest )
+        {
+            std::string   strBody;
+            std::uint32_t count  = 0U;
+            auto          status = ResponseStatus::eOK;
+            try
+            {
+                const StashKeys keys = decodeRequest( header, strRequest );
+
+                std::vector< bool > results;
+                switch( static_cast< RequestType >( header.m_type ) )
+                {
+                    case RequestType::eHas:
+                        results = m_daemon.m_stash.has( keys );
+                        break;
+                    case RequestType::eGet:
+                        results = m_daemon.m_stash.restore( keys );
+                        break;
+                    case RequestType::ePut:
+                        m_daemon.m_stash.stash( keys );
+                        break;
+                    case RequestType::eClear:
+                        m_daemon.m_stash.clear();
+                        break;
+                    default:
+                        THROW_RTE( "Unknown stash daemon request: " << header.m_type );
+                }
+                strBody.assign( results.begin(), results.end() );
+                count = static_cast< std::uint32_t >( results.size() );
+            }
+            catch( std::exception& ex )
+            {
+                status  = ResponseStatus::eError;
+                strBody = ex.what();
+                count   = 0U;
+            }
+
+            std::string strResponse;
+            encodeMessage( static_cast< std::uint32_t >( status ), count, strBody, strResponse );
+
+            auto pSession = shared_from_this();
+            boost::asio::post( m_daemon.m_ioContext,
+                               [ pSession, request, strResponse = std::move( strResponse ) ]() mutable
+                               {
+                                   pSession->m_responses[ request ] = std::move( strResponse );
+                                   pSession->writeResponse();
+                               } );
+        }
+
+        void writeResponse()
+        {
+            if( m_bWriting || m_responses.empty() || m_responses.begin()->first != m_nextResponse )
+            {
+                return;
+            }
+            m_bWriting    = true;
+            auto pSession = shared_from_this();
+            boost::asio::async_write( m_socket, boost::asio::buffer( m_responses.begin()->second ),
+                                      [ pSession ]( boost::system::error_code ec, std::size_t )
+                                      {
+                                          if( !ec )
+                                          {
+                                              pSession->m_responses.erase( pSession->m_responses.begin() );
+                                              ++pSession->m_nextResponse;
+                                              pSession->m_bWriting = false;
+                                              if( pSession->m_bReadPaused )
+                                              {
+                                                  pSession->m_bReadPaused = false;
+                                                  pSession->readHeader();
+                                              }
+                                              pSession->writeResponse();
+                                          }
+                                      } );
+        }
+    };
+
+    Pimpl( const boost::filesystem::path& socketPath,
+           const boost::filesystem::path& stashDirectory,
+           Stash::RestoreMode             restoreMode,
+           Stash::Compression             compression )
+        : m_socketPath( socketPath )
+        , m_stash( stashDirectory, restoreMode, compression )
+        , m_acceptor( m_ioContext )
+        , m_workers( std::max( 1U, std::thread::hardware_concurrency() ) )
+    {
+        // a stale socket from a previous daemon prevents binding
+        boost::filesystem::remove( m_socketPath );
+        boost::filesystem::ensureFoldersExist( m_socketPath );
+
+        const boost::asio::local::stream_protocol::endpoint endpoint( m_socketPath.string() );
+        m_acceptor.open( endpoint.protocol() );
+        m_acceptor.bind( endpoint );
+        // nothing can connect before listen so no other user ever sees the socket open
+        boost::filesystem::permissions( m_socketPath, boost::filesystem::owner_read | boost::filesystem::owner_write );
+        m_acceptor.listen();
+
+        accept();
+        m_ioThread = std::thread( [ this ]() { m_ioContext.run(); } );
+    }
+
+    ~Pimpl() { stop(); }
+
+    void accept()
+    {
+        m_acceptor.async_accept(
+            [ this ]( boost::system::error_code ec, Socket socket )
+            {
+                if( !ec )
+                {
+                    if( isDaemonUser( socket ) )
+                    {
+                        std::make_shared< Session >( *this, std::move( socket ) )->readHeader();
+                    }
+                    accept();
+                }
+            } );
+    }
+
+    void stop()
+    {
+        if( m_bStopped )
+        {
+            return;
+        }
+        m_bStopped = true;
+        m_ioContext.stop();
+        m_ioThread.join();
+        // responses from work still in progress are dropped with the stopped io context
+        m_workers.join();
+        boost::system::error_code ec;
+        boost::filesystem::remove( m_socketPath, ec );
+    }
+};
+
+StashDaemon::StashDaemon( const boost::filesystem::path& socketPath,
+                          const boost::filesystem::path& stashDirectory,
+                          Stash::RestoreMode             restoreMode,
+                          Stash::Compression             compression )
+    : m_pPimpl( std::make_unique< Pimpl >( socketPath, stashDirectory, restoreMode, compression ) )
+{
+}
+
+StashDaemon::~StashDaemon() = default;
+
+Stash& StashDaemon::getStash()
+{
+    return m_pPimpl->m_stash;
+}
+
+void StashDaemon::stop()
+{
+    m_pPimpl->stop();
+}
+
+#else
+
+struct StashDaemonClient::Pimpl
+{
+};
+
+StashDaemonClient::StashDaemonClient( const boost::filesystem::path& )
+{
+    THROW_RTE( "The stash daemon requires UNIX domain sockets" );
+}
+
+StashDaemonClient::~StashDaemonClient() = default;
+
+std::vector< bool > StashDaemonClient::has( const StashKeys& )
+{
+    THROW_RTE( "The stash daemon requires UNIX domain sockets" );
+}
+
+void StashDaemonClient::put( const StashKeys& )
+{
+    THROW_RTE( "The stash daemon requires UNIX domain sockets" );
+}
+
+std::vector< bool > StashDaemonClient::get( const StashKeys& )
+{
+    THROW_RTE( "The stash daemon requires UNIX domain sockets" );
+}
+
+void StashDaemonClient::clear()
+{
+    THROW_RTE( "The stash daemon requires UNIX domain sockets" );
+}
+
+struct StashDaemon::Pimpl
+{
+};
+
+StashDaemon::StashDaemon( const boost::filesystem::path&,
+                          const boost::filesystem::path&,
+                          Stash::RestoreMode,
+                          Stash::Compression )
+{
+    THROW_RTE( "The stash daemon requires UNIX domain sockets" );
+}
+
+StashDaemon::~StashDaemon() = default;
+
+Stash& StashDaemon::getStash()
+{
+    THROW_RTE( "The stash daemon requires UNIX domain sockets" );
+}
+
+void StashDaemon::stop()
+{
+}
+
+#endif
+
+} // namespace task
@@ -0,0 +1,906 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#include "stash_manifest.hpp"
+#include "record_file.hpp"
+
+#include "common/file.hpp"
+#include "common/assert_verify.hpp"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+
+#ifdef _WIN32
+#include <boost/interprocess/sync/file_lock.hpp>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+namespace task
+{
+namespace
+{
+static constexpr char        MANIFEST_MAGIC[ 8 ]      = { 'E', 'D', 'S', 'S', 'T', 'A', 'S', 'H' };
+static constexpr char        JOURNAL_MAGIC[ 8 ]       = { 'E', 'D', 'S', 'S', 'J', 'R', 'N', 'L' };
+static constexpr char        CONTROL_MAGIC[ 8 ]       = { 'E', 'D', 'S', 'S', 'C', 'T', 'R', 'L' };
+static constexpr std::size_t COMPACT_MINIMUM          = 1024U;
+static constexpr std::size_t COMPACT_JOURNAL_FRACTION = 8U;
+
+struct JournalHeader
+{
+    char          m_magic[ 8 ];
+    std::uint32_t m_version;
+    std::uint32_t m_recordSize;
+};
+
+static_assert( sizeof( StashManifest::Header ) == 64U, "Unexpected stash manifest header size" );
+static_assert( sizeof( StashManifest::Record ) == 64U, "Unexpected stash manifest record size" );
+static_assert( sizeof( JournalHeader ) == 16U, "Unexpected stash journal header size" );
+
+inline std::uint32_t checkRecord( const StashManifest::Record& record, const std::string& strPath )
+{
+    StashManifest::Record unchecked = record;
+    unchecked.m_check               = 0U;
+    common::ContentHash contentHash;
+    contentHash.update( &unchecked, sizeof( unchecked ) );
+    contentHash.update( strPath.data(), strPath.size() );
+    return static_cast< std::uint32_t >( contentHash.digest().m_low );
+}
+
+using SearchKey = std::tuple< std::uint64_t, std::uint64_t, std::uint64_t >;
+
+inline SearchKey recordKey( const StashManifest::Record& record )
+{
+    return SearchKey{ record.m_pathHash, record.m_determinantHigh, record.m_determinantLow };
+}
+
+inline StashManifest::Value getValue( const StashManifest::Record& record )
+{
+    return StashManifest::Value{ common::HashCode128{ record.m_objectLow, record.m_objectHigh },
+                                 static_cast< std::time_t >( record.m_fileTime ) };
+}
+
+// erased entries are journaled with a null object digest
+inline bool isTombstone( const StashManifest::Value& value )
+{
+    return value.m_object == common::HashCode128{};
+}
+
+inline bool keyLess( const StashManifest::Record& record, const SearchKey& key )
+{
+    return recordKey( record ) < key;
+}
+} // namespace
+
+// append only journal file written with unbuffered writes so that sync covers every record
+struct StashManifest::Journal
+{
+    const boost::filesystem::path m_journalFile;
+    int                           m_iFile = -1;
+
+    Journal( const boost::filesystem::path& journalFile )
+        : m_journalFile( journalFile )
+    {
+#ifdef _WIN32
+        m_iFile = ::_open( journalFile.string().c_str(), _O_RDWR | _O_CREAT | _O_APPEND | _O_BINARY,
+                           _S_IREAD | _S_IWRITE );
+#else
+        m_iFile = ::open( journalFile.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666 );
+#endif
+        VERIFY_RTE_MSG( m_iFile >= 0, "Failed to open stash journal: " << journalFile.string() );
+    }
+
+    ~Journal()
+    {
+#ifdef _WIN32
+        ::_close( m_iFile );
+#else
+        ::close( m_iFile );
+#endif
+    }
+
+    void append( const char* pData, std::size_t szSize )
+    {
+        while( szSize != 0U )
+        {
+#ifdef _WIN32
+            const int iWritten = ::_write( m_iFile, pData, static_cast< unsigned int >( szSize ) );
+#else
+            const ssize_t iWritten = ::write( m_iFile, pData, szSize );
+#endif
+            VERIFY_RTE_MSG( iWritten > 0, "Failed to write stash journal: " << m_journalFile.string() );
+            pData += iWritten;
+            szSize -= static_cast< std::size_t >( iWritten );
+        }
+    }
+
+    void sync()
+    {
+#ifdef _WIN32
+        const int iResult = ::_commit( m_iFile );
+#elif defined( __APPLE__ )
+        const int iResult = ::fsync( m_iFile );
+#else
+        const int iResult = ::fdatasync( m_iFile );
+#endif
+        VERIFY_RTE_MSG( iResult == 0, "Failed to sync stash journal: " << m_journalFile.string() );
+    }
+
+    std::uint64_t size() const
+    {
+#ifdef _WIN32
+        const __int64 iSize = ::_filelengthi64( m_iFile );
+#else
+        const off_t iSize = ::lseek( m_iFile, 0, SEEK_END );
+#endif
+        VERIFY_RTE_MSG( iSize >= 0, "Failed to size stash journal: " << m_journalFile.string() );
+        return static_cast< std::uint64_t >( iSize );
+    }
+
+    void truncate( std::size_t szSize )
+    {
+#ifdef _WIN32
+        const int iResult = ::_chsize_s( m_iFile, static_cast< __int64 >( szSize ) );
+#else
+        const int iResult = ::ftruncate( m_iFile, static_cast< off_t >( szSize ) );
+#endif
+        VERIFY_RTE_MSG( iResult == 0, "Failed to truncate stash journal: " << m_journalFile.string() );
+        sync();
+    }
+
+    void reset()
+    {
+        truncate( 0U );
+        JournalHeader header;
+        std::memcpy( header.m_magic, JOURNAL_MAGIC, sizeof( JOURNAL_MAGIC ) );
+        header.m_version    = VERSION;
+        header.m_recordSize = sizeof( Record );
+        append( reinterpret_cast< const char* >( &header ), sizeof( JournalHeader ) );
+        sync();
+    }
+};
+
+std::size_t StashManifest::parseJournal( const std::string& strJournal, std::uint64_t szStart, Appended& appended )
+{
+    // strJournal holds the journal from szStart - returns the length of its valid prefix
+    std::size_t szValid = 0U;
+    if( szStart == 0U )
+    {
+        JournalHeader header;
+        if( strJournal.size() < sizeof( JournalHeader ) )
+        {
+            return 0U;
+        }
+        std::memcpy( &header, strJournal.data(), sizeof( JournalHeader ) );
+        if( std::memcmp( header.m_magic, JOURNAL_MAGIC, sizeof( JOURNAL_MAGIC ) ) != 0 || header.m_version != VERSION
+            || header.m_recordSize != sizeof( Record ) )
+        {
+            return 0U;
+        }
+        szValid = sizeof( JournalHeader );
+    }
+
+    // stop at a torn final record
+    while( szValid + sizeof( Record ) <= strJournal.size() )
+    {
+        Record record;
+        std::memcpy( &record, strJournal.data() + szValid, sizeof( Record ) );
+        if( szValid + sizeof( Record ) + common::padded( record.m_pathLength ) > strJournal.size() )
+        {
+            break;
+        }
+        std::string strPath( strJournal.data() + szValid + sizeof( Record ), record.m_pathLength );
+        if( checkRecord( record, strPath ) != record.m_check )
+        {
+            break;
+        }
+        appended[ Key{ record.m_pathHash, record.m_determinantHigh, record.m_determinantLow, std::move( strPath ) } ]
+            = getValue( record );
+        szValid += sizeof( Record ) + common::padded( record.m_pathLength );
+    }
+    return szValid;
+}
+
+// control file shared by every process using the manifest
+struct StashManifest::Control
+{
+    char                         m_magic[ 8 ];
+    std::uint32_t                m_version;
+    std::uint32_t                m_reserved;
+    std::atomic< std::uint64_t > m_epoch;
+    std::atomic< std::uint64_t > m_journalSize;
+};
+
+static_assert( std::atomic< std::uint64_t >::is_always_lock_free, "Stash control requires lock free atomics" );
+
+// exclusive lock on the lock file held per open file rather than per process so that
+// two manifests opened on the same directory within one process also exclude each other
+struct StashManifest::FileLock
+{
+#ifdef _WIN32
+    boost::interprocess::file_lock m_fileLock;
+
+    FileLock( const boost::filesystem::path& lockFile )
+        : m_fileLock( lockFile.string().c_str() )
+    {
+    }
+    void lock() { m_fileLock.lock(); }
+    void unlock() { m_fileLock.unlock(); }
+#else
+    const boost::filesystem::path m_lockFile;
+    int                           m_iFile = -1;
+
+    FileLock( const boost::filesystem::path& lockFile )
+        : m_lockFile( lockFile )
+        , m_iFile( ::open( lockFile.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666 ) )
+    {
+        VERIFY_RTE_MSG( m_iFile >= 0, "Failed to open stash lock file: " << lockFile.string() );
+    }
+    ~FileLock() { ::close( m_iFile ); }
+    void lock()
+    {
+        int iResult;
+        while( ( iResult = ::flock( m_iFile, LOCK_EX ) ) != 0 && errno == EINTR )
+        {
+        }
+        VERIFY_RTE_MSG( iResult == 0, "Failed to lock stash: " << m_lockFile.string() );
+    }
+    void unlock() { ::flock( m_iFile, LOCK_UN ); }
+#endif
+};
+
+// serialises writers within the manifest and then with every other manifest on the directory
+// NOTE: the file lock is shared by the threads of a manifest so the mutex must be taken first
+class StashManifest::WriterLock
+{
+public:
+    WriterLock( StashManifest& manifest )
+        : m_manifest( manifest )
+        , m_lock( manifest.m_writerMutex )
+    {
+        m_manifest.m_pFileLock->lock();
+    }
+    ~WriterLock() { m_manifest.m_pFileLock->unlock(); }
+
+private:
+    StashManifest&                 m_manifest;
+    std::unique_lock< std::mutex > m_lock;
+};
+
+StashManifest::StashManifest( const boost::filesystem::path& manifestFile )
+    : m_manifestFile( manifestFile )
+    , m_journalFile( manifestFile.string() + ".journal" )
+    , m_controlFile( manifestFile.string() + ".control" )
+    , m_lockFile( manifestFile.string() + ".lock" )
+{
+    open();
+}
+
+StashManifest::~StashManifest() = default;
+
+StashManifest::Key StashManifest::makeKey( const boost::filesystem::path& file, const common::HashCode128& determinant )
+{
+    const std::string strPath = file.string();
+    return Key{ common::ContentHash::hash( strPath.data(), strPath.size() ).m_low, determinant.m_high, determinant.m_low,
+                strPath };
+}
+
+const StashManifest::Record* StashManifest::beginRecords() const
+{
+    return reinterpret_cast< const Record* >( m_mapping.data() + sizeof( Header ) );
+}
+
+const StashManifest::Record* StashManifest::endRecords() const
+{
+    return beginRecords() + m_recordCount;
+}
+
+std::string StashManifest::getPath( const Record& record ) const
+{
+    return std::string( m_mapping.data() + m_stringsOffset + record.m_pathOffset, record.m_pathLength );
+}
+
+void StashManifest::open()
+{
+    boost::filesystem::ensureFoldersExist( m_manifestFile );
+
+    // the lock and control files are created once and never removed
+    for( const boost::filesystem::path& file : { m_lockFile, m_controlFile } )
+    {
+        if( !boost::filesystem::exists( file ) )
+        {
+            boost::filesystem::ofstream( file, std::ios_base::out | std::ios_base::app | std::ios_base::binary );
+        }
+    }
+    m_pFileLock = std::make_unique< FileLock >( m_lockFile );
+
+    {
+        WriterLock writerLock( *this );
+
+        if( boost::filesystem::file_size( m_controlFile ) != sizeof( Control ) )
+        {
+            boost::filesystem::resize_file( m_controlFile, 0U );
+            boost::filesystem::resize_file( m_controlFile, sizeof( Control ) );
+        }
+        {
+            boost::interprocess::file_mapping controlMapping(
+                m_controlFile.string().c_str(), boost::interprocess::read_write );
+            m_controlRegion = boost::interprocess::mapped_region( controlMapping, boost::interprocess::read_write );
+            m_pControl      = reinterpret_cast< Control* >( m_controlRegion.get_address() );
+        }
+
+        bool bRecover = false;
+        if( std::memcmp( m_pControl->m_magic, CONTROL_MAGIC, sizeof( CONTROL_MAGIC ) ) != 0
+            || m_pControl->m_version != VERSION )
+        {
+            // new or from an older version - written zeroed above
+            m_pControl->m_epoch.store( 0U );
+            m_pControl->m_journalSize.store( 0U );
+            m_pControl->m_version  = VERSION;
+            m_pControl->m_reserved = 0U;
+            std::memcpy( m_pControl->m_magic, CONTROL_MAGIC, sizeof( CONTROL_MAGIC ) );
+            bRecover = true;
+        }
+
+        try
+        {
+            load();
+        }
+        catch( std::exception& )
+        {
+            // the stash is a cache - an unreadable or older manifest is discarded along with its journal
+            if( m_mapping.is_open() )
+            {
+                m_mapping.close();
+            }
+            boost::filesystem::remove( m_journalFile );
+            write( m_manifestFile, Appended{} );
+            bRecover = true;
+        }
+
+        m_pJournal = std::make_unique< Journal >( m_journalFile );
+
+        // an odd epoch means a writer died part way through compaction
+        if( bRecover || ( m_pControl->m_epoch.load() & 1U ) )
+        {
+            recover();
+        }
+    }
+
+    refresh();
+}
+
+void StashManifest::recover()
+{
+    // NOTE: requires the writer lock
+    std::string strJournal;
+    boost::filesystem::loadBinaryFile( m_journalFile, strJournal );
+
+    Appended          discard;
+    const std::size_t szValid = parseJournal( strJournal, 0U, discard );
+    if( szValid == 0U )
+    {
+        m_pJournal->reset();
+    }
+    else if( szValid != strJournal.size() )
+    {
+        m_pJournal->truncate( szValid );
+    }
+
+    // move to a new even epoch so every reader reloads
+    m_pControl->m_journalSize.store( szValid == 0U ? sizeof( JournalHeader ) : szValid );
+    m_pControl->m_epoch.store( ( m_pControl->m_epoch.load() | 1U ) + 1U );
+}
+
+void StashManifest::load() const
+{
+    if( m_mapping.is_open() )
+    {
+        m_mapping.close();
+    }
+    m_mapping.open( m_manifestFile );
+
+    const std::size_t szFileSize = m_mapping.size();
+    VERIFY_RTE_MSG( szFileSize >= sizeof( Header ), "Invalid stash manifest: " << m_manifestFile.string() );
+
+    Header header;
+    std::memcpy( &header, m_mapping.data(), sizeof( Header ) );
+    VERIFY_RTE_MSG( std::memcmp( header.m_magic, MANIFEST_MAGIC, sizeof( MANIFEST_MAGIC ) ) == 0,
+                    "Invalid stash manifest: " << m_manifestFile.string() );
+    VERIFY_RTE_MSG( header.m_version == VERSION && header.m_recordSize == sizeof( Record ),
+                    "Unsupported stash manifest version: " << header.m_version );
+    VERIFY_RTE_MSG( sizeof( Header ) + header.m_recordCount * sizeof( Record ) <= header.m_stringsOffset
+                        && header.m_stringsOffset + header.m_stringsSize <= szFileSize,
+                    "Invalid stash manifest: " << m_manifestFile.string() );
+
+    m_recordCount   = header.m_recordCount;
+    m_stringsOffset = header.m_stringsOffset;
+}
+
+void StashManifest::refresh() const
+{
+    {
+        std::shared_lock< std::shared_mutex > lock( m_mutex );
+        if( m_pControl->m_epoch.load() == m_epoch && m_pControl->m_journalSize.load() == m_journalOffset )
+        {
+            return;
+        }
+    }
+
+    for( ;; )
+    {
+        {
+            std::unique_lock< std::shared_mutex > lock( m_mutex );
+            if( catchUp() )
+            {
+                return;
+            }
+        }
+        // another process is compacting - wait for it without holding the mapping lock
+        WriterLock writerLock( const_cast< StashManifest& >( *this ) );
+        if( m_pControl->m_epoch.load() & 1U )
+        {
+            const_cast< StashManifest* >( this )->recover();
+        }
+    }
+}
+
+bool StashManifest::catchUp() const
+{
+    // NOTE: requires m_mutex exclusively
+    for( ;; )
+    {
+        const std::uint64_t epoch = m_pControl->m_epoch.load();
+        if( epoch & 1U )
+        {
+            return false;
+        }
+
+        // a new epoch means a new manifest and journal - otherwise only read what was appended since
+        const bool    bReload  = epoch != m_epoch;
+        std::uint64_t szOffset = bReload ? 0U : m_journalOffset;
+        if( bReload )
+        {
+            load();
+        }
+
+        Appended            appended;
+        const std::uint64_t szJournalSize = m_pControl->m_journalSize.load();
+        if( szJournalSize > szOffset )
+        {
+            std::string strJournal( szJournalSize - szOffset, '\0' );
+            {
+                boost::filesystem::ifstream journalStream( m_journalFile, std::ios_base::in | std::ios_base::binary );
+                journalStream.seekg( szOffset );
+                journalStream.read( strJournal.data(), strJournal.size() );
+                strJournal.resize( journalStream.gcount() );
+            }
+            parseJournal( strJournal, szOffset, appended );
+        }
+
+        // seqlock - retry if a compaction started while reading
+        if( m_pControl->m_epoch.load() != epoch )
+        {
+            m_epoch = ~std::uint64_t( 0U );
+            continue;
+        }
+
+        if( bReload )
+        {
+            m_appended.swap( appended );
+        }
+        else
+        {
+            for( auto& [ key, value ] : appended )
+            {
+                m_appended[ key ] = value;
+            }
+        }
+        m_epoch         = epoch;
+        m_journalOffset = szJournalSize;
+        return true;
+    }
+}
+
+void StashManifest::write( const boost::filesystem::path& targetFile, const Appended& entries ) const
+{
+    // intern the path strings
+    std::map< std::string, std::uint64_t > strings;
+    std::uint64_t                          szStringsSize = 0U;
+    for( const auto& [ key, value ] : entries )
+    {
+        auto ib = strings.insert( std::make_pair( std::get< 3 >( key ), szStringsSize ) );
+        if( ib.second )
+        {
+            szStringsSize += std::get< 3 >( key ).size();
+        }
+    }
+
+    Header header;
+    std::memset( &header, 0, sizeof( Header ) );
+    std::memcpy( header.m_magic, MANIFEST_MAGIC, sizeof( MANIFEST_MAGIC ) );
+    header.m_version       = VERSION;
+    header.m_recordSize    = sizeof( Record );
+    header.m_recordCount   = entries.size();
+    header.m_stringsOffset = sizeof( Header ) + entries.size() * sizeof( Record );
+    header.m_stringsSize   = szStringsSize;
+
+    {
+        std::unique_ptr< boost::filesystem::ofstream > pFileStream
+            = boost::filesystem::createBinaryOutputFileStream( targetFile );
+        pFileStream->write( reinterpret_cast< const char* >( &header ), sizeof( Header ) );
+
+        // the map order is the on disk sort order
+        for( const auto& [ key, value ] : entries )
+        {
+            Record record;
+            record.m_pathHash        = std::get< 0 >( key );
+            record.m_determinantHigh = std::get< 1 >( key );
+            record.m_determinantLow  = std::get< 2 >( key );
+            record.m_pathOffset      = strings[ std::get< 3 >( key ) ];
+            record.m_pathLength      = static_cast< std::uint32_t >( std::get< 3 >( key ).size() );
+            record.m_check           = 0U;
+            record.m_objectLow       = value.m_object.m_low;
+            record.m_objectHigh      = value.m_object.m_high;
+            record.m_fileTime        = static_cast< std::int64_t >( value.m_fileTime );
+            pFileStream->write( reinterpret_cast< const char* >( &record ), sizeof( Record ) );
+        }
+
+        std::vector< const std::string* > ordered( strings.size() );
+        {
+            std::vector< std::pair< std::uint64_t, const std::string* > > byOffset;
+            for( const auto& [ strPath, szOffset ] : strings )
+            {
+                byOffset.push_back( std::make_pair( szOffset, &strPath ) );
+            }
+            std::sort( byOffset.begin(), byOffset.end() );
+            std::transform(
+                byOffset.begin(), byOffset.end(), ordered.begin(), []( const auto& p ) { return p.second; } );
+        }
+        for( const std::string* pString : ordered )
+        {
+            pFileStream->write( pString->data(), pString->size() );
+        }
+
+        static const char padding[ 8 ] = { 0 };
+        pFileStream->write( padding, common::padded( szStringsSize ) - szStringsSize );
+
+        VERIFY_RTE_MSG( pFileStream->good(), "Failed to write stash manifest: " << targetFile.string() );
+    }
+    boost::filesystem::syncFile( targetFile );
+}
+
+std::optional< StashManifest::Value > StashManifest::find( const boost::filesystem::path& file,
+                                                           const common::HashCode128&     determinant ) const
+{
+    const Key key = makeKey( file, determinant );
+
+    refresh();
+    std::shared_lock< std::shared_mutex > lock( m_mutex );
+    {
+        Appended::const_iterator iFind = m_appended.find( key );
+        if( iFind != m_appended.end() )
+        {
+            return isTombstone( iFind->second ) ? std::optional< Value >() : iFind->second;
+        }
+    }
+
+    const SearchKey searchKey{ std::get< 0 >( key ), std::get< 1 >( key ), std::get< 2 >( key ) };
+    for( const Record* p = std::lower_bound( beginRecords(), endRecords(), searchKey, keyLess ), *pEnd = endRecords();
+         p != pEnd && recordKey( *p ) == searchKey;
+         ++p )
+    {
+        if( getPath( *p ) == std::get< 3 >( key ) )
+        {
+            return getValue( *p );
+        }
+    }
+
+    return std::optional< Value >();
+}
+
+void StashManifest::insert( const boost::filesystem::path& file,
+                            const common::HashCode128&     determinant,
+                            const Value&                   value )
+{
+    VERIFY_RTE_MSG( !isTombstone( value ), "Invalid stash object for: " << file.string() );
+
+    std::unique_lock< std::mutex > lock( m_commitMutex );
+    if( m_pJournalError )
+    {
+        std::rethrow_exception( m_pJournalError );
+    }
+    queue( makeKey( file, determinant ), value );
+    commit( lock, m_queuedSequence );
+}
+
+void StashManifest::exclusive( const std::function< void() >& functor )
+{
+    WriterLock lock( *this );
+    functor();
+}
+
+void StashManifest::eraseObjects( const std::set< common::HashCode128 >& objects )
+{
+    if( objects.empty() )
+    {
+        return;
+    }
+
+    // find the live entries referring to the objects without blocking lookups
+    refresh();
+    std::vector< Key > keys;
+    {
+        std::shared_lock< std::shared_mutex > lock( m_mutex );
+        for( const Record* p = beginRecords(), *pEnd = endRecords(); p != pEnd; ++p )
+        {
+            if( objects.count( getValue( *p ).m_object ) )
+            {
+                Key key{ p->m_pathHash, p->m_determinantHigh, p->m_determinantLow, getPath( *p ) };
+                if( !m_appended.count( key ) )
+                {
+                    keys.emplace_back( std::move( key ) );
+                }
+            }
+        }
+        for( const auto& [ key, value ] : m_appended )
+        {
+            if( objects.count( value.m_object ) )
+            {
+                keys.push_back( key );
+            }
+        }
+    }
+    if( keys.empty() )
+    {
+        return;
+    }
+
+    std::unique_lock< std::mutex > lock( m_commitMutex );
+    if( m_pJournalError )
+    {
+        std::rethrow_exception( m_pJournalError );
+    }
+    for( const Key& key : keys )
+    {
+        queue( key, Value{} );
+    }
+    commit( lock, m_queuedSequence );
+}
+
+void StashManifest::queue( const Key& key, const Value& value )
+{
+    Record record;
+    record.m_pathHash        = std::get< 0 >( key );
+    record.m_determinantHigh = std::get< 1 >( key );
+    record.m_determinantLow  = std::get< 2 >( key );
+    record.m_pathOffset      = 0U;
+    record.m_pathLength      = static_cast< std::uint32_t >( std::get< 3 >( key ).size() );
+    record.m_check           = 0U;
+    record.m_objectLow       = value.m_object.m_low;
+    record.m_objectHigh      = value.m_object.m_high;
+    record.m_fileTime        = static_cast< std::int64_t >( value.m_fileTime );
+    record.m_check           = checkRecord( record, std::get< 3 >( key ) );
+
+    static const char padding[ 8 ] = { 0 };
+    m_pendingRecords.append( reinterpret_cast< const char* >( &record ), sizeof( Record ) );
+    m_pendingRecords.append( std::get< 3 >( key ) );
+    m_pendingRecords.append( padding, common::padded( record.m_pathLength ) - record.m_pathLength );
+    m_pendingEntries.emplace_back( key, value );
+    ++m_queuedSequence;
+}
+
+void StashManifest::commit( std::unique_lock< std::mutex >& lock, std::uint64_t sequence )
+{
+    while( m_committedSequence < sequence )
+    {
+        if( m_pJournalError )
+        {
+            std::rethrow_exception( m_pJournalError );
+        }
+        if( m_bCommitting )
+        {
+            m_commitCondition.wait( lock );
+            continue;
+        }
+
+        // lead the commit of every record queued so far
+        m_bCommitting = true;
+        std::string records;
+        records.swap( m_pendingRecords );
+        std::vector< std::pair< Key, Value > > entries;
+        entries.swap( m_pendingEntries );
+        const std::uint64_t batchSequence = m_queuedSequence;
+        lock.unlock();
+
+        try
+        {
+            WriterLock writerLock( *this );
+            if( m_pControl->m_epoch.load() & 1U )
+            {
+                recover();
+            }
+
+            bool bFold = false;
+            {
+                std::unique_lock< std::shared_mutex > writeLock( m_mutex );
+                VERIFY_RTE( catchUp() );
+
+                // discard any torn tail left by a writer which died while appending
+                const std::uint64_t szJournalSize = m_pControl->m_journalSize.load();
+                if( m_pJournal->size() != szJournalSize )
+                {
+                    m_pJournal->truncate( szJournalSize );
+                }
+                m_pJournal->append( records.data(), records.size() );
+                m_pJournal->sync();
+
+                for( auto& [ key, value ] : entries )
+                {
+                    m_appended[ std::move( key ) ] = value;
+                }
+                m_journalOffset = szJournalSize + records.size();
+                m_pControl->m_journalSize.store( m_journalOffset );
+
+                // keep the journal small relative to the manifest so opening stays cheap
+                bFold = m_appended.size()
+                        > std::max< std::size_t >( COMPACT_MINIMUM, m_recordCount / COMPACT_JOURNAL_FRACTION );
+            }
+            if( bFold )
+            {
+                foldJournal();
+            }
+        }
+        catch( ... )
+        {
+            // the journal can no longer be trusted to be appended to
+            lock.lock();
+            m_pJournalError = std::current_exception();
+            m_bCommitting   = false;
+            m_commitCondition.notify_all();
+            throw;
+        }
+
+        lock.lock();
+        m_committedSequence = batchSequence;
+        m_bCommitting       = false;
+        m_commitCondition.notify_all();
+    }
+}
+
+void StashManifest::foldJournal()
+{
+    // NOTE: requires commit leadership and the writer lock with the mapping up to date
+    Appended entries;
+    {
+        std::shared_lock< std::shared_mutex > lock( m_mutex );
+        for( const Record* p = beginRecords(), *pEnd = endRecords(); p != pEnd; ++p )
+        {
+            entries.insert( std::make_pair(
+                Key{ p->m_pathHash, p->m_determinantHigh, p->m_determinantLow, getPath( *p ) }, getValue( *p ) ) );
+        }
+        for( const auto& [ key, value ] : m_appended )
+        {
+            if( isTombstone( value ) )
+            {
+                entries.erase( key );
+            }
+            else
+            {
+                entries[ key ] = value;
+            }
+        }
+    }
+
+    // write aside and rename so the manifest is never observed half written
+    const boost::filesystem::path tempFile = common::getTemporaryFile( m_manifestFile );
+    write( tempFile, entries );
+
+    std::unique_lock< std::shared_mutex > lock( m_mutex );
+
+    // odd epoch while the manifest and journal are inconsistent with the control file
+    m_pControl->m_epoch.fetch_add( 1U );
+    m_mapping.close();
+    try
+    {
+        boost::filesystem::rename( tempFile, m_manifestFile );
+    }
+    catch( ... )
+    {
+        m_pControl->m_epoch.fetch_add( 1U );
+        load();
+        throw;
+    }
+    if( m_manifestFile.has_parent_path() )
+    {
+        boost::filesystem::syncFile( m_manifestFile.parent_path() );
+    }
+
+    // the journal is only discarded once the new manifest is durable
+    m_pJournal->reset();
+    m_pControl->m_journalSize.store( sizeof( JournalHeader ) );
+    m_epoch = m_pControl->m_epoch.fetch_add( 1U ) + 1U;
+
+    load();
+    m_appended.clear();
+    m_journalOffset = sizeof( JournalHeader );
+}
+
+void StashManifest::compact()
+{
+    std::unique_lock< std::mutex > lock( m_commitMutex );
+    m_commitCondition.wait( lock, [ this ]() { return !m_bCommitting; } );
+    if( m_pJournalError )
+    {
+        std::rethrow_exception( m_pJournalError );
+    }
+    m_bCommitting = true;
+    lock.unlock();
+
+    std::exception_ptr pError;
+    try
+    {
+        WriterLock writerLock( *this );
+        if( m_pControl->m_epoch.load() & 1U )
+        {
+            recover();
+        }
+        {
+            std::unique_lock< std::shared_mutex > writeLock( m_mutex );
+            VERIFY_RTE( catchUp() );
+        }
+        foldJournal();
+    }
+    catch( ... )
+    {
+        pError = std::current_exception();
+    }
+
+    lock.lock();
+    m_pJournalError = pError;
+    m_bCommitting   = false;
+    m_commitCondition.notify_all();
+    if( pError )
+    {
+        std::rethrow_exception( pError );
+    }
+}
+
+std::size_t StashManifest::size() const
+{
+    refresh();
+    std::shared_lock< std::shared_mutex > lock( m_mutex );
+    return m_recordCount + m_appended.size();
+}
+
+} // namespace task
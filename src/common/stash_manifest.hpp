@@ -0,0 +1,202 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#ifndef GUARD_2024_April_08_stash_manifest
+#define GUARD_2024_April_08_stash_manifest
+
+#include "common/content_hash.hpp"
+
+#include "boost/filesystem/path.hpp"
+#include "boost/iostreams/device/mapped_file.hpp"
+#include "boost/interprocess/mapped_region.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace task
+{
+
+// StashManifest
+//
+// Versioned binary stash manifest.  The manifest file is
+//
+//     Header
+//     Record[ Header::m_recordCount ]  - sorted by ( path hash, determinant, path )
+//     String table                     - interned path strings referenced by the records
+//
+// The sorted region is memory mapped on open and searched in place so lookups never
+// deserialise it.  Updates are written to a separate append only journal, each
+// Record followed by its path padded to 8 bytes, and held in a small in memory map
+// which takes precedence over the sorted region.
+//
+// Concurrent inserts are group committed - the first inserting thread becomes the
+// leader and writes and syncs every record queued so far in one write while the
+// others wait for it.  An insert only returns, and its entry only becomes visible to
+// find, once its record is durable.  Once the journal exceeds an eighth of the sorted
+// records it is folded into a new manifest file which replaces the old one by rename
+// before the journal is truncated.  Replaying a journal over a manifest which already
+// contains its records is harmless so a crash at any point leaves a consistent stash.
+//
+// Each entry maps ( file, determinant ) to the content digest of the stashed object.
+// Erased entries are journaled as tombstones with a null digest which are dropped on
+// compaction.
+//
+// The manifest may be shared by several processes.  Writers - the commit leader and
+// compaction - serialise on an exclusive lock of the lock file.  Readers never take the file lock.  Instead
+// a small memory mapped control file holds an epoch, incremented around every
+// compaction so that it is odd while one is in progress, and the committed journal
+// length.  Lookups compare these with what the process has loaded and only remap
+// the manifest or read the new journal records when they have changed, using the
+// epoch as a seqlock to detect a compaction racing with the read.  A writer which
+// finds the epoch odd knows the previous writer died part way through compaction
+// and recovers the control file from the journal.
+//
+// The manifest is thread safe.
+class StashManifest
+{
+public:
+    static constexpr std::uint32_t VERSION = 3U;
+
+    struct Value
+    {
+        common::HashCode128 m_object;
+        std::time_t         m_fileTime = 0;
+    };
+
+    StashManifest( const boost::filesystem::path& manifestFile );
+    ~StashManifest();
+
+    StashManifest( const StashManifest& )            = delete;
+    StashManifest& operator=( const StashManifest& ) = delete;
+
+    std::optional< Value > find( const boost::filesystem::path& file, const common::HashCode128& determinant ) const;
+    void                   insert( const boost::filesystem::path& file,
+                                   const common::HashCode128&     determinant,
+                                   const Value&                   value );
+
+    // erase every entry referring to one of the objects
+    void eraseObjects( const std::set< common::HashCode128 >& objects );
+
+    // call functor holding the lock which serialises the writers of every process
+    // sharing the stash directory
+    void exclusive( const std::function< void() >& functor );
+
+    // upper bound on the number of entries
+    std::size_t size() const;
+
+    void compact();
+
+    struct Header
+    {
+        char          m_magic[ 8 ];
+        std::uint32_t m_version;
+        std::uint32_t m_recordSize;
+        std::uint64_t m_recordCount;
+        std::uint64_t m_stringsOffset;
+        std::uint64_t m_stringsSize;
+        std::uint64_t m_reserved[ 3 ];
+    };
+
+    struct Record
+    {
+        std::uint64_t m_pathHash;
+        std::uint64_t m_determinantLow;
+        std::uint64_t m_determinantHigh;
+        std::uint64_t m_pathOffset;
+        std::uint32_t m_pathLength;
+        std::uint32_t m_check;
+        std::uint64_t m_objectLow;
+        std::uint64_t m_objectHigh;
+        std::int64_t  m_fileTime;
+    };
+
+private:
+    using Key      = std::tuple< std::uint64_t, std::uint64_t, std::uint64_t, std::string >;
+    using Appended = std::map< Key, Value >;
+
+    static Key         makeKey( const boost::filesystem::path& file, const common::HashCode128& determinant );
+    static std::size_t parseJournal( const std::string& strJournal, std::uint64_t szStart, Appended& appended );
+
+    struct Journal;
+    struct Control;
+    struct FileLock;
+    class WriterLock;
+
+    void open();
+    void load() const;
+    void recover();
+    void refresh() const;
+    bool catchUp() const;
+    void write( const boost::filesystem::path& targetFile, const Appended& entries ) const;
+    void queue( const Key& key, const Value& value );
+    void commit( std::unique_lock< std::mutex >& lock, std::uint64_t sequence );
+    void foldJournal();
+
+    const Record* beginRecords() const;
+    const Record* endRecords() const;
+    std::string   getPath( const Record& record ) const;
+
+    const boost::filesystem::path m_manifestFile;
+    const boost::filesystem::path m_journalFile;
+    const boost::filesystem::path m_controlFile;
+    const boost::filesystem::path m_lockFile;
+
+    // shared between processes
+    boost::interprocess::mapped_region m_controlRegion;
+    Control*                           m_pControl = nullptr;
+    std::unique_ptr< FileLock >        m_pFileLock;
+    std::mutex                         m_writerMutex;
+
+    // guards the mapping and the appended entries which are brought up to date with the
+    // control file on each lookup
+    mutable std::shared_mutex                    m_mutex;
+    mutable boost::iostreams::mapped_file_source m_mapping;
+    mutable std::uint64_t                        m_recordCount   = 0U;
+    mutable std::uint64_t                        m_stringsOffset = 0U;
+    mutable Appended                             m_appended;
+    mutable std::uint64_t                        m_epoch         = ~std::uint64_t( 0U );
+    mutable std::uint64_t                        m_journalOffset = 0U;
+
+    // group commit state
+    std::mutex                             m_commitMutex;
+    std::condition_variable                m_commitCondition;
+    std::unique_ptr< Journal >             m_pJournal;
+    std::string                            m_pendingRecords;
+    std::vector< std::pair< Key, Value > > m_pendingEntries;
+    std::uint64_t                          m_queuedSequence    = 0U;
+    std::uint64_t                          m_committedSequence = 0U;
+    bool                                   m_bCommitting       = false;
+    std::exception_ptr                     m_pJournalError;
+};
+
+} // namespace task
+
+#endif // GUARD_2024_April_08_stash_manifest
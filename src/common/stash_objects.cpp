@@ -0,0 +1,431 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#include "stash_objects.hpp"
+
+#include "common/file.hpp"
+#include "common/assert_verify.hpp"
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include <cstring>
+
+namespace task
+{
+namespace
+{
+// compressed object layout - host byte order
+//
+// Header
+// zlib stream of the object contents
+static constexpr char        COMPRESSED_MAGIC[ 8 ]  = { 'E', 'D', 'S', 'S', 'Z', 'O', 'B', 'J' };
+static constexpr const char* pszCompressedExtension = ".z";
+static constexpr const char* pszTempFolder          = "tmp";
+static constexpr std::size_t BUFFER_SIZE            = 1U << 16U;
+
+// temporaries this old were orphaned by a crash rather than being written by a
+// process sharing the stash
+static constexpr std::time_t STALE_TEMP_SECONDS = 60 * 60;
+
+struct Header
+{
+    char          m_magic[ 8 ];
+    std::uint32_t m_level;
+    std::uint32_t m_reserved;
+};
+
+static_assert( sizeof( Header ) == 16U, "Unexpected compressed stash object header size" );
+
+inline void writeHeader( std::ostream& output, int level )
+{
+    Header header;
+    std::memcpy( header.m_magic, COMPRESSED_MAGIC, sizeof( COMPRESSED_MAGIC ) );
+    header.m_level    = static_cast< std::uint32_t >( level );
+    header.m_reserved = 0U;
+    output.write( reinterpret_cast< const char* >( &header ), sizeof( Header ) );
+}
+
+inline int readHeader( std::istream& input, const boost::filesystem::path& objectFile )
+{
+    Header header;
+    input.read( reinterpret_cast< char* >( &header ), sizeof( Header ) );
+    VERIFY_RTE_MSG( input.good() && std::memcmp( header.m_magic, COMPRESSED_MAGIC, sizeof( COMPRESSED_MAGIC ) ) == 0,
+                    "Corrupt stash object: " << objectFile.string() );
+    return static_cast< int >( header.m_level );
+}
+
+// copy until the end of the input returning false on any error
+inline bool copyStream( std::istream& input, std::ostream& output )
+{
+    std::vector< char > buffer( BUFFER_SIZE );
+    while( input.read( buffer.data(), buffer.size() ) || input.gcount() != 0 )
+    {
+        output.write( buffer.data(), input.gcount() );
+    }
+    return input.eof() && !input.bad() && output.good();
+}
+
+inline boost::filesystem::path makeTempFile( const boost::filesystem::path& tempDirectory )
+{
+    const boost::filesystem::path tempFile
+        = tempDirectory / boost::filesystem::unique_path( "%%%%-%%%%-%%%%-%%%%.tmp" );
+    boost::filesystem::ensureFoldersExist( tempFile );
+    return tempFile;
+}
+
+inline void removeStaleTempFiles( const boost::filesystem::path& tempDirectory )
+{
+    boost::system::error_code ec;
+    if( !boost::filesystem::exists( tempDirectory, ec ) )
+    {
+        return;
+    }
+    const std::time_t staleTime = std::time( nullptr ) - STALE_TEMP_SECONDS;
+    for( boost::filesystem::directory_iterator i( tempDirectory, ec ), iEnd; !ec && i != iEnd; i.increment( ec ) )
+    {
+        boost::system::error_code fileError;
+        const std::time_t         writeTime = boost::filesystem::last_write_time( i->path(), fileError );
+        if( !fileError && writeTime < staleTime )
+        {
+#ifdef _WIN32
+            // read only files cannot be removed on windows
+            boost::filesystem::permissions(
+                i->path(), boost::filesystem::add_perms | boost::filesystem::owner_write, fileError );
+#endif
+            boost::filesystem::remove( i->path(), fileError );
+        }
+    }
+}
+
+inline void addOwnerWrite( const boost::filesystem::path& file )
+{
+    boost::filesystem::permissions( file, boost::filesystem::add_perms | boost::filesystem::owner_write );
+}
+
+inline void removeWrite( const boost::filesystem::path& file )
+{
+    boost::filesystem::permissions( file, boost::filesystem::remove_perms | boost::filesystem::owner_write
+                                              | boost::filesystem::group_write | boost::filesystem::others_write );
+}
+} // namespace
+
+StashObjects::StashObjects( const boost::filesystem::path& objectsDirectory, Stash::Compression compression )
+    : m_objectsDirectory( objectsDirectory )
+    , m_tempDirectory( objectsDirectory / pszTempFolder )
+    , m_compression( compression )
+{
+    removeStaleTempFiles( m_tempDirectory );
+}
+
+boost::filesystem::path StashObjects::getObjectFile( const common::HashCode128& digest ) const
+{
+    const std::string strHex = digest.toHexString();
+    return m_objectsDirectory / strHex.substr( 0U, 2U ) / strHex.substr( 2U );
+}
+
+boost::filesystem::path StashObjects::getCompressedFile( const common::HashCode128& digest ) const
+{
+    boost::filesystem::path objectFile = getObjectFile( digest );
+    objectFile += pszCompressedExtension;
+    return objectFile;
+}
+
+bool StashObjects::has( const common::HashCode128& digest ) const
+{
+    // look for the form this stash writes first
+    if( m_compression == Stash::Compression::eNone )
+    {
+        return boost::filesystem::exists( getObjectFile( digest ) )
+               || boost::filesystem::exists( getCompressedFile( digest ) );
+    }
+    else
+    {
+        return boost::filesystem::exists( getCompressedFile( digest ) )
+               || boost::filesystem::exists( getObjectFile( digest ) );
+    }
+}
+
+common::HashCode128 StashObjects::put( const boost::filesystem::path& file, std::uint64_t& szStoredBytes )
+{
+    szStoredBytes = 0U;
+
+    // the memoised digest usually lets duplicates be detected without reading the file
+    {
+        const common::HashCode128 digest = FileHash( file ).getDigest();
+        if( has( digest ) )
+        {
+            return digest;
+        }
+    }
+
+    // otherwise hash while copying so the object name always matches the bytes written
+    const bool              bCompress = m_compression == Stash::Compression::eAdaptive;
+    boost::filesystem::path tempFile  = makeTempFile( m_tempDirectory );
+
+    common::ContentHash contentHash;
+    std::uint64_t       szSize = 0U;
+    {
+        std::unique_ptr< boost::filesystem::ofstream > pFileStream
+            = boost::filesystem::createBinaryOutputFileStream( tempFile );
+        boost::iostreams::filtering_ostream output;
+        if( bCompress )
+        {
+            writeHeader( *pFileStream, FAST_LEVEL );
+            output.push( boost::iostreams::zlib_compressor( boost::iostreams::zlib_params( FAST_LEVEL ) ) );
+        }
+        output.push( *pFileStream );
+        common::internal::readFileChunks( file,
+                                          [ &contentHash, &output, &szSize ]( const void* pData, std::size_t szChunk )
+                                          {
+                                              contentHash.update( pData, szChunk );
+                                              output.write( reinterpret_cast< const char* >( pData ), szChunk );
+                                              szSize += szChunk;
+                                          } );
+        VERIFY_RTE_MSG( output.good(), "Failed to write stash object: " << tempFile.string() );
+        output.reset();
+        VERIFY_RTE_MSG( pFileStream->good(), "Failed to write stash object: " << tempFile.string() );
+    }
+    const common::HashCode128 digest = contentHash.digest();
+
+    if( has( digest ) )
+    {
+        // stashed concurrently
+        boost::filesystem::remove( tempFile );
+        return digest;
+    }
+
+    boost::filesystem::path objectFile = getObjectFile( digest );
+    if( bCompress )
+    {
+        if( boost::filesystem::file_size( tempFile ) < szSize )
+        {
+            objectFile = getCompressedFile( digest );
+        }
+        else
+        {
+            // incompressible contents are stored raw so that they can be cloned or linked
+            const boost::filesystem::path rawFile = makeTempFile( m_tempDirectory );
+            decompress( tempFile, rawFile );
+            boost::filesystem::remove( tempFile );
+            tempFile = rawFile;
+        }
+    }
+
+    // the object must be durable before any manifest entry can refer to it
+    szStoredBytes = boost::filesystem::file_size( tempFile );
+    boost::filesystem::syncFile( tempFile );
+    removeWrite( tempFile );
+    boost::filesystem::ensureFoldersExist( objectFile );
+    boost::filesystem::rename( tempFile, objectFile );
+    return digest;
+}
+
+bool StashObjects::materialise( const common::HashCode128&     digest,
+                                const boost::filesystem::path& targetFile,
+                                Stash::RestoreMode             restoreMode,
+                                bool&                          bLinked ) const
+{
+    bLinked = false;
+    const boost::filesystem::path objectFile = getObjectFile( digest );
+    if( !boost::filesystem::exists( objectFile ) )
+    {
+        return decompress( getCompressedFile( digest ), targetFile );
+    }
+
+    if( restoreMode != Stash::RestoreMode::eCopy )
+    {
+        if( boost::filesystem::cloneFile( objectFile, targetFile ) )
+        {
+            addOwnerWrite( targetFile );
+            return true;
+        }
+    }
+
+    boost::system::error_code ec;
+    if( restoreMode == Stash::RestoreMode::eLink )
+    {
+        boost::filesystem::create_hard_link( objectFile, targetFile, ec );
+        if( !ec )
+        {
+            bLinked = true;
+            return true;
+        }
+    }
+
+    boost::filesystem::copy_file( objectFile, targetFile, ec );
+    if( ec )
+    {
+        // evicted concurrently
+        if( !boost::filesystem::exists( objectFile ) )
+        {
+            return false;
+        }
+        THROW_RTE( "Failed to restore stash object: " << objectFile.string() << " to: " << targetFile.string()
+                                                       << " error: " << ec.message() );
+    }
+    addOwnerWrite( targetFile );
+    return true;
+}
+
+bool StashObjects::decompress( const boost::filesystem::path& objectFile, const boost::filesystem::path& targetFile ) const
+{
+    boost::filesystem::ifstream inputFile( objectFile, std::ios_base::in | std::ios_base::binary );
+    if( !inputFile )
+    {
+        // evicted concurrently
+        return false;
+    }
+
+    try
+    {
+        readHeader( inputFile, objectFile );
+        boost::iostreams::filtering_istream input;
+        input.push( boost::iostreams::zlib_decompressor() );
+        input.push( inputFile );
+
+        std::unique_ptr< boost::filesystem::ofstream > pFileStream
+            = boost::filesystem::createBinaryOutputFileStream( targetFile );
+        VERIFY_RTE_MSG( copyStream( input, *pFileStream ),
+                        "Failed to decompress stash object: " << objectFile.string() << " to: " << targetFile.string() );
+    }
+    catch( std::exception& )
+    {
+        // never leave a partial file behind
+        boost::system::error_code ec;
+        boost::filesystem::remove( targetFile, ec );
+        throw;
+    }
+    return true;
+}
+
+std::vector< StashObjects::ObjectInfo > StashObjects::list() const
+{
+    std::vector< ObjectInfo > objects;
+    if( !boost::filesystem::exists( m_objectsDirectory ) )
+    {
+        return objects;
+    }
+
+    for( boost::filesystem::directory_iterator iFanOut( m_objectsDirectory ), iFanOutEnd; iFanOut != iFanOutEnd;
+         ++iFanOut )
+    {
+        if( !boost::filesystem::is_directory( iFanOut->path() ) )
+        {
+            continue;
+        }
+        const std::string strPrefix = iFanOut->path().filename().string();
+        for( boost::filesystem::directory_iterator i( iFanOut->path() ), iEnd; i != iEnd; ++i )
+        {
+            ObjectInfo  info;
+            std::string strName = i->path().filename().string();
+            const bool  bCompressed
+                = boost::filesystem::path( strName ).extension() == pszCompressedExtension;
+            if( bCompressed )
+            {
+                strName.resize( strName.size() - std::strlen( pszCompressedExtension ) );
+            }
+            if( !common::HashCode128::fromHexString( strPrefix + strName, info.m_digest ) )
+            {
+                continue;
+            }
+            if( bCompressed )
+            {
+                boost::filesystem::ifstream inputFile( i->path(), std::ios_base::in | std::ios_base::binary );
+                if( !inputFile )
+                {
+                    continue;
+                }
+                info.m_level = readHeader( inputFile, i->path() );
+            }
+            boost::system::error_code ec;
+            info.m_size      = boost::filesystem::file_size( i->path(), ec );
+            info.m_stashTime = boost::filesystem::last_write_time( i->path(), ec );
+            if( !ec )
+            {
+                objects.push_back( info );
+            }
+        }
+    }
+    return objects;
+}
+
+bool StashObjects::remove( const common::HashCode128& digest )
+{
+    bool bRemoved = false;
+    for( const boost::filesystem::path& objectFile : { getObjectFile( digest ), getCompressedFile( digest ) } )
+    {
+        boost::system::error_code ec;
+#ifdef _WIN32
+        // read only files cannot be removed on windows
+        boost::filesystem::permissions(
+            objectFile, boost::filesystem::add_perms | boost::filesystem::owner_write, ec );
+#endif
+        if( boost::filesystem::remove( objectFile, ec ) && !ec )
+        {
+            bRemoved = true;
+        }
+    }
+    return bRemoved;
+}
+
+std::optional< std::uint64_t > StashObjects::recompress( const common::HashCode128& digest, int level )
+{
+    const boost::filesystem::path objectFile = getCompressedFile( digest );
+    const boost::filesystem::path tempFile   = makeTempFile( m_tempDirectory );
+    {
+        boost::filesystem::ifstream inputFile( objectFile, std::ios_base::in | std::ios_base::binary );
+        if( !inputFile )
+        {
+            return std::optional< std::uint64_t >();
+        }
+        readHeader( inputFile, objectFile );
+        boost::iostreams::filtering_istream input;
+        input.push( boost::iostreams::zlib_decompressor() );
+        input.push( inputFile );
+
+        std::unique_ptr< boost::filesystem::ofstream > pFileStream
+            = boost::filesystem::createBinaryOutputFileStream( tempFile );
+        writeHeader( *pFileStream, level );
+        boost::iostreams::filtering_ostream output;
+        output.push( boost::iostreams::zlib_compressor( boost::iostreams::zlib_params( level ) ) );
+        output.push( *pFileStream );
+        const bool bCopied = copyStream( input, output );
+        output.reset();
+        if( !bCopied || !pFileStream->good() )
+        {
+            pFileStream.reset();
+            boost::filesystem::remove( tempFile );
+            THROW_RTE( "Failed to recompress stash object: " << objectFile.string() );
+        }
+    }
+
+    // restores already reading the old file are unaffected by the rename
+    boost::filesystem::syncFile( tempFile );
+    removeWrite( tempFile );
+#ifdef _WIN32
+    boost::filesystem::permissions( objectFile, boost::filesystem::add_perms | boost::filesystem::owner_write );
+#endif
+    boost::filesystem::rename( tempFile, objectFile );
+    return boost::filesystem::file_size( objectFile );
+}
+
+} // namespace task
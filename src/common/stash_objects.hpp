@@ -0,0 +1,105 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+#ifndef GUARD_2024_April_10_stash_objects
+#define GUARD_2024_April_10_stash_objects
+
+#include "common/content_hash.hpp"
+#include "common/stash.hpp"
+
+#include "boost/filesystem/path.hpp"
+
+#include <cstdint>
+#include <ctime>
+#include <optional>
+#include <vector>
+
+namespace task
+{
+
+// StashObjects
+//
+// Content addressed store of stashed file contents.  Each object is named by the
+// hex ContentHash digest of its contents and fanned out over 256 directories by the
+// first byte of the digest i.e. objects/ab/cdef...  Identical outputs stashed under
+// different determinants therefore share one object.
+//
+// Objects are immutable once written and are made read only so that a hard linked
+// restore cannot be modified in place by a later build step.
+//
+// With Stash::Compression::eAdaptive new objects are zlib compressed at FAST_LEVEL
+// into objects/ab/cdef....z preceded by a small header recording the level.  Objects
+// which do not shrink are stored raw.  recompress() later rewrites cold objects at
+// DENSE_LEVEL.  Either form is found and restored whatever the compression setting.
+//
+// Objects are written to objects/tmp and renamed into place once complete so that a
+// crash never leaves a partial object.  Temporaries orphaned by a crash are swept
+// from objects/tmp when the store is next opened.
+class StashObjects
+{
+public:
+    static constexpr int FAST_LEVEL  = 1;
+    static constexpr int DENSE_LEVEL = 9;
+
+    struct ObjectInfo
+    {
+        common::HashCode128 m_digest;
+        std::uint64_t       m_size      = 0U; // bytes on disk
+        std::time_t         m_stashTime = 0;
+        int                 m_level     = 0; // zlib level or zero if stored raw
+    };
+
+    StashObjects( const boost::filesystem::path& objectsDirectory, Stash::Compression compression );
+
+    boost::filesystem::path getObjectFile( const common::HashCode128& digest ) const;
+    boost::filesystem::path getCompressedFile( const common::HashCode128& digest ) const;
+    bool                    has( const common::HashCode128& digest ) const;
+
+    // store the contents of the file returning its content digest
+    // szStoredBytes is set to the bytes newly stored - zero if the contents were already present
+    common::HashCode128 put( const boost::filesystem::path& file, std::uint64_t& szStoredBytes );
+
+    // create the target file with the object contents using the cheapest method the
+    // restore mode and filesystem allow - compressed objects are always decompressed
+    // into the target.  The target must not exist.  bLinked is set if the target is a
+    // hard link sharing the object's inode and so must not be modified.
+    // returns false if the object no longer exists
+    bool materialise( const common::HashCode128&     digest,
+                      const boost::filesystem::path& targetFile,
+                      Stash::RestoreMode             restoreMode,
+                      bool&                          bLinked ) const;
+
+    std::vector< ObjectInfo > list() const;
+    bool                      remove( const common::HashCode128& digest );
+
+    // rewrite a compressed object at the level returning its new size on disk
+    // or nothing if the object no longer exists
+    std::optional< std::uint64_t > recompress( const common::HashCode128& digest, int level );
+
+private:
+    bool decompress( const boost::filesystem::path& objectFile, const boost::filesystem::path& targetFile ) const;
+
+    const boost::filesystem::path m_objectsDirectory;
+    const boost::filesystem::path m_tempDirectory;
+    const Stash::Compression      m_compression;
+};
+
+} // namespace task
+
+#endif // GUARD_2024_April_10_stash_objects
@@ -75,8 +75,118 @@ std::ostream& operator<<( std::ostream& os, const Status& status )
 }
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
-Progress::Progress( StatusFIFO& fifo, Status::Owner owner )
+namespace
+{
+    std::size_t roundUpToPowerOfTwo( std::size_t szValue )
+    {
+        std::size_t szResult = 2U;
+        while( szResult < szValue )
+        {
+            szResult <<= 1U;
+        }
+        return szResult;
+    }
+}
+
+StatusFIFO::StatusFIFO( std::size_t szCapacity, Overflow overflow )
+    :   m_szMask( roundUpToPowerOfTwo( szCapacity ) - 1U ),
+        m_overflow( overflow ),
+        m_pSlots( new Slot[ m_szMask + 1U ] ),
+        m_tail( 0U ),
+        m_head( 0U ),
+        m_dropped( 0U )
+{
+    for( std::size_t i = 0U; i <= m_szMask; ++i )
+    {
+        m_pSlots[ i ].m_sequence.store( i, std::memory_order_relaxed );
+    }
+}
+
+StatusFIFO::~StatusFIFO()
+{
+}
+
+bool StatusFIFO::push( Status&& status )
+{
+    std::size_t szPos = m_tail.load( std::memory_order_relaxed );
+    Slot* pSlot = nullptr;
+    while( true )
+    {
+        pSlot = &m_pSlots[ szPos & m_szMask ];
+        const std::size_t szSequence = pSlot->m_sequence.load( std::memory_order_acquire );
+        const std::ptrdiff_t difference
+            = static_cast< std::ptrdiff_t >( szSequence ) - static_cast< std::ptrdiff_t >( szPos );
+        if( difference == 0 )
+        {
+            // the slot is free - claim it
+            if( m_tail.compare_exchange_weak( szPos, szPos + 1U, std::memory_order_relaxed ) )
+            {
+                break;
+            }
+        }
+        else if( difference < 0 )
+        {
+            // the ring is full - the consumer has not freed this slot from the last lap
+            if( m_overflow == eDrop )
+            {
+                m_dropped.fetch_add( 1U, std::memory_order_relaxed );
+                return false;
+            }
+            std::this_thread::yield();
+            szPos = m_tail.load( std::memory_order_relaxed );
+        }
+        else
+        {
+            // another producer claimed the slot
+            szPos = m_tail.load( std::memory_order_relaxed );
+        }
+    }
+    
+    pSlot->m_status = std::move( status );
+    pSlot->m_sequence.store( szPos + 1U, std::memory_order_release );
+    return true;
+}
+
+bool StatusFIFO::empty() const
+{
+    const Slot& slot = m_pSlots[ m_head & m_szMask ];
+    return slot.m_sequence.load( std::memory_order_acquire ) != m_head + 1U;
+}
+
+Status StatusFIFO::pop()
+{
+    Slot& slot = m_pSlots[ m_head & m_szMask ];
+    VERIFY_RTE_MSG( slot.m_sequence.load( std::memory_order_acquire ) == m_head + 1U,
+        "StatusFIFO pop when empty" );
+    Status status = std::move( slot.m_status );
+    slot.m_sequence.store( m_head + m_szMask + 1U, std::memory_order_release );
+    ++m_head;
+    return status;
+}
+
+std::size_t StatusFIFO::drain( std::vector< Status >& statuses )
+{
+    std::size_t szCount = 0U;
+    while( true )
+    {
+        Slot& slot = m_pSlots[ m_head & m_szMask ];
+        if( slot.m_sequence.load( std::memory_order_acquire ) != m_head + 1U )
+        {
+            break;
+        }
+        statuses.emplace_back( std::move( slot.m_status ) );
+        slot.m_sequence.store( m_head + m_szMask + 1U, std::memory_order_release );
+        ++m_head;
+        ++szCount;
+    }
+    return szCount;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+Progress::Progress( StatusFIFO& fifo, Status::Owner owner, CancellationToken cancellationToken )
     :   m_fifo( fifo ),
+        m_cancellationToken( cancellationToken ),
         m_status( owner )
 {
 }
@@ -122,7 +232,7 @@ void Progress::setState( Status::State state )
         case Status::eFailed    :
             m_status.m_elapsed = getElapsedTime();
             m_timer.stop();
-            // m_fifo.push( m_status );
+            m_fifo.push( m_status );
             break;
         default:
             THROW_RTE( "Unknown task state" );
@@ -142,6 +252,12 @@ void Progress::failed()
     setState( Status::eFailed );
 }
 
+void Progress::spawn( const std::vector< std::shared_ptr< Task > >& tasks )
+{
+    VERIFY_RTE_MSG( m_spawner, "Tasks can only be spawned by a task run by a scheduler" );
+    m_spawner( tasks );
+}
+
 void Progress::msg( const std::string& strMsg )              
 {
     m_status.m_elapsed = getElapsedTime();
@@ -166,14 +282,19 @@ Task::~Task()
     
 }
     
-bool Task::isReady( const RawPtrSet& finished )
+std::string Task::getIdentity() const
 {
-    for( RawPtr pTask : m_dependencies )
-    {
-        if( !finished.count( pTask ) )
-            return false;
-    }
-    return true;
+    return std::string();
+}
+    
+Task::Resources Task::getResources() const
+{
+    return Resources();
+}
+    
+std::optional< Task::CacheInfo > Task::getCacheInfo() const
+{
+    return std::optional< CacheInfo >();
 }
     
 void Task::failed( Progress& taskProgress )
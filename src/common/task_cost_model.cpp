@@ -0,0 +1,188 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+
+#include "common/task_cost_model.hpp"
+#include "common/assert_verify.hpp"
+
+#include "record_file.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <mutex>
+
+namespace task
+{
+namespace
+{
+// model file records are each followed by their task identity
+static constexpr char          MODEL_MAGIC[ 8 ] = { 'E', 'D', 'S', 'T', 'C', 'O', 'S', 'T' };
+static constexpr std::uint32_t MODEL_VERSION    = 1U;
+
+struct Record
+{
+    double        m_cost;
+    std::uint32_t m_identityLength;
+    std::uint32_t m_reserved;
+};
+
+static_assert( sizeof( Record ) == 16U, "Unexpected cost model record size" );
+} // namespace
+
+TaskCostModel::TaskCostModel() = default;
+
+TaskCostModel::~TaskCostModel()
+{
+    try
+    {
+        flush();
+    }
+    catch( std::exception& )
+    {
+        // costs are only estimates and are learnt again if lost
+    }
+}
+
+void TaskCostModel::open( const boost::filesystem::path& modelFile )
+{
+    load( modelFile );
+    std::unique_lock< std::shared_mutex > lock( m_mutex );
+    m_modelFile = modelFile;
+}
+
+void TaskCostModel::flush()
+{
+    std::optional< boost::filesystem::path > modelFile;
+    {
+        std::unique_lock< std::shared_mutex > lock( m_mutex );
+        if( !m_bModified )
+        {
+            return;
+        }
+        modelFile   = m_modelFile;
+        m_bModified = false;
+    }
+    if( modelFile.has_value() )
+    {
+        save( modelFile.value() );
+    }
+}
+
+void TaskCostModel::load( const boost::filesystem::path& modelFile )
+{
+    // an unknown, older or corrupt model is ignored and costs are learnt again
+    common::RecordFileReader< Record > reader( modelFile, MODEL_MAGIC, MODEL_VERSION );
+
+    CostMap costs;
+    for( std::uint64_t i = 0U; i != reader.getCount(); ++i )
+    {
+        Record      record;
+        std::string strIdentity;
+        if( !reader.read( record ) || !reader.readPadded( record.m_identityLength, strIdentity ) )
+        {
+            return;
+        }
+        costs[ std::move( strIdentity ) ] = record.m_cost;
+    }
+
+    std::unique_lock< std::shared_mutex > lock( m_mutex );
+    for( const auto& [ strIdentity, recordCost ] : costs )
+    {
+        double& cost = m_costs[ strIdentity ];
+        m_totalCost += recordCost - cost;
+        cost = recordCost;
+    }
+}
+
+void TaskCostModel::save( const boost::filesystem::path& modelFile ) const
+{
+    std::shared_lock< std::shared_mutex > lock( m_mutex );
+    common::RecordFileWriter writer( MODEL_MAGIC, MODEL_VERSION, m_costs.size(), sizeof( Record ) );
+    for( const auto& [ strIdentity, cost ] : m_costs )
+    {
+        writer.write( Record{ cost, static_cast< std::uint32_t >( strIdentity.size() ), 0U } );
+        writer.writePadded( strIdentity );
+    }
+    lock.unlock();
+    writer.save( modelFile );
+}
+
+std::optional< double > TaskCostModel::find( const std::string& strIdentity ) const
+{
+    std::shared_lock< std::shared_mutex > lock( m_mutex );
+    CostMap::const_iterator               iFind = m_costs.find( strIdentity );
+    if( iFind != m_costs.end() )
+    {
+        return iFind->second;
+    }
+    return std::optional< double >();
+}
+
+double TaskCostModel::estimate( const std::string& strIdentity ) const
+{
+    std::shared_lock< std::shared_mutex > lock( m_mutex );
+    CostMap::const_iterator               iFind = m_costs.find( strIdentity );
+    if( iFind != m_costs.end() )
+    {
+        return iFind->second;
+    }
+    return m_costs.empty() ? DEFAULT_COST : m_totalCost / static_cast< double >( m_costs.size() );
+}
+
+void TaskCostModel::set( const std::string& strIdentity, double cost )
+{
+    std::unique_lock< std::shared_mutex > lock( m_mutex );
+    double&                               entry = m_costs[ strIdentity ];
+    m_totalCost += cost - entry;
+    entry       = cost;
+    m_bModified = true;
+}
+
+void TaskCostModel::record( const std::string& strIdentity, double duration )
+{
+    std::unique_lock< std::shared_mutex > lock( m_mutex );
+    auto ibResult = m_costs.insert( std::make_pair( strIdentity, duration ) );
+    if( ibResult.second )
+    {
+        m_totalCost += duration;
+    }
+    else
+    {
+        const double cost = ibResult.first->second + SMOOTHING * ( duration - ibResult.first->second );
+        m_totalCost += cost - ibResult.first->second;
+        ibResult.first->second = cost;
+    }
+    m_bModified = true;
+}
+
+void TaskCostModel::clear()
+{
+    std::unique_lock< std::shared_mutex > lock( m_mutex );
+    m_costs.clear();
+    m_totalCost = 0.0;
+    m_bModified = true;
+}
+
+std::size_t TaskCostModel::size() const
+{
+    std::shared_lock< std::shared_mutex > lock( m_mutex );
+    return m_costs.size();
+}
+
+} // namespace task
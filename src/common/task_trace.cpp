@@ -0,0 +1,262 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+
+#include "common/task_trace.hpp"
+#include "common/assert_verify.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+namespace task
+{
+namespace
+{
+std::atomic< std::uint64_t > g_nextTraceID( 1U );
+
+// the buffer this thread last recorded to
+thread_local std::uint64_t g_currentTraceID = 0U;
+thread_local void*         g_pCurrentBuffer = nullptr;
+
+void writeJSONString( std::ostream& os, const std::string& str )
+{
+    os << '"';
+    for( const char c : str )
+    {
+        switch( c )
+        {
+            case '"':
+                os << "\\\"";
+                break;
+            case '\\':
+                os << "\\\\";
+                break;
+            case '\n':
+                os << "\\n";
+                break;
+            case '\r':
+                os << "\\r";
+                break;
+            case '\t':
+                os << "\\t";
+                break;
+            default:
+                if( static_cast< unsigned char >( c ) < 0x20U )
+                {
+                    os << "\\u" << std::hex << std::setw( 4 ) << std::setfill( '0' ) << static_cast< int >( c )
+                       << std::dec << std::setfill( ' ' );
+                }
+                else
+                {
+                    os << c;
+                }
+                break;
+        }
+    }
+    os << '"';
+}
+
+const char* getStateName( Status::State state )
+{
+    switch( state )
+    {
+        case Status::ePending:
+            return "PENDING";
+        case Status::eStarted:
+            return "STARTED";
+        case Status::eCached:
+            return "CACHED";
+        case Status::eSucceeded:
+            return "SUCCEEDED";
+        case Status::eFailed:
+            return "FAILED";
+        default:
+            THROW_RTE( "Unknown task state" );
+    }
+}
+
+// chrome trace timestamps are microseconds
+inline double toMicroSeconds( std::int64_t nanoSeconds )
+{
+    return static_cast< double >( nanoSeconds ) / 1000.0;
+}
+} // namespace
+
+struct TaskTrace::Chunk
+{
+    static constexpr std::size_t SIZE = 256U;
+
+    Event                      m_events[ SIZE ];
+    std::atomic< std::size_t > m_count{ 0U };
+    std::atomic< Chunk* >      m_pNext{ nullptr };
+};
+
+struct TaskTrace::ThreadBuffer
+{
+    ThreadBuffer( std::thread::id threadID, std::uint32_t index )
+        : m_threadID( threadID )
+        , m_index( index )
+        , m_pHead( new Chunk )
+        , m_pTail( m_pHead )
+    {
+    }
+    ~ThreadBuffer()
+    {
+        for( Chunk* pChunk = m_pHead; pChunk != nullptr; )
+        {
+            Chunk* pNext = pChunk->m_pNext.load( std::memory_order_relaxed );
+            delete pChunk;
+            pChunk = pNext;
+        }
+    }
+
+    const std::thread::id m_threadID;
+    const std::uint32_t   m_index;
+    Chunk* const          m_pHead;
+    // owning thread only
+    Chunk*                m_pTail;
+};
+
+TaskTrace::TaskTrace()
+    : m_traceID( g_nextTraceID++ )
+    , m_startTime( Clock::now() )
+{
+}
+
+TaskTrace::~TaskTrace() = default;
+
+std::int64_t TaskTrace::now() const
+{
+    return std::chrono::duration_cast< std::chrono::nanoseconds >( Clock::now() - m_startTime ).count();
+}
+
+TaskTrace::ThreadBuffer& TaskTrace::getThreadBuffer()
+{
+    if( g_currentTraceID == m_traceID )
+    {
+        return *static_cast< ThreadBuffer* >( g_pCurrentBuffer );
+    }
+
+    // the thread may have recorded to this trace before recording to another
+    std::lock_guard< std::mutex > lock( m_buffersMutex );
+    const std::thread::id         threadID = std::this_thread::get_id();
+    ThreadBuffer*                 pBuffer  = nullptr;
+    for( const std::unique_ptr< ThreadBuffer >& pExisting : m_buffers )
+    {
+        if( pExisting->m_threadID == threadID )
+        {
+            pBuffer = pExisting.get();
+        }
+    }
+    if( pBuffer == nullptr )
+    {
+        m_buffers.push_back(
+            std::make_unique< ThreadBuffer >( threadID, static_cast< std::uint32_t >( m_buffers.size() ) ) );
+        pBuffer = m_buffers.back().get();
+    }
+    g_currentTraceID = m_traceID;
+    g_pCurrentBuffer = pBuffer;
+    return *pBuffer;
+}
+
+void TaskTrace::record( Event event )
+{
+    ThreadBuffer& buffer  = getThreadBuffer();
+    Chunk*        pChunk  = buffer.m_pTail;
+    std::size_t   szCount = pChunk->m_count.load( std::memory_order_relaxed );
+    if( szCount == Chunk::SIZE )
+    {
+        Chunk* pNext = new Chunk;
+        pChunk->m_pNext.store( pNext, std::memory_order_release );
+        buffer.m_pTail = pNext;
+        pChunk         = pNext;
+        szCount        = 0U;
+    }
+    event.m_thread              = buffer.m_index;
+    pChunk->m_events[ szCount ] = std::move( event );
+    pChunk->m_count.store( szCount + 1U, std::memory_order_release );
+}
+
+std::vector< TaskTrace::Event > TaskTrace::getEvents() const
+{
+    std::vector< Event > events;
+
+    std::lock_guard< std::mutex > lock( m_buffersMutex );
+    for( const std::unique_ptr< ThreadBuffer >& pBuffer : m_buffers )
+    {
+        for( const Chunk* pChunk = pBuffer->m_pHead; pChunk != nullptr;
+             pChunk              = pChunk->m_pNext.load( std::memory_order_acquire ) )
+        {
+            const std::size_t szCount = pChunk->m_count.load( std::memory_order_acquire );
+            events.insert( events.end(), pChunk->m_events, pChunk->m_events + szCount );
+        }
+    }
+    return events;
+}
+
+void TaskTrace::writeChromeTrace( std::ostream& os ) const
+{
+    std::vector< Event > events = getEvents();
+    std::sort( events.begin(), events.end(),
+               []( const Event& left, const Event& right )
+               { return left.m_startNanoSeconds < right.m_startNanoSeconds; } );
+
+    std::uint32_t nThreads = 0U;
+    for( const Event& event : events )
+    {
+        nThreads = std::max( nThreads, event.m_thread + 1U );
+    }
+
+    const std::ios_base::fmtflags flags     = os.flags();
+    const std::streamsize         precision = os.precision();
+    os << std::fixed << std::setprecision( 3 );
+
+    os << "{\"traceEvents\":[";
+    bool bFirst = true;
+    for( std::uint32_t thread = 0U; thread != nThreads; ++thread )
+    {
+        os << ( bFirst ? "\n" : ",\n" ) << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread
+           << ",\"args\":{\"name\":\"worker " << thread << "\"}}";
+        bFirst = false;
+    }
+    for( const Event& event : events )
+    {
+        os << ( bFirst ? "\n" : ",\n" ) << "{\"name\":";
+        writeJSONString( os, event.m_strName.empty() ? std::string( "task" ) : event.m_strName );
+        os << ",\"cat\":\"task\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.m_thread
+           << ",\"ts\":" << toMicroSeconds( event.m_startNanoSeconds )
+           << ",\"dur\":" << toMicroSeconds( event.m_endNanoSeconds - event.m_startNanoSeconds )
+           << ",\"args\":{\"run\":" << event.m_run << ",\"task\":" << event.m_szTask << ",\"state\":\"" << getStateName( event.m_state )
+           << "\",\"wait_us\":" << toMicroSeconds( event.m_startNanoSeconds - event.m_enqueueNanoSeconds )
+           << ",\"source\":";
+        writeJSONString( os, event.m_strSource );
+        os << ",\"target\":";
+        writeJSONString( os, event.m_strTarget );
+        os << "}}";
+        bFirst = false;
+    }
+    os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    os.flags( flags );
+    os.precision( precision );
+}
+
+} // namespace task
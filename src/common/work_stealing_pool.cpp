@@ -0,0 +1,280 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+
+#include "work_stealing_pool.hpp"
+
+#include "common/assert_verify.hpp"
+
+namespace task
+{
+namespace
+{
+thread_local const void* g_pCurrentPool   = nullptr;
+thread_local std::size_t g_szCurrentWorker = 0U;
+} // namespace
+
+// Chase-Lev deque of job pointers after Le, Pop, Cohen and Zappa Nardelli,
+// "Correct and Efficient Work-Stealing for Weak Memory Models".  Only the owning
+// worker pushes and pops at the bottom.  Any thread may steal from the top.
+// Outgrown buffers are kept until destruction since a thief may still be reading one.
+class WorkStealingPool::Deque
+{
+    struct Buffer
+    {
+        Buffer( std::int64_t capacity )
+            : m_capacity( capacity )
+            , m_pItems( new std::atomic< Job* >[ static_cast< std::size_t >( capacity ) ] )
+        {
+        }
+        Job* get( std::int64_t index ) const
+        {
+            return m_pItems[ static_cast< std::size_t >( index & ( m_capacity - 1 ) ) ].load( std::memory_order_relaxed );
+        }
+        void put( std::int64_t index, Job* pJob )
+        {
+            m_pItems[ static_cast< std::size_t >( index & ( m_capacity - 1 ) ) ].store( pJob, std::memory_order_relaxed );
+        }
+
+        const std::int64_t                       m_capacity;
+        std::unique_ptr< std::atomic< Job* >[] > m_pItems;
+    };
+
+public:
+    static constexpr std::int64_t INITIAL_CAPACITY = 256;
+
+    Deque()
+        : m_top( 0 )
+        , m_bottom( 0 )
+    {
+        m_buffers.push_back( std::make_unique< Buffer >( INITIAL_CAPACITY ) );
+        m_pBuffer.store( m_buffers.back().get(), std::memory_order_relaxed );
+    }
+
+    // owner only
+    void push( Job* pJob )
+    {
+        const std::int64_t bottom  = m_bottom.load( std::memory_order_relaxed );
+        const std::int64_t top     = m_top.load( std::memory_order_acquire );
+        Buffer*            pBuffer = m_pBuffer.load( std::memory_order_relaxed );
+        if( bottom - top > pBuffer->m_capacity - 1 )
+        {
+            m_buffers.push_back( std::make_unique< Buffer >( pBuffer->m_capacity * 2 ) );
+            Buffer* pGrown = m_buffers.back().get();
+            for( std::int64_t index = top; index != bottom; ++index )
+            {
+                pGrown->put( index, pBuffer->get( index ) );
+            }
+            m_pBuffer.store( pGrown, std::memory_order_release );
+            pBuffer = pGrown;
+        }
+        // a release store rather than the paper's fence so thread sanitizer can follow it
+        pBuffer->put( bottom, pJob );
+        m_bottom.store( bottom + 1, std::memory_order_release );
+    }
+
+    // owner only - newest first
+    Job* pop()
+    {
+        const std::int64_t bottom  = m_bottom.load( std::memory_order_relaxed ) - 1;
+        Buffer*            pBuffer = m_pBuffer.load( std::memory_order_relaxed );
+        m_bottom.store( bottom, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        std::int64_t top = m_top.load( std::memory_order_relaxed );
+
+        Job* pJob = nullptr;
+        if( top <= bottom )
+        {
+            pJob = pBuffer->get( bottom );
+            if( top == bottom )
+            {
+                // last job - race any thief for it
+                if( !m_top.compare_exchange_strong(
+                        top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+                {
+                    pJob = nullptr;
+                }
+                m_bottom.store( bottom + 1, std::memory_order_relaxed );
+            }
+        }
+        else
+        {
+            m_bottom.store( bottom + 1, std::memory_order_relaxed );
+        }
+        return pJob;
+    }
+
+    // any thread - oldest first
+    Job* steal()
+    {
+        std::int64_t top = m_top.load( std::memory_order_acquire );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        const std::int64_t bottom = m_bottom.load( std::memory_order_acquire );
+        if( top < bottom )
+        {
+            Job* pJob = m_pBuffer.load( std::memory_order_acquire )->get( top );
+            if( m_top.compare_exchange_strong( top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed ) )
+            {
+                return pJob;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    std::atomic< std::int64_t >              m_top;
+    std::atomic< std::int64_t >              m_bottom;
+    std::atomic< Buffer* >                   m_pBuffer;
+    std::vector< std::unique_ptr< Buffer > > m_buffers;
+};
+
+struct WorkStealingPool::Worker
+{
+    Deque         m_deque;
+    std::uint64_t m_randomState = 0U;
+    std::thread   m_thread;
+};
+
+WorkStealingPool::WorkStealingPool( unsigned int nThreads )
+    : m_queued( 0U )
+    , m_sleepers( 0U )
+{
+    VERIFY_RTE_MSG( nThreads > 0U, "Work stealing pool requires at least one thread" );
+    for( unsigned int i = 0U; i != nThreads; ++i )
+    {
+        m_workers.push_back( std::make_unique< Worker >() );
+        m_workers.back()->m_randomState = 0x9E3779B97F4A7C15ULL * ( i + 1U );
+    }
+    // every worker must exist before any can steal
+    for( std::size_t szWorker = 0U; szWorker != m_workers.size(); ++szWorker )
+    {
+        m_workers[ szWorker ]->m_thread = std::thread( [ this, szWorker ]() { workerThread( szWorker ); } );
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard< std::mutex > lock( m_sleepMutex );
+        m_bStop = true;
+    }
+    m_sleepCondition.notify_all();
+    for( std::unique_ptr< Worker >& pWorker : m_workers )
+    {
+        pWorker->m_thread.join();
+    }
+}
+
+void WorkStealingPool::post( Job job )
+{
+    Job* pJob = new Job( std::move( job ) );
+    // counted before it can be taken so that the count never goes below zero
+    m_queued.fetch_add( 1U, std::memory_order_seq_cst );
+    if( g_pCurrentPool == this )
+    {
+        m_workers[ g_szCurrentWorker ]->m_deque.push( pJob );
+    }
+    else
+    {
+        std::lock_guard< std::mutex > lock( m_injectMutex );
+        m_inject.push_back( pJob );
+    }
+    wake();
+}
+
+void WorkStealingPool::wake()
+{
+    // a worker about to sleep either sees the queued job or is seen as a sleeper
+    if( m_sleepers.load( std::memory_order_seq_cst ) != 0U )
+    {
+        {
+            std::lock_guard< std::mutex > lock( m_sleepMutex );
+        }
+        m_sleepCondition.notify_one();
+    }
+}
+
+WorkStealingPool::Job* WorkStealingPool::findJob( Worker& worker )
+{
+    if( Job* pJob = worker.m_deque.pop() )
+    {
+        return pJob;
+    }
+
+    {
+        std::lock_guard< std::mutex > lock( m_injectMutex );
+        if( !m_inject.empty() )
+        {
+            Job* pJob = m_inject.front();
+            m_inject.pop_front();
+            return pJob;
+        }
+    }
+
+    // xorshift to pick where to start looking for a victim
+    worker.m_randomState ^= worker.m_randomState << 13U;
+    worker.m_randomState ^= worker.m_randomState >> 7U;
+    worker.m_randomState ^= worker.m_randomState << 17U;
+    const std::size_t szStart = static_cast< std::size_t >( worker.m_randomState % m_workers.size() );
+    for( std::size_t sz = 0U; sz != m_workers.size(); ++sz )
+    {
+        Worker& victim = *m_workers[ ( szStart + sz ) % m_workers.size() ];
+        if( &victim != &worker )
+        {
+            if( Job* pJob = victim.m_deque.steal() )
+            {
+                return pJob;
+            }
+        }
+    }
+    return nullptr;
+}
+
+void WorkStealingPool::workerThread( std::size_t szWorker )
+{
+    g_pCurrentPool    = this;
+    g_szCurrentWorker = szWorker;
+    Worker& worker    = *m_workers[ szWorker ];
+
+    while( true )
+    {
+        if( Job* pJob = findJob( worker ) )
+        {
+            m_queued.fetch_sub( 1U, std::memory_order_relaxed );
+            std::unique_ptr< Job > pOwned( pJob );
+            ( *pOwned )();
+            continue;
+        }
+
+        std::unique_lock< std::mutex > lock( m_sleepMutex );
+        m_sleepers.fetch_add( 1U, std::memory_order_seq_cst );
+        // a steal can miss a job which is mid push so only sleep once nothing is queued
+        m_sleepCondition.wait(
+            lock, [ this ]() { return m_queued.load( std::memory_order_seq_cst ) != 0U || m_bStop; } );
+        m_sleepers.fetch_sub( 1U, std::memory_order_relaxed );
+        if( m_bStop && m_queued.load( std::memory_order_seq_cst ) == 0U )
+        {
+            break;
+        }
+    }
+
+    g_pCurrentPool = nullptr;
+}
+
+} // namespace task
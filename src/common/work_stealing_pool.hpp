@@ -0,0 +1,84 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+
+#ifndef GUARD_2024_April_18_work_stealing_pool
+#define GUARD_2024_April_18_work_stealing_pool
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace task
+{
+
+// WorkStealingPool
+//
+// Fixed set of worker threads each owning a Chase-Lev deque.  A job posted from a
+// worker is pushed onto that worker's own deque and the worker pops from the same end
+// so the successors a task releases run next on the thread which has their inputs in
+// cache.  Idle workers steal the oldest job from a randomly chosen victim.  Jobs
+// posted from any other thread go to a shared injection queue.
+//
+// Workers with nothing to do sleep on a condition variable which posts only signal
+// when a worker is actually asleep.  The destructor runs every job already posted
+// before joining the workers.
+class WorkStealingPool
+{
+public:
+    using Job = std::function< void() >;
+
+    WorkStealingPool( unsigned int nThreads );
+    ~WorkStealingPool();
+
+    WorkStealingPool( const WorkStealingPool& )            = delete;
+    WorkStealingPool& operator=( const WorkStealingPool& ) = delete;
+
+    void post( Job job );
+
+private:
+    class Deque;
+    struct Worker;
+
+    void workerThread( std::size_t szWorker );
+    Job* findJob( Worker& worker );
+    void wake();
+
+    std::vector< std::unique_ptr< Worker > > m_workers;
+
+    std::mutex         m_injectMutex;
+    std::deque< Job* > m_inject;
+
+    // jobs posted but not yet taken and workers waiting for one
+    std::atomic< std::size_t > m_queued;
+    std::atomic< std::size_t > m_sleepers;
+    std::mutex                 m_sleepMutex;
+    std::condition_variable    m_sleepCondition;
+    bool                       m_bStop = false;
+};
+
+} // namespace task
+
+#endif // GUARD_2024_April_18_work_stealing_pool
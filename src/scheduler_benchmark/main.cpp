@@ -0,0 +1,469 @@
+//  Copyright (c) Deighton Systems Limited. 2022. All Rights Reserved.
+//  Author: Edward Deighton
+//  License: Please see license.txt in the project root folder.
+
+//  Use and copying of this software and preparation of derivative works
+//  based upon this software are permitted. Any copy of this software or
+//  of any derivative work must include the above copyright notice, this
+//  paragraph and the one after it.  Any distribution of this software or
+//  derivative works must comply with all applicable laws.
+
+//  This software is made available AS IS, and COPYRIGHT OWNERS DISCLAIMS
+//  ALL WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE
+//  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+//  PURPOSE, AND NOTWITHSTANDING ANY OTHER PROVISION CONTAINED HEREIN, ANY
+//  LIABILITY FOR DAMAGES RESULTING FROM THE SOFTWARE OR ITS USE IS
+//  EXPRESSLY DISCLAIMED, WHETHER ARISING IN CONTRACT, TORT (INCLUDING
+//  NEGLIGENCE) OR STRICT LIABILITY, EVEN IF COPYRIGHT OWNERS ARE ADVISED
+//  OF THE POSSIBILITY OF SUCH DAMAGES.
+
+// scheduler_benchmark
+//
+// Runs synthetic task graphs through task::Scheduler and reports the cost of
+// scheduling rather than of the tasks.  For each graph shape, executor and thread count:
+//
+//     wall_ms                 - time from Scheduler::run to the run completing
+//     ns_per_task             - wall time over the number of tasks
+//     dispatch_ns_per_task    - mean time from a task being both ready and having a free
+//                               worker, that worker's previous task finishing, to it starting
+//     idle_ns_per_task        - worker time with nothing ready to run over the number of tasks
+//                               which measures the parallelism of the graph not the scheduler
+//     ready_latency_us        - p50, p99 and max of the time from a task's last dependency
+//                               finishing, or the run starting for a root, to the task starting
+//
+// The results are written as JSON so runs can be compared by script.
+
+#include "common/assert_verify.hpp"
+#include "common/scheduler.hpp"
+#include "common/task.hpp"
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/path.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+// when and where each task started and finished in nanoseconds since the run started
+struct Timeline
+{
+    Clock::time_point              m_startTime;
+    std::vector< std::int64_t >    m_starts;
+    std::vector< std::int64_t >    m_ends;
+    std::vector< std::thread::id > m_workers;
+
+    std::int64_t now() const
+    {
+        return std::chrono::duration_cast< std::chrono::nanoseconds >( Clock::now() - m_startTime ).count();
+    }
+};
+
+class BenchmarkTask : public task::Task
+{
+public:
+    BenchmarkTask( std::size_t szIndex, const RawPtrSet& dependencies, Timeline& timeline,
+                   std::chrono::nanoseconds work )
+        : Task( dependencies )
+        , m_szIndex( szIndex )
+        , m_timeline( timeline )
+        , m_work( work )
+    {
+    }
+
+    virtual void run( task::Progress& progress )
+    {
+        m_timeline.m_starts[ m_szIndex ]  = m_timeline.now();
+        m_timeline.m_workers[ m_szIndex ] = std::this_thread::get_id();
+        progress.start( "benchmark", std::string(), std::string() );
+        if( m_work.count() != 0 )
+        {
+            // spin rather than sleep so the work occupies the worker
+            const Clock::time_point endTime = Clock::now() + m_work;
+            while( Clock::now() < endTime )
+            {
+            }
+        }
+        progress.succeeded();
+        m_timeline.m_ends[ m_szIndex ] = m_timeline.now();
+    }
+
+private:
+    const std::size_t              m_szIndex;
+    Timeline&                      m_timeline;
+    const std::chrono::nanoseconds m_work;
+};
+
+// each task depends on tasks earlier in the order so the graph is always acyclic
+struct Graph
+{
+    std::vector< std::vector< std::size_t > > m_dependencies;
+
+    std::size_t getEdges() const
+    {
+        std::size_t szEdges = 0U;
+        for( const auto& dependencies : m_dependencies )
+        {
+            szEdges += dependencies.size();
+        }
+        return szEdges;
+    }
+};
+
+Graph createChain( std::size_t szTasks )
+{
+    Graph graph;
+    graph.m_dependencies.resize( szTasks );
+    for( std::size_t i = 1U; i < szTasks; ++i )
+    {
+        graph.m_dependencies[ i ].push_back( i - 1U );
+    }
+    return graph;
+}
+
+// one root releasing every other task which all join in a single sink
+Graph createFanOut( std::size_t szTasks )
+{
+    Graph graph;
+    graph.m_dependencies.resize( std::max< std::size_t >( szTasks, 3U ) );
+    const std::size_t szSink = graph.m_dependencies.size() - 1U;
+    for( std::size_t i = 1U; i != szSink; ++i )
+    {
+        graph.m_dependencies[ i ].push_back( 0U );
+        graph.m_dependencies[ szSink ].push_back( i );
+    }
+    return graph;
+}
+
+// a chain of diamonds - each fork releases two tasks which join before the next fork
+Graph createDiamonds( std::size_t szTasks )
+{
+    Graph graph;
+    graph.m_dependencies.resize( std::max< std::size_t >( szTasks, 4U ) );
+    for( std::size_t i = 1U; i < graph.m_dependencies.size(); ++i )
+    {
+        switch( i % 3U )
+        {
+            case 1U:
+            case 2U:
+                graph.m_dependencies[ i ].push_back( i - ( i % 3U ) );
+                break;
+            case 0U:
+                graph.m_dependencies[ i ].push_back( i - 1U );
+                graph.m_dependencies[ i ].push_back( i - 2U );
+                break;
+        }
+    }
+    return graph;
+}
+
+// layers of random width where each task depends on a few random tasks of the layer before
+Graph createLayered( std::size_t szTasks, std::size_t szWidth, std::size_t szFanIn, std::mt19937& random )
+{
+    Graph graph;
+    graph.m_dependencies.resize( szTasks );
+    std::size_t szLayerBegin = 0U, szPreviousBegin = 0U;
+    std::uniform_int_distribution< std::size_t > widthDistribution( 1U, std::max< std::size_t >( szWidth, 1U ) * 2U );
+    while( szLayerBegin < szTasks )
+    {
+        const std::size_t szLayerEnd = std::min( szTasks, szLayerBegin + widthDistribution( random ) );
+        for( std::size_t i = szLayerBegin; i != szLayerEnd && szLayerBegin != 0U; ++i )
+        {
+            std::uniform_int_distribution< std::size_t > dependencyDistribution( szPreviousBegin, szLayerBegin - 1U );
+            for( std::size_t j = 0U; j != szFanIn; ++j )
+            {
+                graph.m_dependencies[ i ].push_back( dependencyDistribution( random ) );
+            }
+            std::sort( graph.m_dependencies[ i ].begin(), graph.m_dependencies[ i ].end() );
+            graph.m_dependencies[ i ].erase(
+                std::unique( graph.m_dependencies[ i ].begin(), graph.m_dependencies[ i ].end() ),
+                graph.m_dependencies[ i ].end() );
+        }
+        szPreviousBegin = szLayerBegin;
+        szLayerBegin    = szLayerEnd;
+    }
+    return graph;
+}
+
+struct Result
+{
+    std::string  m_strShape;
+    std::size_t  m_szTasks   = 0U;
+    std::size_t  m_szEdges   = 0U;
+    std::string  m_strExecutor;
+    unsigned int m_threads   = 0U;
+    std::int64_t m_workNanoSeconds = 0;
+    double       m_wallMilliSeconds       = 0.0;
+    double       m_nanoSecondsPerTask     = 0.0;
+    double       m_dispatchNanoSecondsPerTask = 0.0;
+    double       m_idleNanoSecondsPerTask     = 0.0;
+    double       m_p50MicroSeconds        = 0.0;
+    double       m_p99MicroSeconds        = 0.0;
+    double       m_maxMicroSeconds        = 0.0;
+};
+
+Result runGraph( const Graph& graph, task::Scheduler::Executor executor, unsigned int threads,
+                 std::chrono::nanoseconds work )
+{
+    const std::size_t szTasks = graph.m_dependencies.size();
+
+    Timeline timeline;
+    timeline.m_starts.resize( szTasks );
+    timeline.m_ends.resize( szTasks );
+    timeline.m_workers.resize( szTasks );
+
+    task::Task::PtrVector tasks;
+    tasks.reserve( szTasks );
+    for( std::size_t i = 0U; i != szTasks; ++i )
+    {
+        task::Task::RawPtrSet dependencies;
+        for( std::size_t szDependency : graph.m_dependencies[ i ] )
+        {
+            dependencies.insert( tasks[ szDependency ].get() );
+        }
+        tasks.push_back( std::make_shared< BenchmarkTask >( i, dependencies, timeline, work ) );
+    }
+    task::Schedule::Ptr pSchedule( new task::Schedule( tasks ) );
+
+    task::StatusFIFO fifo;
+    task::Scheduler  scheduler( fifo, task::Scheduler::getDefaultAliveRate(), threads, executor );
+
+    timeline.m_startTime                = Clock::now();
+    task::Scheduler::Run::Ptr pRun      = scheduler.run( nullptr, pSchedule );
+    VERIFY_RTE_MSG( pRun->wait(), "Benchmark run failed" );
+    const std::int64_t wallNanoSeconds = timeline.now();
+
+    std::vector< std::int64_t > readyTimes( szTasks, 0 ), latencies;
+    latencies.reserve( szTasks );
+    std::int64_t busyNanoSeconds = 0;
+    for( std::size_t i = 0U; i != szTasks; ++i )
+    {
+        for( std::size_t szDependency : graph.m_dependencies[ i ] )
+        {
+            readyTimes[ i ] = std::max( readyTimes[ i ], timeline.m_ends[ szDependency ] );
+        }
+        latencies.push_back( timeline.m_starts[ i ] - readyTimes[ i ] );
+        busyNanoSeconds += timeline.m_ends[ i ] - timeline.m_starts[ i ];
+    }
+
+    // replay each worker's tasks in order - time before a task was ready or while its worker
+    // was still running the previous task is not the scheduler's
+    std::vector< std::size_t > order( szTasks );
+    for( std::size_t i = 0U; i != szTasks; ++i )
+    {
+        order[ i ] = i;
+    }
+    std::sort( order.begin(), order.end(),
+               [ &timeline ]( std::size_t left, std::size_t right )
+               {
+                   return std::make_pair( timeline.m_workers[ left ], timeline.m_starts[ left ] )
+                          < std::make_pair( timeline.m_workers[ right ], timeline.m_starts[ right ] );
+               } );
+    std::int64_t dispatchNanoSeconds = 0, workerFreeNanoSeconds = 0;
+    for( std::size_t i = 0U; i != szTasks; ++i )
+    {
+        const std::size_t szTask = order[ i ];
+        if( i == 0U || timeline.m_workers[ szTask ] != timeline.m_workers[ order[ i - 1U ] ] )
+        {
+            workerFreeNanoSeconds = 0;
+        }
+        dispatchNanoSeconds
+            += timeline.m_starts[ szTask ] - std::max( readyTimes[ szTask ], workerFreeNanoSeconds );
+        workerFreeNanoSeconds = timeline.m_ends[ szTask ];
+    }
+    std::sort( latencies.begin(), latencies.end() );
+    auto percentile = [ &latencies ]( double fraction )
+    {
+        const std::size_t szIndex = std::min( latencies.size() - 1U,
+                                              static_cast< std::size_t >( fraction * latencies.size() ) );
+        return latencies[ szIndex ] / 1000.0;
+    };
+
+    Result result;
+    result.m_szTasks          = szTasks;
+    result.m_szEdges          = graph.getEdges();
+    result.m_strExecutor      = ( executor == task::Scheduler::Executor::eAsio ) ? "asio" : "work_stealing";
+    result.m_threads          = threads;
+    result.m_workNanoSeconds  = work.count();
+    result.m_wallMilliSeconds = wallNanoSeconds / 1000000.0;
+    result.m_nanoSecondsPerTask = static_cast< double >( wallNanoSeconds ) / szTasks;
+    result.m_dispatchNanoSecondsPerTask = static_cast< double >( dispatchNanoSeconds ) / szTasks;
+    result.m_idleNanoSecondsPerTask
+        = static_cast< double >( wallNanoSeconds * threads - busyNanoSeconds - dispatchNanoSeconds ) / szTasks;
+    result.m_p50MicroSeconds = percentile( 0.5 );
+    result.m_p99MicroSeconds = percentile( 0.99 );
+    result.m_maxMicroSeconds = latencies.back() / 1000.0;
+    return result;
+}
+
+void writeJSON( std::ostream& os, const std::vector< Result >& results )
+{
+    os << std::fixed << std::setprecision( 3 );
+    os << "{\n  \"benchmarks\": [";
+    bool bFirst = true;
+    for( const Result& result : results )
+    {
+        os << ( bFirst ? "\n" : ",\n" );
+        bFirst = false;
+        // clang-format off
+        os << "    {"
+           << "\"shape\":\""                  << result.m_strShape << "\","
+           << "\"tasks\":"                    << result.m_szTasks << ","
+           << "\"edges\":"                    << result.m_szEdges << ","
+           << "\"executor\":\""               << result.m_strExecutor << "\","
+           << "\"threads\":"                  << result.m_threads << ","
+           << "\"work_ns\":"                  << result.m_workNanoSeconds << ","
+           << "\"wall_ms\":"                  << result.m_wallMilliSeconds << ","
+           << "\"ns_per_task\":"              << result.m_nanoSecondsPerTask << ","
+           << "\"dispatch_ns_per_task\":"     << result.m_dispatchNanoSecondsPerTask << ","
+           << "\"idle_ns_per_task\":"         << result.m_idleNanoSecondsPerTask << ","
+           << "\"ready_latency_us\":{"
+           << "\"p50\":"                      << result.m_p50MicroSeconds << ","
+           << "\"p99\":"                      << result.m_p99MicroSeconds << ","
+           << "\"max\":"                      << result.m_maxMicroSeconds << "}}";
+        // clang-format on
+    }
+    os << "\n  ]\n}\n";
+}
+
+} // namespace
+
+int main( int argc, const char* argv[] )
+{
+    namespace po = boost::program_options;
+
+    std::vector< std::string > shapes;
+    std::vector< unsigned int > threadCounts;
+    std::string                 strExecutor = "both";
+    std::size_t                 szTasks = 10000U, szWidth = 64U, szFanIn = 3U;
+    unsigned int                repeats = 1U, seed = 1U;
+    std::int64_t                workNanoSeconds = 0;
+    boost::filesystem::path     outputFilePath;
+
+    po::options_description options( "Allowed options" );
+    {
+        // clang-format off
+        options.add_options()
+            ( "help,?",                                                                 "Produce help message" )
+            ( "shape",      po::value< std::vector< std::string > >( &shapes ),         "chain, fanout, diamond, layered or empty.  Default is all of them" )
+            ( "tasks",      po::value< std::size_t >( &szTasks ),                       "Tasks in each graph" )
+            ( "width",      po::value< std::size_t >( &szWidth ),                       "Mean width of the layered graph" )
+            ( "fanin",      po::value< std::size_t >( &szFanIn ),                       "Dependencies of each task of the layered graph" )
+            ( "threads",    po::value< std::vector< unsigned int > >( &threadCounts ),  "Thread counts.  Default is powers of two up to the hardware concurrency" )
+            ( "executor",   po::value< std::string >( &strExecutor ),                   "asio, work_stealing or both" )
+            ( "work",       po::value< std::int64_t >( &workNanoSeconds ),              "Nanoseconds each task body spins for - empty shapes always zero" )
+            ( "repeats",    po::value< unsigned int >( &repeats ),                      "Times to run each configuration" )
+            ( "seed",       po::value< unsigned int >( &seed ),                         "Seed of the layered graph" )
+            ( "output",     po::value< boost::filesystem::path >( &outputFilePath ),    "JSON file to write.  Default is standard output" )
+            ;
+        // clang-format on
+    }
+
+    try
+    {
+        po::variables_map vm;
+        po::store( po::command_line_parser( argc, argv ).options( options ).run(), vm );
+        po::notify( vm );
+
+        if( vm.count( "help" ) )
+        {
+            std::cout << options << "\n";
+            return 0;
+        }
+
+        if( shapes.empty() )
+        {
+            shapes = { "chain", "fanout", "diamond", "layered", "empty" };
+        }
+        if( threadCounts.empty() )
+        {
+            const unsigned int hardwareThreads = std::max( 1U, std::thread::hardware_concurrency() );
+            for( unsigned int threads = 1U; threads < hardwareThreads; threads *= 2U )
+            {
+                threadCounts.push_back( threads );
+            }
+            threadCounts.push_back( hardwareThreads );
+        }
+        std::vector< task::Scheduler::Executor > executors;
+        if( strExecutor == "asio" || strExecutor == "both" )
+        {
+            executors.push_back( task::Scheduler::Executor::eAsio );
+        }
+        if( strExecutor == "work_stealing" || strExecutor == "both" )
+        {
+            executors.push_back( task::Scheduler::Executor::eWorkStealing );
+        }
+        VERIFY_RTE_MSG( !executors.empty(), "Unknown executor: " << strExecutor );
+        VERIFY_RTE_MSG( szTasks > 0U, "Graphs need at least one task" );
+
+        std::vector< Result > results;
+        for( const std::string& strShape : shapes )
+        {
+            std::mt19937 random( seed );
+            Graph        graph;
+            std::chrono::nanoseconds work( workNanoSeconds );
+            if( strShape == "chain" )
+                graph = createChain( szTasks );
+            else if( strShape == "fanout" )
+                graph = createFanOut( szTasks );
+            else if( strShape == "diamond" )
+                graph = createDiamonds( szTasks );
+            else if( strShape == "layered" )
+                graph = createLayered( szTasks, szWidth, szFanIn, random );
+            else if( strShape == "empty" )
+            {
+                // no dependencies and no work - the raw cost of dispatch
+                graph.m_dependencies.resize( szTasks );
+                work = std::chrono::nanoseconds( 0 );
+            }
+            else
+                THROW_RTE( "Unknown shape: " << strShape );
+
+            for( task::Scheduler::Executor executor : executors )
+            {
+                for( unsigned int threads : threadCounts )
+                {
+                    for( unsigned int i = 0U; i != repeats; ++i )
+                    {
+                        Result result     = runGraph( graph, executor, threads, work );
+                        result.m_strShape = strShape;
+                        std::cerr << strShape << " " << result.m_strExecutor << " threads: " << threads
+                                  << " ns/task: " << result.m_nanoSecondsPerTask
+                                  << " p99 ready latency us: " << result.m_p99MicroSeconds << std::endl;
+                        results.push_back( result );
+                    }
+                }
+            }
+        }
+
+        if( outputFilePath.empty() )
+        {
+            writeJSON( std::cout, results );
+        }
+        else
+        {
+            boost::filesystem::ofstream outputFile( outputFilePath );
+            VERIFY_RTE_MSG( outputFile.good(), "Failed to open: " << outputFilePath.string() );
+            writeJSON( outputFile, results );
+        }
+        return 0;
+    }
+    catch( std::exception& e )
+    {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
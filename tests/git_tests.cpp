@@ -0,0 +1,157 @@
+#include "common/git.hpp"
+#include "common/process.hpp"
+
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+class GitRepository
+{
+public:
+    GitRepository()
+        // a space checks that the directory is quoted on every command line
+        : m_directory( boost::filesystem::temp_directory_path() / boost::filesystem::unique_path( "git test %%%%-%%%%" ) )
+    {
+        boost::filesystem::create_directories( m_directory );
+        run( "-c init.defaultBranch=main init -q" );
+        run( "config user.name test" );
+        run( "config user.email test@example.com" );
+    }
+    ~GitRepository()
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all( m_directory, ec );
+    }
+
+    const boost::filesystem::path& getDirectory() const { return m_directory; }
+
+    void run( const std::string& strArgs )
+    {
+        std::string strOutput, strError;
+        ASSERT_EQ( common::runProcess( "git -C \"" + m_directory.string() + "\" " + strArgs, strOutput, strError ),
+                   EXIT_SUCCESS )
+            << strError;
+    }
+
+    boost::filesystem::path write( const std::string& strFile, const std::string& strContents )
+    {
+        const boost::filesystem::path filePath = m_directory / strFile;
+        std::ofstream( filePath.string(), std::ios_base::binary ) << strContents;
+        return filePath;
+    }
+
+    void commit( const std::string& strMsg )
+    {
+        run( "add ." );
+        git::commit( m_directory, strMsg );
+    }
+
+private:
+    const boost::filesystem::path m_directory;
+};
+} // namespace
+
+TEST( Git, Session )
+{
+    GitRepository repository;
+    const boost::filesystem::path fileOne = repository.write( "one.txt", "one\n" );
+    const boost::filesystem::path fileTwo = repository.write( "two.txt", "two\n" );
+    repository.commit( "first" );
+    repository.write( "one.txt", "one changed\n" );
+    repository.commit( "second" );
+    repository.write( "one.txt", "one changed again\n" );
+    repository.write( "two.txt", "two changed\n" );
+    repository.commit( "third" );
+
+    git::Session session( repository.getDirectory() );
+
+    for( const boost::filesystem::path& filePath : { fileOne, fileTwo } )
+    {
+        const std::vector< std::string > hashes = session.getFileGitHashes( filePath );
+        ASSERT_EQ( hashes, git::getFileGitHashes( repository.getDirectory(), filePath ) );
+        ASSERT_EQ( hashes.size(), filePath == fileOne ? 3U : 2U );
+
+        std::vector< git::Session::FileRequest > requests;
+        for( const std::string& strHash : hashes )
+        {
+            const std::string strExpected = git::getGitFile( repository.getDirectory(), filePath, strHash );
+            ASSERT_EQ( session.getGitFile( filePath, strHash ), strExpected );
+            requests.push_back( { filePath, strHash } );
+        }
+        const std::vector< std::string > contents = session.getGitFiles( requests );
+        ASSERT_EQ( contents.size(), hashes.size() );
+        for( std::size_t i = 0U; i != hashes.size(); ++i )
+        {
+            ASSERT_EQ( contents[ i ], git::getGitFile( repository.getDirectory(), filePath, hashes[ i ] ) );
+        }
+    }
+    ASSERT_EQ( session.getGitFile( fileOne, session.getFileGitHashes( fileOne ).front() ), "one changed again\n" );
+
+    // a batch too large to write without a thread
+    {
+        const std::string                        strHash = session.getFileGitHashes( fileTwo ).back();
+        std::vector< git::Session::FileRequest > requests( 1000U, git::Session::FileRequest{ fileTwo, strHash } );
+        for( const std::string& strContents : session.getGitFiles( requests ) )
+        {
+            ASSERT_EQ( strContents, "two\n" );
+        }
+    }
+
+    // a missing object fails its request but not the session
+    const std::string strMissing( 40U, '0' );
+    ASSERT_THROW( session.getGitFile( fileOne, strMissing ), std::runtime_error );
+    ASSERT_THROW( session.getGitFiles( { { fileOne, strMissing }, { fileTwo, session.getFileGitHashes( fileTwo ).front() } } ),
+                  std::runtime_error );
+    ASSERT_EQ( session.getGitFile( fileTwo, session.getFileGitHashes( fileTwo ).front() ), "two changed\n" );
+
+    // later commits only appear once refreshed
+    repository.write( "two.txt", "two changed again\n" );
+    repository.commit( "fourth" );
+    ASSERT_EQ( session.getFileGitHashes( fileTwo ).size(), 2U );
+    session.refresh();
+    ASSERT_EQ( session.getFileGitHashes( fileTwo ), git::getFileGitHashes( repository.getDirectory(), fileTwo ) );
+    ASSERT_EQ( session.getFileGitHashes( fileTwo ).size(), 3U );
+}
+
+TEST( Git, SessionRepositoryRemoved )
+{
+    GitRepository repository;
+    const boost::filesystem::path fileOne = repository.write( "one.txt", "one\n" );
+    repository.commit( "first" );
+
+    git::Session      session( repository.getDirectory() );
+    const std::string strHash = session.getFileGitHashes( fileOne ).front();
+
+    // git cat-file exits at once so writing the requests meets a closed pipe
+    boost::filesystem::remove_all( repository.getDirectory() / ".git" );
+    std::vector< git::Session::FileRequest > requests( 10000U, git::Session::FileRequest{ fileOne, strHash } );
+    for( int i = 0; i != 2; ++i )
+    {
+        try
+        {
+            session.getGitFiles( requests );
+            FAIL() << "Expected git cat-file to fail";
+        }
+        catch( std::runtime_error& ex )
+        {
+            ASSERT_NE( std::string( ex.what() ).find( "not a git repository" ), std::string::npos ) << ex.what();
+        }
+        requests.resize( 1U );
+    }
+}
+
+TEST( Git, SessionNotARepository )
+{
+    const boost::filesystem::path directory
+        = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path( "git test %%%%-%%%%" );
+    boost::filesystem::create_directories( directory );
+    ASSERT_FALSE( git::isGitRepo( directory ) );
+    ASSERT_THROW( git::Session session( directory ), std::runtime_error );
+    boost::filesystem::remove_all( directory );
+}
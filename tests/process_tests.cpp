@@ -1,10 +1,22 @@
 
 #include "common/process.hpp"
+#include "common/spawn_server.hpp"
+#include "common/file.hpp"
 
+#include "boost/asio/io_context.hpp"
 #include "boost/filesystem.hpp"
+#include "boost/process/exception.hpp"
 
 #include <gtest/gtest.h>
 
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
 #ifdef _WIN32
 static const std::string exeName = "common_tests.exe";
 static const std::string expected =
@@ -85,4 +97,182 @@ TEST( ProcessTests, BasicError )
 #endif
     ASSERT_EQ( "", strOutput );
     ASSERT_EQ( "Exception calling main: unrecognised option '--foobar'\n", strError );
-}
\ No newline at end of file
+}
+
+#ifndef _WIN32
+TEST( ProcessTests, SpawnServer )
+{
+    const common::Command cmd{ "sh -c \"echo $SPAWN_TEST; echo oops 1>&2; exit 3\"", { { "SPAWN_TEST", "value" } } };
+    {
+        common::SpawnServer server;
+        {
+            const common::CommandResult result = server.run( common::Command{ "echo \"hello  world\"", {} } );
+            ASSERT_EQ( result.m_exitCode, 0 );
+            ASSERT_EQ( result.m_strOutput, "hello  world\n" );
+        }
+        {
+            const common::CommandResult result = server.run( cmd );
+            ASSERT_EQ( result.m_exitCode, 3 );
+            ASSERT_EQ( result.m_strOutput, "value\n" );
+            ASSERT_EQ( result.m_strError, "oops\n" );
+        }
+        // a command which exits after closing its output is still reaped
+        {
+            const common::CommandResult result = server.run( common::Command{ "sh -c \"exec 1>&- 2>&-; sleep 0.2; exit 4\"", {} } );
+            ASSERT_EQ( result.m_exitCode, 4 );
+        }
+        ASSERT_THROW( server.run( common::Command{ "no_such_spawn_server_program", {} } ), boost::process::process_error );
+
+        // commands run in the working directory of the caller rather than of the helper
+        const boost::filesystem::path workingFolder
+            = boost::filesystem::canonical( boost::filesystem::temp_directory_path() ) / "common_tests" / "spawn_server";
+        boost::filesystem::create_directories( workingFolder );
+        boost::filesystem::updateFileIfChanged( workingFolder / "spawn_test.sh", "#!/bin/sh\necho script\n" );
+        boost::filesystem::permissions( workingFolder / "spawn_test.sh", boost::filesystem::owner_all );
+        const boost::filesystem::path previousFolder = boost::filesystem::current_path();
+        boost::filesystem::current_path( workingFolder );
+        const common::CommandResult pwdResult    = server.run( common::Command{ "pwd", {} } );
+        const common::CommandResult scriptResult = server.run( common::Command{ "./spawn_test.sh", {} } );
+        boost::filesystem::current_path( previousFolder );
+        ASSERT_EQ( pwdResult.m_strOutput, workingFolder.string() + "\n" );
+        ASSERT_EQ( scriptResult.m_strOutput, "script\n" );
+    }
+
+    // runCmd and runProcess only use the server while it is installed
+    common::SpawnServer::start();
+    struct Stop
+    {
+        ~Stop() { common::SpawnServer::stop(); }
+    } stop;
+    ASSERT_TRUE( common::SpawnServer::get() );
+    {
+        std::string strOutput, strError;
+        ASSERT_EQ( common::runCmd( cmd, strOutput, strError ), EXIT_FAILURE );
+        ASSERT_EQ( strOutput, "value\n" );
+        ASSERT_THROW( common::runCmd( common::Command{ "no_such_spawn_server_program", {} }, strOutput, strError ),
+                      boost::process::process_error );
+    }
+
+    std::vector< std::thread > threads;
+    std::vector< int >         failures( 8, 0 );
+    for( int i = 0; i != 8; ++i )
+    {
+        threads.emplace_back(
+            [ i, &failures ]()
+            {
+                for( int j = 0; j != 16; ++j )
+                {
+                    const std::string strExpected = std::to_string( i * 16 + j );
+                    std::string       strOutput, strError;
+                    if( common::runProcess( "echo " + strExpected, strOutput, strError ) != EXIT_SUCCESS
+                        || strOutput != strExpected + "\n" )
+                    {
+                        ++failures[ i ];
+                    }
+                }
+            } );
+    }
+    for( std::thread& thread : threads )
+    {
+        thread.join();
+    }
+    ASSERT_EQ( failures, std::vector< int >( 8, 0 ) );
+
+    common::SpawnServer::stop();
+    ASSERT_FALSE( common::SpawnServer::get() );
+}
+#endif
+
+TEST( ProcessTests, StartCmd )
+{
+    ASSERT_TRUE( boost::filesystem::exists( exeName ) )
+        << "Unit test could not find executable " << exeName << " - are you running from correct cwd?";
+
+    // every command driven by the one thread running the io_context
+    boost::asio::io_context                   ioContext;
+    std::vector< std::string >                outputs( 100 );
+    std::vector< common::CommandResult >      results( 100 );
+    std::vector< common::CommandHandle::Ptr > handles;
+    for( std::size_t i = 0U; i != outputs.size(); ++i )
+    {
+        const common::Command    cmd{ exeName + ( i % 2 == 0U ? " --help" : " --foobar" ), {} };
+        common::CommandCallbacks callbacks;
+        callbacks.m_onOutput   = [ &outputs, i ]( std::string_view chunk ) { outputs[ i ].append( chunk ); };
+        callbacks.m_onComplete = [ &results, i ]( common::CommandResult result ) { results[ i ] = std::move( result ); };
+        handles.push_back( common::startCmd( ioContext, cmd, std::move( callbacks ) ) );
+    }
+    ioContext.run();
+
+    for( std::size_t i = 0U; i != outputs.size(); ++i )
+    {
+        ASSERT_TRUE( handles[ i ]->hasCompleted() );
+        // streamed output is not collected in the result
+        ASSERT_EQ( results[ i ].m_strOutput, "" );
+        if( i % 2 == 0U )
+        {
+            ASSERT_EQ( outputs[ i ], expected );
+            ASSERT_EQ( results[ i ].m_strError, "" );
+        }
+        else
+        {
+            ASSERT_NE( results[ i ].m_exitCode, EXIT_SUCCESS );
+            ASSERT_EQ( results[ i ].m_strError, "Exception calling main: unrecognised option '--foobar'\n" );
+        }
+    }
+}
+
+#ifndef _WIN32
+TEST( ProcessTests, StartCmdTerminate )
+{
+    boost::asio::io_context  ioContext;
+    common::CommandResult    result;
+    common::CommandCallbacks callbacks;
+    callbacks.m_onComplete = [ &result ]( common::CommandResult r ) { result = std::move( r ); };
+
+    const common::Command      cmd{ "sleep 30", {} };
+    common::CommandHandle::Ptr pHandle = common::startCmd( ioContext, cmd, std::move( callbacks ) );
+    ASSERT_GT( pHandle->getPID(), 0 );
+    pHandle->terminate();
+    ioContext.run();
+
+    ASSERT_TRUE( pHandle->hasCompleted() );
+    ASSERT_EQ( result.m_exitCode, 128 + SIGKILL );
+    ASSERT_GT( result.m_usage.m_maxResidentBytes, 0U );
+}
+
+namespace
+{
+void onTestChildSignal( int )
+{
+}
+} // namespace
+
+TEST( ProcessTests, StartCmdClosedOutput )
+{
+    // the process wide SIGCHLD disposition belongs to the application
+    struct sigaction previousAction, testAction;
+    std::memset( &testAction, 0, sizeof( testAction ) );
+    testAction.sa_handler = &onTestChildSignal;
+    testAction.sa_flags   = SA_RESTART;
+    sigemptyset( &testAction.sa_mask );
+    ASSERT_EQ( ::sigaction( SIGCHLD, &testAction, &previousAction ), 0 );
+
+    // the command is only reaped once it exits after closing its output
+    boost::asio::io_context  ioContext;
+    common::CommandResult    result;
+    common::CommandCallbacks callbacks;
+    callbacks.m_onComplete = [ &result ]( common::CommandResult r ) { result = std::move( r ); };
+
+    const common::Command      cmd{ "sh -c \"exec 1>&- 2>&-; sleep 0.2; exit 4\"", {} };
+    common::CommandHandle::Ptr pHandle = common::startCmd( ioContext, cmd, std::move( callbacks ) );
+    ioContext.run();
+
+    struct sigaction action;
+    ::sigaction( SIGCHLD, &previousAction, &action );
+    ASSERT_EQ( action.sa_handler, &onTestChildSignal );
+    ASSERT_EQ( action.sa_flags & SA_RESTART, SA_RESTART );
+
+    ASSERT_TRUE( pHandle->hasCompleted() );
+    ASSERT_EQ( result.m_exitCode, 4 );
+}
+#endif
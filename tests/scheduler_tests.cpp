@@ -1,12 +1,20 @@
 
 #include "common/task.hpp"
 #include "common/scheduler.hpp"
+#include "common/task_cost_model.hpp"
+#include "common/stash.hpp"
+#include "common/file.hpp"
+#include "common/async_task.hpp"
 #include "common/assert_verify.hpp"
 
 #include <gtest/gtest.h>
 
+#include <boost/filesystem/operations.hpp>
+
 #include <sstream>
 #include <chrono>
+#include <future>
+#include <set>
 
 namespace
 {
@@ -289,3 +297,946 @@ TEST( Scheduler, ReSchedule )
     
     
 }
+
+namespace
+{
+    class SequenceTask : public task::Task
+    {
+        std::atomic< std::size_t >& m_sequence;
+        std::string m_strIdentity;
+    public:
+        std::size_t m_szStarted = 0U, m_szFinished = 0U;
+        
+        SequenceTask( std::atomic< std::size_t >& sequence, const task::Task::RawPtrSet& dependencies,
+                      const std::string& strIdentity = std::string() )
+            :   Task( dependencies ),
+                m_sequence( sequence ),
+                m_strIdentity( strIdentity )
+        {
+        }
+        
+        virtual std::string getIdentity() const { return m_strIdentity; }
+        
+        virtual void run( task::Progress& progress )
+        {
+            m_szStarted = ++m_sequence;
+            progress.start( "sequence", std::string( "sequence" ), std::string( "sequence" ) );
+            m_szFinished = ++m_sequence;
+            progress.setState( task::Status::eSucceeded );
+        }
+    };
+}
+
+TEST( Scheduler, LargeSchedule )
+{
+    using namespace task;
+    
+    // layers of tasks each depending on a few tasks of the previous layer
+    static const std::size_t szLayers = 100U, szWidth = 200U;
+    
+    for( Scheduler::Executor executor : { Scheduler::Executor::eAsio, Scheduler::Executor::eWorkStealing } )
+    {
+        std::atomic< std::size_t > sequence( 0U );
+        Task::PtrVector tasks;
+        for( std::size_t szLayer = 0U; szLayer != szLayers; ++szLayer )
+        {
+            for( std::size_t szTask = 0U; szTask != szWidth; ++szTask )
+            {
+                Task::RawPtrSet dependencies;
+                if( szLayer != 0U )
+                {
+                    const std::size_t szPrevious = ( szLayer - 1U ) * szWidth;
+                    dependencies.insert( tasks[ szPrevious + szTask ].get() );
+                    dependencies.insert( tasks[ szPrevious + ( szTask * 7U + 3U ) % szWidth ].get() );
+                }
+                tasks.push_back( Task::Ptr( new SequenceTask( sequence, dependencies ) ) );
+            }
+        }
+    
+        Schedule::Ptr pSchedule( new Schedule( tasks ) );
+    
+        StatusFIFO fifo;
+        Scheduler scheduler( fifo, getKeepAliveTime(), std::optional< unsigned int >(), executor );
+        ASSERT_TRUE( scheduler.run( nullptr, pSchedule )->wait() );
+    
+        for( Task::Ptr pTask : tasks )
+        {
+            const SequenceTask* pSequenceTask = dynamic_cast< const SequenceTask* >( pTask.get() );
+            ASSERT_NE( pSequenceTask->m_szFinished, 0U );
+            for( Task::RawPtr pDependency : pTask->getDependencies() )
+            {
+                ASSERT_LT( dynamic_cast< const SequenceTask* >( pDependency )->m_szFinished, pSequenceTask->m_szStarted );
+            }
+        }
+    }
+}
+
+TEST( Scheduler, WorkStealingFail )
+{
+    using namespace task;
+    
+    Task::PtrVector tasks1 = createGoodSchedule();
+    Task::PtrVector tasks2 = createBadSchedule();
+    
+    Schedule::Ptr pSchedule1( new Schedule( tasks1 ) );
+    Schedule::Ptr pSchedule2( new Schedule( tasks2 ) );
+    
+    StatusFIFO fifo;
+    Scheduler scheduler( fifo, getKeepAliveTime(), 4U, Scheduler::Executor::eWorkStealing );
+    
+    int schedule1, schedule2;
+    Scheduler::Run::Ptr pRun1 = scheduler.run( &schedule1, pSchedule1 );
+    Scheduler::Run::Ptr pRun2 = scheduler.run( &schedule2, pSchedule2 );
+    
+    ASSERT_TRUE( pRun1->wait() );
+    ASSERT_THROW( pRun2->wait(), std::runtime_error );
+}
+
+TEST( Scheduler, InvalidSchedule )
+{
+    using namespace task;
+    
+    std::atomic< std::size_t > sequence( 0U );
+    Task::Ptr pOutside( new SequenceTask( sequence, Task::RawPtrSet{} ) );
+    Task::Ptr pTask( new SequenceTask( sequence, Task::RawPtrSet{ pOutside.get() } ) );
+    
+    ASSERT_THROW( Schedule( Task::PtrVector{ pTask } ), std::runtime_error );
+}
+
+TEST( Scheduler, CostModel )
+{
+    using namespace task;
+    
+    const boost::filesystem::path modelFile = boost::filesystem::temp_directory_path() / "common_tests" / "task_costs.bin";
+    boost::filesystem::remove( modelFile );
+    
+    {
+        TaskCostModel model;
+        model.open( modelFile );
+        ASSERT_EQ( model.estimate( "unknown" ), TaskCostModel::DEFAULT_COST );
+        
+        model.record( "compile", 10.0 );
+        model.record( "compile", 20.0 );
+        model.set( "copy", 1.0 );
+        ASSERT_DOUBLE_EQ( model.find( "compile" ).value(), 10.0 + TaskCostModel::SMOOTHING * 10.0 );
+        // unknown tasks cost the mean
+        ASSERT_DOUBLE_EQ( model.estimate( "unknown" ), ( 13.0 + 1.0 ) / 2.0 );
+    }
+    
+    TaskCostModel model;
+    model.load( modelFile );
+    ASSERT_EQ( model.size(), 2U );
+    ASSERT_DOUBLE_EQ( model.find( "compile" ).value(), 13.0 );
+    ASSERT_DOUBLE_EQ( model.find( "copy" ).value(), 1.0 );
+}
+
+TEST( Scheduler, CriticalPath )
+{
+    using namespace task;
+    
+    // a chain of three cheap tasks outranks independent tasks which each cost more than one link
+    std::atomic< std::size_t > sequence( 0U );
+    Task::PtrVector tasks;
+    for( int i = 0; i != 5; ++i )
+    {
+        tasks.push_back( Task::Ptr( new SequenceTask( sequence, Task::RawPtrSet{}, "wide" ) ) );
+    }
+    Task::Ptr pHead( new SequenceTask( sequence, Task::RawPtrSet{}, "chain" ) );
+    Task::Ptr pMiddle( new SequenceTask( sequence, Task::RawPtrSet{ pHead.get() }, "chain" ) );
+    Task::Ptr pTail( new SequenceTask( sequence, Task::RawPtrSet{ pMiddle.get() }, "chain" ) );
+    tasks.push_back( pTail );
+    tasks.push_back( pMiddle );
+    tasks.push_back( pHead );
+    
+    TaskCostModel::Ptr pCostModel = std::make_shared< TaskCostModel >();
+    pCostModel->set( "wide", 2.0 );
+    pCostModel->set( "chain", 1.0 );
+    
+    StatusFIFO fifo;
+    Scheduler scheduler( fifo, getKeepAliveTime(), 1U );
+    scheduler.setCostModel( pCostModel );
+    ASSERT_TRUE( scheduler.run( nullptr, Schedule::Ptr( new Schedule( tasks ) ) )->wait() );
+    
+    ASSERT_EQ( dynamic_cast< const SequenceTask* >( pHead.get() )->m_szStarted, 1U );
+    // the model learns from the run
+    ASSERT_LT( pCostModel->find( "wide" ).value(), 2.0 );
+}
+
+namespace
+{
+    class ResourceTask : public task::Task
+    {
+        task::Task::Resources m_resources;
+        std::atomic< int >& m_active;
+        std::atomic< int >& m_maxActive;
+    public:
+        ResourceTask( const task::Task::Resources& resources, std::atomic< int >& active, std::atomic< int >& maxActive )
+            :   Task( task::Task::RawPtrSet{} ),
+                m_resources( resources ),
+                m_active( active ),
+                m_maxActive( maxActive )
+        {
+        }
+        
+        virtual task::Task::Resources getResources() const { return m_resources; }
+        
+        virtual void run( task::Progress& progress )
+        {
+            progress.start( "resource", std::string( "resource" ), std::string( "resource" ) );
+            const int active = ++m_active;
+            for( int max = m_maxActive; active > max && !m_maxActive.compare_exchange_weak( max, active ); )
+            {
+            }
+            using namespace std::chrono_literals;
+            std::this_thread::sleep_for( 2ms );
+            --m_active;
+            progress.setState( task::Status::eSucceeded );
+        }
+    };
+}
+
+TEST( Scheduler, Resources )
+{
+    using namespace task;
+    
+    Task::Resources budget;
+    budget.m_memoryMB = 1000U;
+    budget.m_semaphores[ "linker" ] = 2U;
+    
+    Task::Resources heavy, light, huge;
+    heavy.m_memoryMB = 600U;
+    light.m_semaphores[ "linker" ] = 1U;
+    huge.m_memoryMB = 5000U;
+    
+    std::atomic< int > heavyActive( 0 ), heavyMax( 0 ), lightActive( 0 ), lightMax( 0 ), freeActive( 0 ), freeMax( 0 );
+    Task::PtrVector tasks;
+    for( int i = 0; i != 10; ++i )
+    {
+        tasks.push_back( Task::Ptr( new ResourceTask( heavy, heavyActive, heavyMax ) ) );
+        tasks.push_back( Task::Ptr( new ResourceTask( light, lightActive, lightMax ) ) );
+        tasks.push_back( Task::Ptr( new ResourceTask( Task::Resources(), freeActive, freeMax ) ) );
+    }
+    // more than the whole budget still runs
+    tasks.push_back( Task::Ptr( new ResourceTask( huge, heavyActive, heavyMax ) ) );
+    
+    StatusFIFO fifo;
+    Scheduler scheduler( fifo, getKeepAliveTime(), 8U );
+    scheduler.setResourceBudget( budget );
+    ASSERT_TRUE( scheduler.run( nullptr, Schedule::Ptr( new Schedule( tasks ) ) )->wait() );
+    
+    ASSERT_EQ( heavyMax, 1 );
+    ASSERT_LE( lightMax, 2 );
+    // unconstrained tasks backfill the remaining threads
+    ASSERT_GT( freeMax, 1 );
+}
+
+TEST( Scheduler, Trace )
+{
+    using namespace task;
+    
+    Task::PtrVector tasks = createGoodSchedule();
+    Schedule::Ptr pSchedule( new Schedule( tasks ) );
+    
+    task::StatusFIFO fifo;
+    Scheduler scheduler( fifo, getKeepAliveTime() );
+    scheduler.setTracing( true );
+    
+    Scheduler::Run::Ptr pRun = scheduler.run( nullptr, pSchedule );
+    ASSERT_TRUE( pRun->wait() );
+    
+    TaskTrace::Ptr pTrace = pRun->getTrace();
+    ASSERT_TRUE( pTrace );
+    
+    const std::vector< TaskTrace::Event > events = pTrace->getEvents();
+    ASSERT_EQ( events.size(), tasks.size() );
+    for( const TaskTrace::Event& event : events )
+    {
+        ASSERT_EQ( event.m_state, Status::eSucceeded );
+        ASSERT_LE( event.m_enqueueNanoSeconds, event.m_startNanoSeconds );
+        ASSERT_LE( event.m_startNanoSeconds, event.m_endNanoSeconds );
+        ASSERT_EQ( event.m_strName, event.m_strSource );
+    }
+    
+    std::ostringstream os;
+    pTrace->writeChromeTrace( os );
+    const std::string strJSON = os.str();
+    ASSERT_NE( strJSON.find( "\"traceEvents\"" ), std::string::npos );
+    std::size_t szComplete = 0U;
+    for( std::size_t szPos = strJSON.find( "\"ph\":\"X\"" ); szPos != std::string::npos;
+         szPos = strJSON.find( "\"ph\":\"X\"", szPos + 1U ) )
+    {
+        ++szComplete;
+    }
+    ASSERT_EQ( szComplete, tasks.size() );
+}
+
+TEST( StatusFIFO, Drain )
+{
+    using namespace task;
+    
+    static const std::size_t szProducers = 4U, szStatuses = 2000U;
+    
+    // smaller than the total so producers block on the consumer
+    StatusFIFO fifo( 64U, StatusFIFO::eBlock );
+    ASSERT_EQ( fifo.getCapacity(), 64U );
+    
+    std::vector< std::thread > producers;
+    for( std::size_t i = 0U; i != szProducers; ++i )
+    {
+        producers.emplace_back(
+            [ &fifo, i ]()
+            {
+                for( std::size_t j = 0U; j != szStatuses; ++j )
+                {
+                    Status status( reinterpret_cast< Status::Owner >( i + 1U ) );
+                    status.m_strTaskName = std::to_string( j );
+                    ASSERT_TRUE( fifo.push( std::move( status ) ) );
+                }
+            } );
+    }
+    
+    std::vector< Status > statuses;
+    while( statuses.size() != szProducers * szStatuses )
+    {
+        if( fifo.drain( statuses ) == 0U )
+        {
+            std::this_thread::yield();
+        }
+    }
+    for( std::thread& producer : producers )
+    {
+        producer.join();
+    }
+    ASSERT_TRUE( fifo.empty() );
+    ASSERT_EQ( fifo.getDropped(), 0U );
+    
+    // each producer's statuses arrive in order
+    std::vector< std::size_t > next( szProducers, 0U );
+    for( const Status& status : statuses )
+    {
+        const std::size_t szProducer = reinterpret_cast< std::size_t >( status.m_owner ) - 1U;
+        ASSERT_EQ( status.m_strTaskName, std::to_string( next[ szProducer ]++ ) );
+    }
+}
+
+TEST( StatusFIFO, Drop )
+{
+    using namespace task;
+    
+    StatusFIFO fifo( 4U, StatusFIFO::eDrop );
+    for( int i = 0; i != 6; ++i )
+    {
+        Status status;
+        status.m_msgs.push_back( std::to_string( i ) );
+        ASSERT_EQ( fifo.push( std::move( status ) ), i < 4 );
+    }
+    ASSERT_EQ( fifo.getDropped(), 2U );
+    
+    ASSERT_EQ( fifo.pop().m_msgs.front(), "0" );
+    ASSERT_TRUE( fifo.push( Status() ) );
+    
+    std::vector< Status > statuses;
+    ASSERT_EQ( fifo.drain( statuses ), 4U );
+    ASSERT_EQ( statuses.front().m_msgs.front(), "1" );
+    ASSERT_TRUE( statuses.back().m_msgs.empty() );
+    ASSERT_TRUE( fifo.empty() );
+    ASSERT_THROW( fifo.pop(), std::runtime_error );
+}
+
+TEST( Scheduler, StatusOverflow )
+{
+    using namespace task;
+    
+    static const std::size_t szTasks = 200U;
+    
+    Task::PtrVector tasks;
+    for( std::size_t i = 0U; i != szTasks; ++i )
+    {
+        tasks.push_back( Task::Ptr( new TestTask( "overflow", Task::RawPtrSet{} ) ) );
+    }
+    
+    // drained only after the run so the statuses which do not fit are dropped
+    StatusFIFO fifo( 64U );
+    Scheduler scheduler( fifo, getKeepAliveTime() );
+    ASSERT_TRUE( scheduler.run( nullptr, Schedule::Ptr( new Schedule( tasks ) ) )->wait() );
+    
+    std::vector< Status > statuses;
+    ASSERT_EQ( fifo.drain( statuses ), 64U );
+    ASSERT_EQ( fifo.getDropped(), szTasks - 64U );
+    ASSERT_EQ( statuses.front().m_state, Status::eSucceeded );
+}
+
+namespace
+{
+    // writes its content then appends the content of its input if it has one
+    class FileTask : public task::Task
+    {
+        std::string m_strContent;
+        std::optional< boost::filesystem::path > m_input;
+        boost::filesystem::path m_output;
+        std::atomic< int >& m_runs;
+    public:
+        FileTask( const std::string& strContent, const std::optional< boost::filesystem::path >& input,
+                  const boost::filesystem::path& output, const task::Task::RawPtrSet& dependencies,
+                  std::atomic< int >& runs )
+            :   Task( dependencies ),
+                m_strContent( strContent ),
+                m_input( input ),
+                m_output( output ),
+                m_runs( runs )
+        {
+        }
+        
+        virtual std::optional< CacheInfo > getCacheInfo() const
+        {
+            CacheInfo cacheInfo;
+            cacheInfo.m_determinant = task::DeterminantHash( m_strContent );
+            if( m_input.has_value() )
+            {
+                cacheInfo.m_inputs.push_back( task::FileHash( m_input.value() ) );
+            }
+            cacheInfo.m_outputs.push_back( m_output );
+            return cacheInfo;
+        }
+        
+        virtual void run( task::Progress& progress )
+        {
+            progress.start( m_strContent, m_output, m_output );
+            ++m_runs;
+            std::string strContent = m_strContent;
+            if( m_input.has_value() )
+            {
+                std::string strInput;
+                boost::filesystem::loadAsciiFile( m_input.value(), strInput, false );
+                strContent += strInput;
+            }
+            boost::filesystem::ensureFoldersExist( m_output );
+            boost::filesystem::updateFileIfChanged( m_output, strContent );
+            progress.succeeded();
+        }
+    };
+}
+
+TEST( Scheduler, Incremental )
+{
+    using namespace task;
+    
+    const boost::filesystem::path tempDir = boost::filesystem::temp_directory_path() / "common_tests" / "incremental";
+    boost::filesystem::remove_all( tempDir );
+    const boost::filesystem::path a = tempDir / "output" / "a.txt", b = tempDir / "output" / "b.txt",
+                                  c = tempDir / "output" / "c.txt";
+    
+    std::shared_ptr< Stash > pStash = std::make_shared< Stash >( tempDir / "stash" );
+    
+    std::size_t szCached = 0U;
+    auto build = [ & ]( const std::string& strContent )
+    {
+        std::atomic< int > runs( 0 );
+        Task::Ptr pTaskA( new FileTask( strContent, std::nullopt, a, Task::RawPtrSet{}, runs ) );
+        Task::Ptr pTaskB( new FileTask( "b", a, b, Task::RawPtrSet{ pTaskA.get() }, runs ) );
+        Task::Ptr pTaskC( new FileTask( "c", b, c, Task::RawPtrSet{ pTaskB.get() }, runs ) );
+        Schedule::Ptr pSchedule( new Schedule( Task::PtrVector{ pTaskA, pTaskB, pTaskC } ) );
+        
+        StatusFIFO fifo;
+        Scheduler scheduler( fifo, getKeepAliveTime() );
+        scheduler.setStash( pStash );
+        EXPECT_TRUE( scheduler.run( nullptr, pSchedule )->wait() );
+        szCached = 0U;
+        while( !fifo.empty() )
+        {
+            if( fifo.pop().m_state == Status::eCached )
+                ++szCached;
+        }
+        return runs.load();
+    };
+    
+    auto load = []( const boost::filesystem::path& file )
+    {
+        std::string strContents;
+        boost::filesystem::loadAsciiFile( file, strContents, false );
+        return strContents;
+    };
+    
+    ASSERT_EQ( build( "a" ), 3 );
+    ASSERT_EQ( load( c ), "cba" );
+    ASSERT_EQ( szCached, 0U );
+    
+    // nothing runs and the outputs are restored
+    boost::filesystem::remove_all( tempDir / "output" );
+    ASSERT_EQ( build( "a" ), 0 );
+    ASSERT_EQ( load( c ), "cba" );
+    ASSERT_EQ( szCached, 3U );
+    
+    // a changed determinant reruns the task and everything downstream of its output
+    ASSERT_EQ( build( "x" ), 3 );
+    ASSERT_EQ( load( c ), "cbx" );
+    ASSERT_EQ( build( "a" ), 0 );
+    ASSERT_EQ( load( c ), "cba" );
+}
+
+namespace
+{
+    // claims an output which it never writes so stashing it fails
+    class MissingOutputTask : public task::Task
+    {
+        boost::filesystem::path m_output;
+    public:
+        MissingOutputTask( const boost::filesystem::path& output )
+            :   Task( {} ),
+                m_output( output )
+        {
+        }
+        
+        virtual std::optional< CacheInfo > getCacheInfo() const
+        {
+            CacheInfo cacheInfo;
+            cacheInfo.m_determinant = task::DeterminantHash( m_output.string() );
+            cacheInfo.m_outputs.push_back( m_output );
+            return cacheInfo;
+        }
+        
+        virtual void run( task::Progress& progress )
+        {
+            progress.start( "missing", m_output, m_output );
+            progress.succeeded();
+        }
+    };
+}
+
+TEST( Scheduler, StashFailure )
+{
+    using namespace task;
+    
+    const boost::filesystem::path tempDir = boost::filesystem::temp_directory_path() / "common_tests" / "stash_failure";
+    boost::filesystem::remove_all( tempDir );
+    const boost::filesystem::path missing = tempDir / "output" / "missing.txt", b = tempDir / "output" / "b.txt";
+    
+    // the stash is only a cache so failing to stash an output fails neither the task nor the run
+    std::atomic< int > runs( 0 );
+    Task::Ptr pTaskA( new MissingOutputTask( missing ) );
+    Task::Ptr pTaskB( new FileTask( "b", std::nullopt, b, Task::RawPtrSet{ pTaskA.get() }, runs ) );
+    Schedule::Ptr pSchedule( new Schedule( Task::PtrVector{ pTaskA, pTaskB } ) );
+    
+    StatusFIFO fifo;
+    Scheduler scheduler( fifo, getKeepAliveTime() );
+    scheduler.setStash( std::make_shared< Stash >( tempDir / "stash" ) );
+    ASSERT_TRUE( scheduler.run( nullptr, pSchedule )->wait() );
+    ASSERT_EQ( runs.load(), 1 );
+    ASSERT_TRUE( boost::filesystem::exists( b ) );
+}
+
+namespace
+{
+    // runs until the run is cancelled
+    class CancellableTask : public task::Task
+    {
+        std::atomic< bool >& m_bCancelled;
+    public:
+        CancellableTask( std::atomic< bool >& bCancelled )
+            :   Task( {} ),
+                m_bCancelled( bCancelled )
+        {
+        }
+        
+        virtual void run( task::Progress& progress )
+        {
+            progress.start( "cancellable", std::string(), std::string() );
+            const auto startTime = std::chrono::steady_clock::now();
+            while( std::chrono::steady_clock::now() - startTime < std::chrono::seconds( 10 ) )
+            {
+                if( progress.isCancelled() )
+                {
+                    m_bCancelled = true;
+                    return;
+                }
+                std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+            }
+            progress.succeeded();
+        }
+    };
+    
+    class OrderTask : public task::Task
+    {
+        char m_owner;
+        std::mutex& m_mutex;
+        std::string& m_strOrder;
+    public:
+        OrderTask( char owner, std::mutex& mutex, std::string& strOrder )
+            :   Task( {} ),
+                m_owner( owner ),
+                m_mutex( mutex ),
+                m_strOrder( strOrder )
+        {
+        }
+        
+        virtual void run( task::Progress& progress )
+        {
+            progress.start( "order", std::string(), std::string() );
+            {
+                std::lock_guard< std::mutex > lock( m_mutex );
+                m_strOrder.push_back( m_owner );
+            }
+            progress.succeeded();
+        }
+    };
+    
+    // holds a worker until the gate is opened
+    class GateTask : public task::Task
+    {
+        std::shared_future< void > m_gate;
+    public:
+        GateTask( std::shared_future< void > gate )
+            :   Task( {} ),
+                m_gate( gate )
+        {
+        }
+        
+        virtual void run( task::Progress& progress )
+        {
+            progress.start( "gate", std::string(), std::string() );
+            m_gate.wait();
+            progress.succeeded();
+        }
+    };
+}
+
+TEST( Scheduler, Cancellation )
+{
+    using namespace task;
+    
+    std::atomic< bool > bCancelled( false );
+    const auto startTime = std::chrono::steady_clock::now();
+    {
+        StatusFIFO fifo;
+        Scheduler scheduler( fifo, getKeepAliveTime() );
+        Scheduler::Run::Ptr pRun
+            = scheduler.run( nullptr, Schedule::Ptr( new Schedule( Task::PtrVector{ Task::Ptr( new CancellableTask( bCancelled ) ) } ) ) );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+        pRun->cancel();
+        ASSERT_FALSE( pRun->wait() );
+    }
+    ASSERT_TRUE( bCancelled );
+    ASSERT_LT( std::chrono::steady_clock::now() - startTime, std::chrono::seconds( 5 ) );
+}
+
+TEST( Scheduler, FairQueuing )
+{
+    using namespace task;
+    
+    static const int iTasks = 20;
+    int batch = 0, interactive = 0;
+    
+    std::mutex mutex;
+    std::string strOrder;
+    Task::PtrVector batchTasks, interactiveTasks;
+    for( int i = 0; i != iTasks; ++i )
+    {
+        batchTasks.push_back( Task::Ptr( new OrderTask( 'b', mutex, strOrder ) ) );
+        interactiveTasks.push_back( Task::Ptr( new OrderTask( 'i', mutex, strOrder ) ) );
+    }
+    
+    StatusFIFO fifo;
+    Scheduler scheduler( fifo, getKeepAliveTime(), 1U );
+    scheduler.setOwnerWeight( &interactive, 4.0 );
+    
+    // occupy the only worker until both owners have their backlog queued
+    int gateOwner = 0;
+    std::promise< void > gate;
+    Scheduler::Run::Ptr pGateRun = scheduler.run( &gateOwner,
+        Schedule::Ptr( new Schedule( Task::PtrVector{ Task::Ptr( new GateTask( gate.get_future().share() ) ) } ) ) );
+    Scheduler::Run::Ptr pBatchRun = scheduler.run( &batch, Schedule::Ptr( new Schedule( batchTasks ) ) );
+    Scheduler::Run::Ptr pInteractiveRun = scheduler.run( &interactive, Schedule::Ptr( new Schedule( interactiveTasks ) ) );
+    gate.set_value();
+    ASSERT_TRUE( pGateRun->wait() );
+    ASSERT_TRUE( pBatchRun->wait() );
+    ASSERT_TRUE( pInteractiveRun->wait() );
+    
+    // the interactive owner gets four tasks to each batch task while both have a backlog
+    ASSERT_EQ( strOrder.size(), 2U * iTasks );
+    ASSERT_LT( strOrder.rfind( 'i' ), 30U ) << strOrder;
+}
+
+namespace
+{
+    // spawns a task per item it discovers and each of those spawns again until the depth is reached
+    class DiscoveryTask : public task::Task
+    {
+        int m_iDepth;
+        std::atomic< int >& m_generated;
+        bool m_bFail;
+    public:
+        DiscoveryTask( int iDepth, std::atomic< int >& generated, bool bFail, const task::Task::RawPtrSet& dependencies = {} )
+            :   Task( dependencies ),
+                m_iDepth( iDepth ),
+                m_generated( generated ),
+                m_bFail( bFail )
+        {
+        }
+        
+        virtual void run( task::Progress& progress )
+        {
+            progress.start( "discovery", std::string(), std::string() );
+            if( m_iDepth == 0 )
+            {
+                ++m_generated;
+                VERIFY_RTE_MSG( !m_bFail, "Generation failed" );
+            }
+            else
+            {
+                Task::Ptr pFirst( new DiscoveryTask( m_iDepth - 1, m_generated, m_bFail ) );
+                Task::Ptr pSecond( new DiscoveryTask( m_iDepth - 1, m_generated, false, { pFirst.get() } ) );
+                progress.spawn( Task::PtrVector{ pFirst, pSecond } );
+            }
+            progress.succeeded();
+        }
+    };
+    
+    class CheckTask : public task::Task
+    {
+        std::atomic< int >& m_generated;
+        int m_iExpected;
+    public:
+        CheckTask( std::atomic< int >& generated, int iExpected, const task::Task::RawPtrSet& dependencies )
+            :   Task( dependencies ),
+                m_generated( generated ),
+                m_iExpected( iExpected )
+        {
+        }
+        
+        virtual void run( task::Progress& progress )
+        {
+            progress.start( "check", std::string(), std::string() );
+            VERIFY_RTE_MSG( m_generated == m_iExpected, "Successor ran before spawned tasks: " << m_generated );
+            progress.succeeded();
+        }
+    };
+}
+
+namespace
+{
+    // spawns a task needing the same resources as itself
+    class SpawningResourceTask : public ResourceTask
+    {
+        task::Task::Resources m_resources;
+        std::atomic< int >& m_active;
+        std::atomic< int >& m_maxActive;
+    public:
+        SpawningResourceTask( const task::Task::Resources& resources, std::atomic< int >& active, std::atomic< int >& maxActive )
+            :   ResourceTask( resources, active, maxActive ),
+                m_resources( resources ),
+                m_active( active ),
+                m_maxActive( maxActive )
+        {
+        }
+        
+        virtual void run( task::Progress& progress )
+        {
+            ResourceTask::run( progress );
+            progress.spawn( Task::PtrVector{ Task::Ptr( new ResourceTask( m_resources, m_active, m_maxActive ) ) } );
+        }
+    };
+}
+
+TEST( Scheduler, SpawnResources )
+{
+    using namespace task;
+    
+    Task::Resources budget, heavy;
+    budget.m_memoryMB = 1000U;
+    heavy.m_memoryMB = 600U;
+    
+    // the parent's admission is released once it returns so its child can be admitted
+    std::atomic< int > active( 0 ), maxActive( 0 );
+    Task::Ptr pParent( new SpawningResourceTask( heavy, active, maxActive ) );
+    
+    StatusFIFO fifo;
+    Scheduler scheduler( fifo, getKeepAliveTime(), 4U );
+    scheduler.setResourceBudget( budget );
+    Scheduler::Run::Ptr pRun = scheduler.run( nullptr, Schedule::Ptr( new Schedule( Task::PtrVector{ pParent } ) ) );
+    std::promise< void > finished;
+    pRun->onFinished( [ &finished ]() { finished.set_value(); } );
+    ASSERT_EQ( finished.get_future().wait_for( std::chrono::seconds( 10 ) ), std::future_status::ready );
+    ASSERT_TRUE( pRun->wait() );
+    ASSERT_EQ( maxActive, 1 );
+}
+
+TEST( Scheduler, Spawn )
+{
+    using namespace task;
+    
+    for( Scheduler::Executor executor : { Scheduler::Executor::eAsio, Scheduler::Executor::eWorkStealing } )
+    {
+        StatusFIFO fifo;
+        Scheduler scheduler( fifo, getKeepAliveTime(), std::optional< unsigned int >(), executor );
+        
+        // the successor waits for everything spawned beneath the task it depends on
+        std::atomic< int > generated( 0 );
+        Task::Ptr pDiscovery( new DiscoveryTask( 5, generated, false ) );
+        Task::Ptr pCheck( new CheckTask( generated, 32, { pDiscovery.get() } ) );
+        ASSERT_TRUE( scheduler.run( nullptr, Schedule::Ptr( new Schedule( Task::PtrVector{ pDiscovery, pCheck } ) ) )->wait() );
+        ASSERT_EQ( generated, 32 );
+        
+        // and a spawned failure fails the run
+        Task::Ptr pFailing( new DiscoveryTask( 3, generated, true ) );
+        ASSERT_THROW( scheduler.run( nullptr, Schedule::Ptr( new Schedule( Task::PtrVector{ pFailing } ) ) )->wait(),
+                      std::runtime_error );
+    }
+    
+    // spawned runs share the trace and are told apart by their run
+    {
+        StatusFIFO fifo;
+        Scheduler scheduler( fifo, getKeepAliveTime() );
+        scheduler.setTracing( true );
+        std::atomic< int > generated( 0 );
+        Task::Ptr pDiscovery( new DiscoveryTask( 3, generated, false ) );
+        Scheduler::Run::Ptr pRun = scheduler.run( nullptr, Schedule::Ptr( new Schedule( Task::PtrVector{ pDiscovery } ) ) );
+        ASSERT_TRUE( pRun->wait() );
+        
+        const std::vector< TaskTrace::Event > events = pRun->getTrace()->getEvents();
+        ASSERT_EQ( events.size(), 15U );
+        std::set< std::pair< std::uint32_t, std::size_t > > tasks;
+        for( const TaskTrace::Event& event : events )
+        {
+            ASSERT_TRUE( tasks.insert( { event.m_run, event.m_szTask } ).second );
+        }
+    }
+    
+    // outside a scheduler there is nowhere to spawn to
+    std::atomic< int > generated( 0 );
+    StatusFIFO fifo;
+    Progress progress( fifo, nullptr );
+    ASSERT_THROW( DiscoveryTask( 1, generated, false ).run( progress ), std::runtime_error );
+}
+
+#ifdef __cpp_impl_coroutine
+
+namespace
+{
+    class SleepTask : public task::AsyncTask
+    {
+        std::string m_strFile;
+    public:
+        SleepTask( const std::string& strFile, const task::Task::RawPtrSet& dependencies )
+            :   AsyncTask( dependencies ),
+                m_strFile( strFile )
+        {
+        }
+        
+        virtual Coroutine runAsync( task::Progress& progress )
+        {
+            progress.start( "sleep", m_strFile, m_strFile );
+            
+            const common::Command sleep{ "sleep 0.3", {} }, echo{ "echo " + m_strFile, {} };
+            const common::CommandResult sleepResult = co_await task::awaitCmd( sleep );
+            VERIFY_RTE( sleepResult.m_exitCode == EXIT_SUCCESS );
+            
+            const common::CommandResult echoResult = co_await task::awaitCmd( echo );
+            boost::filesystem::updateFileIfChanged( m_strFile, echoResult.m_strOutput );
+            
+            const std::string strContents = co_await task::awaitFile( m_strFile );
+            VERIFY_RTE_MSG( strContents == m_strFile + "\n", "Unexpected file contents: " << strContents );
+            
+            task::Schedule::Ptr pSchedule( new task::Schedule( createGoodSchedule() ) );
+            VERIFY_RTE( co_await task::awaitSchedule( pSchedule ) );
+            
+            progress.succeeded();
+        }
+    };
+}
+
+TEST( Scheduler, AsyncTask )
+{
+    using namespace task;
+    
+    const boost::filesystem::path tempDir = boost::filesystem::temp_directory_path() / "common_tests" / "async";
+    boost::filesystem::remove_all( tempDir );
+    boost::filesystem::create_directories( tempDir );
+    
+    Task::PtrVector tasks;
+    for( int i = 0; i != 4; ++i )
+    {
+        tasks.push_back( Task::Ptr( new SleepTask( ( tempDir / ( std::to_string( i ) + ".txt" ) ).string(), {} ) ) );
+    }
+    Schedule::Ptr pSchedule( new Schedule( tasks ) );
+    
+    // the waits overlap on a single worker
+    StatusFIFO fifo;
+    Scheduler scheduler( fifo, getKeepAliveTime(), 1U );
+    const auto startTime = std::chrono::steady_clock::now();
+    ASSERT_TRUE( scheduler.run( nullptr, pSchedule )->wait() );
+    ASSERT_LT( std::chrono::steady_clock::now() - startTime, std::chrono::milliseconds( 1000 ) );
+    
+    // and the coroutine runs through outside of a scheduler
+    Progress progress( fifo, nullptr );
+    tasks.front()->run( progress );
+    ASSERT_TRUE( progress.isFinished() );
+}
+
+namespace
+{
+    // awaits a schedule of a task needing the same resources as itself
+    class AwaitingResourceTask : public task::AsyncTask
+    {
+        task::Task::Resources m_resources;
+        std::atomic< int >& m_active;
+        std::atomic< int >& m_maxActive;
+    public:
+        AwaitingResourceTask( const task::Task::Resources& resources, std::atomic< int >& active, std::atomic< int >& maxActive )
+            :   AsyncTask( {} ),
+                m_resources( resources ),
+                m_active( active ),
+                m_maxActive( maxActive )
+        {
+        }
+        
+        virtual task::Task::Resources getResources() const { return m_resources; }
+        
+        virtual Coroutine runAsync( task::Progress& progress )
+        {
+            progress.start( "awaiting", std::string(), std::string() );
+            task::Schedule::Ptr pSchedule( new task::Schedule(
+                Task::PtrVector{ Task::Ptr( new ResourceTask( m_resources, m_active, m_maxActive ) ) } ) );
+            VERIFY_RTE( co_await task::awaitSchedule( pSchedule ) );
+            progress.succeeded();
+        }
+    };
+}
+
+TEST( Scheduler, AsyncTaskChildRun )
+{
+    using namespace task;
+    
+    Task::Resources budget, heavy;
+    budget.m_memoryMB = 1000U;
+    heavy.m_memoryMB = 600U;
+    
+    std::atomic< int > active( 0 ), maxActive( 0 );
+    Task::Ptr pTask( new AwaitingResourceTask( heavy, active, maxActive ) );
+    
+    StatusFIFO fifo;
+    Scheduler scheduler( fifo, getKeepAliveTime(), 2U );
+    scheduler.setResourceBudget( budget );
+    scheduler.setTracing( true );
+    int owner = 0;
+    Scheduler::Run::Ptr pRun = scheduler.run( &owner, Schedule::Ptr( new Schedule( Task::PtrVector{ pTask } ) ) );
+    
+    // the awaiting task's admission is released while it waits for the awaited schedule
+    std::promise< void > finished;
+    pRun->onFinished( [ &finished ]() { finished.set_value(); } );
+    ASSERT_EQ( finished.get_future().wait_for( std::chrono::seconds( 10 ) ), std::future_status::ready );
+    ASSERT_TRUE( pRun->wait() );
+    
+    // which ran as a child run of the task's run with its owner and trace
+    const std::vector< TaskTrace::Event > events = pRun->getTrace()->getEvents();
+    ASSERT_EQ( events.size(), 2U );
+    ASSERT_NE( events.front().m_run, events.back().m_run );
+    std::size_t szStatuses = 0U;
+    while( !fifo.empty() )
+    {
+        ASSERT_EQ( fifo.pop().m_owner, &owner );
+        ++szStatuses;
+    }
+    ASSERT_EQ( szStatuses, 2U );
+}
+
+#endif
@@ -2,9 +2,16 @@
 
 #include "common/hash.hpp"
 #include "common/stash.hpp"
+#include "common/content_hash.hpp"
+#include "common/hash_memo.hpp"
+#include "common/file.hpp"
+#include "common/stash_daemon.hpp"
 
 #include <gtest/gtest.h>
 
+#include <fstream>
+#include <thread>
+
 static const std::size_t szTestValue1 = 123;
 static const std::size_t szTestValue2 = 124;
 
@@ -140,4 +147,649 @@ TEST( Stash, Basic6 )
     h1 ^= 0.123f;
     h1 ^= std::vector{ 1,2,3,4,5 };
     h1 ^= std::vector{ 'a','n','r' };
-}
\ No newline at end of file
+}
+TEST( Stash, ContentHashChunking )
+{
+    std::string strData;
+    for( std::size_t sz = 0U; sz != 5000U; ++sz )
+    {
+        strData.push_back( static_cast< char >( ( sz * 131U ) ^ ( sz >> 3 ) ) );
+    }
+
+    const common::HashCode128 expected = common::ContentHash::hash( strData.data(), strData.size() );
+
+    for( std::size_t szChunk : { 1U, 7U, 63U, 64U, 65U, 1023U, 1024U, 1025U, 4999U } )
+    {
+        common::ContentHash contentHash;
+        for( std::size_t szPos = 0U; szPos < strData.size(); szPos += szChunk )
+        {
+            contentHash.update( strData.data() + szPos, std::min( szChunk, strData.size() - szPos ) );
+        }
+        ASSERT_EQ( contentHash.digest(), expected ) << "chunk size: " << szChunk;
+    }
+
+    // zero padding of the final stripe must not alias
+    const std::string strShort( "abc" );
+    const std::string strPadded( "abc\0", 4 );
+    ASSERT_NE( common::ContentHash::hash( strShort.data(), strShort.size() ),
+               common::ContentHash::hash( strPadded.data(), strPadded.size() ) );
+    ASSERT_NE( common::ContentHash::hash( nullptr, 0U ), common::ContentHash::hash( strShort.data(), 1U ) );
+}
+
+TEST( Stash, ContentHashStable )
+{
+    // the content hash is persisted so these values must never change
+    const std::string strData = "The quick brown fox jumps over the lazy dog";
+    ASSERT_EQ( common::ContentHash::hash( nullptr, 0U ).toHexString(), "180f178c9a27430123459d5f2878591d" );
+    ASSERT_EQ( common::ContentHash::hash( strData.data(), strData.size() ).toHexString(),
+               "418a23bddb7ecdcfeb61ecb0bd92510b" );
+}
+
+TEST( Stash, FileHashDigest )
+{
+    const boost::filesystem::path tempDir  = boost::filesystem::temp_directory_path() / "common_tests";
+    const boost::filesystem::path tempFile = tempDir / "content_hash_test.txt";
+    boost::filesystem::ensureFoldersExist( tempFile );
+
+    const std::string strData( 3U * common::ContentHash::BLOCK_SIZE + 17U, 'x' );
+    boost::filesystem::updateFileIfChanged( tempFile, strData );
+
+    const task::FileHash fileHash( tempFile );
+    ASSERT_EQ( fileHash.getDigest(), common::ContentHash::hash( strData.data(), strData.size() ) );
+    ASSERT_EQ( fileHash.get(), common::Hash( tempFile ).get() );
+
+    task::DeterminantHash determinant( fileHash );
+    ASSERT_EQ( determinant.getDigest(), fileHash.getDigest() );
+    determinant ^= std::string( "test" );
+    ASSERT_NE( determinant.getDigest(), fileHash.getDigest() );
+
+    // every file in a determinant keeps its full width
+    const task::DeterminantHash combined( fileHash, std::string( "test" ) );
+    ASSERT_EQ( combined.get(), common::Hash( fileHash, std::string( "test" ) ).get() );
+    ASSERT_EQ( combined.getDigest(),
+               common::ContentHash::combine(
+                   fileHash.getDigest(), common::ContentHash::widen( common::Hash( std::string( "test" ) ).get() ) ) );
+    ASSERT_NE( combined.getDigest(), common::ContentHash::widen( combined.get() ) );
+}
+
+TEST( Stash, HashAll )
+{
+    const boost::filesystem::path tempDir = boost::filesystem::temp_directory_path() / "common_tests" / "hash_all";
+    boost::filesystem::remove_all( tempDir );
+
+    std::vector< boost::filesystem::path > files;
+    for( int i = 0; i != 64; ++i )
+    {
+        const boost::filesystem::path file = tempDir / ( "file_" + std::to_string( i ) + ".txt" );
+        boost::filesystem::ensureFoldersExist( file );
+        boost::filesystem::updateFileIfChanged(
+            file, std::string( i * 97, static_cast< char >( 'a' + i % 26 ) ) + "\n" );
+        files.push_back( file );
+    }
+
+    task::BuildHashCodes buildHashCodes;
+    buildHashCodes.hashAll( files, 4U );
+
+    ASSERT_EQ( buildHashCodes.get().size(), files.size() );
+    for( const boost::filesystem::path& file : files )
+    {
+        ASSERT_EQ( buildHashCodes.get( file ), task::FileHash( file ) );
+        ASSERT_EQ( buildHashCodes.get( file ).getDigest(), task::FileHash( file ).getDigest() );
+    }
+
+    task::BuildHashCodes missing;
+    ASSERT_THROW( missing.hashAll( { tempDir / "missing.txt" }, 2U ), std::runtime_error );
+}
+
+TEST( Stash, HashMemo )
+{
+    const boost::filesystem::path tempDir  = boost::filesystem::temp_directory_path() / "common_tests" / "hash_memo";
+    const boost::filesystem::path tempFile = tempDir / "memo_test.txt";
+    const boost::filesystem::path memoFile = tempDir / "hash_memo.bin";
+    boost::filesystem::remove_all( tempDir );
+    boost::filesystem::ensureFoldersExist( tempFile );
+
+    boost::filesystem::updateFileIfChanged( tempFile, "memo test contents" );
+    // files modified within the racy window are never memoised
+    boost::filesystem::last_write_time( tempFile, std::time( nullptr ) - 3600 );
+
+    boost::filesystem::FileStat fileStat;
+    ASSERT_TRUE( boost::filesystem::getFileStat( tempFile, fileStat ) );
+
+    const common::HashCode128 digest = task::FileHash( tempFile ).getDigest();
+    {
+        common::FileHashMemo memo;
+        memo.insert( tempFile, fileStat, digest );
+        ASSERT_EQ( memo.find( tempFile, fileStat ), digest );
+        memo.save( memoFile );
+    }
+    {
+        common::FileHashMemo memo;
+        memo.load( memoFile );
+        ASSERT_EQ( memo.size(), 1U );
+        ASSERT_EQ( memo.find( tempFile, fileStat ), digest );
+
+        // any change to the stat tuple misses
+        boost::filesystem::FileStat changed = fileStat;
+        ++changed.m_size;
+        ASSERT_FALSE( memo.find( tempFile, changed ).has_value() );
+        changed = fileStat;
+        ++changed.m_modifiedNanoSeconds;
+        ASSERT_FALSE( memo.find( tempFile, changed ).has_value() );
+    }
+    {
+        // truncated or corrupt memos are discarded
+        std::ifstream     memoStream( memoFile.string(), std::ios::binary );
+        const std::string strMemo( ( std::istreambuf_iterator< char >( memoStream ) ), std::istreambuf_iterator< char >() );
+        const boost::filesystem::path corruptFile = tempDir / "corrupt_memo.bin";
+        boost::filesystem::updateFileIfChanged( corruptFile, strMemo.substr( 0U, strMemo.size() - 16U ) );
+        common::FileHashMemo memo;
+        ASSERT_NO_THROW( memo.load( corruptFile ) );
+        ASSERT_EQ( memo.size(), 0U );
+
+        std::string strHugeCount = strMemo.substr( 0U, 24U );
+        std::fill( strHugeCount.begin() + 16, strHugeCount.end(), '\x7f' );
+        boost::filesystem::updateFileIfChanged( corruptFile, strHugeCount );
+        ASSERT_NO_THROW( memo.load( corruptFile ) );
+        ASSERT_EQ( memo.size(), 0U );
+    }
+
+    // the process wide memo is consulted by FileHash
+    boost::filesystem::updateFileIfChanged( tempFile, "memo test contents changed" );
+    boost::filesystem::last_write_time( tempFile, std::time( nullptr ) - 3600 );
+    ASSERT_NE( task::FileHash( tempFile ).getDigest(), digest );
+}
+
+TEST( Stash, Manifest )
+{
+    const boost::filesystem::path tempDir  = boost::filesystem::temp_directory_path() / "common_tests" / "stash_manifest";
+    const boost::filesystem::path stashDir = tempDir / "stash";
+    boost::filesystem::remove_all( tempDir );
+
+    // enough entries to force the appended records to be compacted
+    static const std::size_t szFiles = 1100U;
+
+    std::vector< boost::filesystem::path > files;
+    for( std::size_t sz = 0U; sz != szFiles; ++sz )
+    {
+        std::ostringstream os;
+        os << "file_" << sz << ".txt";
+        files.push_back( tempDir / "output" / os.str() );
+        boost::filesystem::ensureFoldersExist( files.back() );
+        boost::filesystem::updateFileIfChanged( files.back(), os.str() );
+    }
+
+    {
+        task::Stash stash( stashDir );
+        for( std::size_t sz = 0U; sz != szFiles; ++sz )
+        {
+            stash.stash( files[ sz ], task::DeterminantHash( sz ) );
+        }
+        ASSERT_TRUE( stash.restore( files[ 0 ], task::DeterminantHash( std::size_t( 0U ) ) ) );
+        ASSERT_FALSE( stash.restore( files[ 0 ], task::DeterminantHash( std::size_t( 1U ) ) ) );
+    }
+
+    for( const boost::filesystem::path& file : files )
+    {
+        boost::filesystem::remove( file );
+    }
+
+    {
+        // reopening reads the same entries back from the manifest file
+        task::Stash stash( stashDir );
+        for( std::size_t sz = 0U; sz != szFiles; ++sz )
+        {
+            ASSERT_TRUE( stash.restore( files[ sz ], task::DeterminantHash( sz ) ) );
+            std::ostringstream os;
+            os << "file_" << sz << ".txt";
+            std::string strContents;
+            boost::filesystem::loadAsciiFile( files[ sz ], strContents, false );
+            ASSERT_EQ( strContents, os.str() );
+        }
+        ASSERT_FALSE( stash.restore( tempDir / "output" / "missing.txt", task::DeterminantHash( std::size_t( 0U ) ) ) );
+
+        stash.clear();
+        ASSERT_FALSE( stash.restore( files[ 0 ], task::DeterminantHash( std::size_t( 0U ) ) ) );
+    }
+}
+
+TEST( Stash, ContentAddressed )
+{
+    const boost::filesystem::path tempDir  = boost::filesystem::temp_directory_path() / "common_tests" / "stash_objects";
+    const boost::filesystem::path stashDir = tempDir / "stash";
+    const boost::filesystem::path fileOne  = tempDir / "output" / "one.txt";
+    const boost::filesystem::path fileTwo  = tempDir / "output" / "two.txt";
+    boost::filesystem::remove_all( tempDir );
+    boost::filesystem::ensureFoldersExist( fileOne );
+    boost::filesystem::updateFileIfChanged( fileOne, "identical contents" );
+    boost::filesystem::updateFileIfChanged( fileTwo, "identical contents" );
+
+    auto countObjects = [ &stashDir ]()
+    {
+        std::size_t szCount = 0U;
+        for( boost::filesystem::recursive_directory_iterator i( stashDir / "objects" ), iEnd; i != iEnd; ++i )
+        {
+            if( boost::filesystem::is_regular_file( i->path() ) )
+                ++szCount;
+        }
+        return szCount;
+    };
+
+    for( task::Stash::RestoreMode restoreMode :
+         { task::Stash::RestoreMode::eCopy, task::Stash::RestoreMode::eClone, task::Stash::RestoreMode::eLink } )
+    {
+        task::Stash stash( stashDir, restoreMode );
+        stash.clear();
+        boost::filesystem::last_write_time( fileOne, std::time( nullptr ) - 3600 );
+
+        // identical contents are stored once
+        stash.stash( fileOne, task::DeterminantHash( szTestValue1 ) );
+        stash.stash( fileTwo, task::DeterminantHash( szTestValue2 ) );
+        stash.stash( fileOne, task::DeterminantHash( szTestValue2 ) );
+        ASSERT_EQ( countObjects(), 1U );
+        std::time_t objectTime = 0;
+        for( boost::filesystem::recursive_directory_iterator i( stashDir / "objects" ), iEnd; i != iEnd; ++i )
+        {
+            if( boost::filesystem::is_regular_file( i->path() ) )
+                objectTime = boost::filesystem::last_write_time( i->path() );
+        }
+
+        boost::filesystem::remove( fileOne );
+        boost::filesystem::remove( fileTwo );
+        ASSERT_TRUE( stash.restore( fileOne, task::DeterminantHash( szTestValue1 ) ) );
+        if( boost::filesystem::hard_link_count( fileOne ) > 1U )
+        {
+            // restoring through a hard link leaves the shared object's stash time alone
+            ASSERT_EQ( boost::filesystem::last_write_time( fileOne ), objectTime );
+        }
+        ASSERT_TRUE( stash.restore( fileTwo, task::DeterminantHash( szTestValue2 ) ) );
+
+        std::string strContents;
+        boost::filesystem::loadAsciiFile( fileTwo, strContents, false );
+        ASSERT_EQ( strContents, "identical contents" );
+
+        if( restoreMode == task::Stash::RestoreMode::eCopy )
+        {
+            ASSERT_EQ( boost::filesystem::hard_link_count( fileOne ), 1U );
+            ASSERT_TRUE( ( boost::filesystem::status( fileOne ).permissions() & boost::filesystem::owner_write ) != 0 );
+        }
+    }
+}
+
+TEST( Stash, OrphanedTemporaries )
+{
+    const boost::filesystem::path tempDir  = boost::filesystem::temp_directory_path() / "common_tests" / "stash_orphans";
+    const boost::filesystem::path stashDir = tempDir / "stash";
+    const boost::filesystem::path file     = tempDir / "output" / "file.txt";
+    const boost::filesystem::path orphan   = stashDir / "objects" / "tmp" / "orphan.tmp";
+    const boost::filesystem::path inFlight = stashDir / "objects" / "tmp" / "in_flight.tmp";
+    boost::filesystem::remove_all( tempDir );
+    boost::filesystem::ensureFoldersExist( file );
+    boost::filesystem::updateFileIfChanged( file, "contents" );
+
+    // temporaries left by a crash are swept on open but those still being written are not
+    boost::filesystem::ensureFoldersExist( orphan );
+    boost::filesystem::updateFileIfChanged( orphan, "partial" );
+    boost::filesystem::updateFileIfChanged( inFlight, "partial" );
+    boost::filesystem::last_write_time( orphan, std::time( nullptr ) - 24 * 3600 );
+
+    task::Stash stash( stashDir );
+    ASSERT_FALSE( boost::filesystem::exists( orphan ) );
+    ASSERT_TRUE( boost::filesystem::exists( inFlight ) );
+
+    // stashing never leaves temporaries among the objects
+    stash.stash( file, task::DeterminantHash( szTestValue1 ) );
+    std::size_t szObjects = 0U;
+    for( boost::filesystem::directory_iterator iFanOut( stashDir / "objects" ), iFanOutEnd; iFanOut != iFanOutEnd;
+         ++iFanOut )
+    {
+        if( iFanOut->path().filename() == "tmp" )
+            continue;
+        for( boost::filesystem::directory_iterator i( iFanOut->path() ), iEnd; i != iEnd; ++i )
+        {
+            ASSERT_NE( i->path().extension(), ".tmp" );
+            ++szObjects;
+        }
+    }
+    ASSERT_EQ( szObjects, 1U );
+    ASSERT_TRUE( stash.restore( file, task::DeterminantHash( szTestValue1 ) ) );
+}
+
+TEST( Stash, Compressed )
+{
+    const boost::filesystem::path tempDir  = boost::filesystem::temp_directory_path() / "common_tests" / "stash_compressed";
+    const boost::filesystem::path stashDir = tempDir / "stash";
+    const boost::filesystem::path textFile = tempDir / "output" / "text.txt";
+    const boost::filesystem::path randFile = tempDir / "output" / "random.bin";
+    boost::filesystem::remove_all( tempDir );
+    boost::filesystem::ensureFoldersExist( textFile );
+
+    std::string strText;
+    for( std::size_t sz = 0U; sz != 5000U; ++sz )
+    {
+        strText += "line " + std::to_string( sz % 100U ) + " of some compressible text\n";
+    }
+    std::string strRandom( 10000U, '\0' );
+    std::uint64_t state = 12345U;
+    for( char& c : strRandom )
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        c     = static_cast< char >( state >> 56U );
+    }
+    boost::filesystem::updateFileIfChanged( textFile, strText );
+    boost::filesystem::updateFileIfChanged( randFile, strRandom );
+
+    auto findObjects = [ &stashDir ]( const std::string& strExtension )
+    {
+        std::vector< boost::filesystem::path > objects;
+        for( boost::filesystem::recursive_directory_iterator i( stashDir / "objects" ), iEnd; i != iEnd; ++i )
+        {
+            if( boost::filesystem::is_regular_file( i->path() ) && i->path().extension() == strExtension )
+                objects.push_back( i->path() );
+        }
+        return objects;
+    };
+    auto readLevel = []( const boost::filesystem::path& objectFile )
+    {
+        std::string strObject;
+        boost::filesystem::loadAsciiFile( objectFile, strObject, false );
+        return static_cast< int >( static_cast< unsigned char >( strObject.at( 8U ) ) );
+    };
+    auto checkRestore = [ & ]( task::Stash& stash )
+    {
+        boost::filesystem::remove( textFile );
+        boost::filesystem::remove( randFile );
+        ASSERT_TRUE( stash.restore( textFile, task::DeterminantHash( szTestValue1 ) ) );
+        ASSERT_TRUE( stash.restore( randFile, task::DeterminantHash( szTestValue2 ) ) );
+        std::string strContents;
+        boost::filesystem::loadAsciiFile( textFile, strContents, false );
+        ASSERT_EQ( strContents, strText );
+        boost::filesystem::loadAsciiFile( randFile, strContents, false );
+        ASSERT_EQ( strContents, strRandom );
+    };
+
+    {
+        task::Stash stash( stashDir, task::Stash::RestoreMode::eLink, task::Stash::Compression::eAdaptive );
+        stash.stash( textFile, task::DeterminantHash( szTestValue1 ) );
+        stash.stash( randFile, task::DeterminantHash( szTestValue2 ) );
+
+        // incompressible contents are stored raw
+        const std::vector< boost::filesystem::path > compressed = findObjects( ".z" );
+        ASSERT_EQ( compressed.size(), 1U );
+        ASSERT_EQ( findObjects( "" ).size(), 1U );
+        ASSERT_LT( boost::filesystem::file_size( compressed.front() ), strText.size() / 4U );
+        ASSERT_EQ( readLevel( compressed.front() ), 1 );
+
+        checkRestore( stash );
+        ASSERT_EQ( boost::filesystem::hard_link_count( textFile ), 1U );
+    }
+
+    // objects with no recorded access are aged by when they were stashed
+    boost::filesystem::remove( stashDir / "stash_access.bin" );
+    const boost::filesystem::path compressedObject = findObjects( ".z" ).front();
+    boost::filesystem::last_write_time( compressedObject, std::time( nullptr ) - 2 * 24 * 60 * 60 );
+    {
+        task::Stash stash( stashDir, task::Stash::RestoreMode::eClone, task::Stash::Compression::eAdaptive );
+        stash.evict();
+        ASSERT_EQ( readLevel( compressedObject ), 9 );
+        checkRestore( stash );
+    }
+
+    // compressed objects are restored whatever the compression setting
+    {
+        task::Stash stash( stashDir );
+        checkRestore( stash );
+    }
+}
+
+TEST( Stash, Journal )
+{
+    const boost::filesystem::path tempDir  = boost::filesystem::temp_directory_path() / "common_tests" / "stash_journal";
+    const boost::filesystem::path stashDir = tempDir / "stash";
+    boost::filesystem::remove_all( tempDir );
+
+    static const std::size_t szThreads        = 8U;
+    static const std::size_t szFilesPerThread = 40U;
+
+    auto getFile = [ &tempDir ]( std::size_t szIndex )
+    {
+        std::ostringstream os;
+        os << "file_" << szIndex << ".txt";
+        return tempDir / "output" / os.str();
+    };
+    for( std::size_t sz = 0U; sz != szThreads * szFilesPerThread; ++sz )
+    {
+        boost::filesystem::ensureFoldersExist( getFile( sz ) );
+        boost::filesystem::updateFileIfChanged( getFile( sz ), getFile( sz ).string() );
+    }
+
+    {
+        // concurrent stashes are group committed to the journal
+        task::Stash              stash( stashDir );
+        std::vector< std::thread > threads;
+        for( std::size_t szThread = 0U; szThread != szThreads; ++szThread )
+        {
+            threads.emplace_back(
+                [ &, szThread ]()
+                {
+                    for( std::size_t sz = szThread * szFilesPerThread; sz != ( szThread + 1U ) * szFilesPerThread; ++sz )
+                    {
+                        stash.stash( getFile( sz ), task::DeterminantHash( sz ) );
+                    }
+                } );
+        }
+        for( std::thread& thread : threads )
+        {
+            thread.join();
+        }
+    }
+
+    // simulate a crash part way through appending a record
+    {
+        std::ofstream journal( ( stashDir / "stash_manifest.bin.journal" ).native().c_str(),
+                               std::ios_base::app | std::ios_base::binary );
+        journal << "torn record";
+    }
+
+    {
+        task::Stash stash( stashDir );
+        for( std::size_t sz = 0U; sz != szThreads * szFilesPerThread; ++sz )
+        {
+            boost::filesystem::remove( getFile( sz ) );
+            ASSERT_TRUE( stash.restore( getFile( sz ), task::DeterminantHash( sz ) ) );
+        }
+        // the journal remains usable after the torn tail is discarded
+        stash.stash( getFile( 0U ), task::DeterminantHash( szTestValue1 ) );
+    }
+    {
+        task::Stash stash( stashDir );
+        ASSERT_TRUE( stash.restore( getFile( 0U ), task::DeterminantHash( szTestValue1 ) ) );
+    }
+}
+
+TEST( Stash, Eviction )
+{
+    const boost::filesystem::path tempDir  = boost::filesystem::temp_directory_path() / "common_tests" / "stash_eviction";
+    const boost::filesystem::path stashDir = tempDir / "stash";
+    boost::filesystem::remove_all( tempDir );
+
+    static const std::size_t szFiles    = 10U;
+    static const std::size_t szFileSize = 1000U;
+
+    std::vector< boost::filesystem::path > files;
+    for( std::size_t sz = 0U; sz != szFiles; ++sz )
+    {
+        std::ostringstream os;
+        os << "file_" << sz << ".txt";
+        files.push_back( tempDir / "output" / os.str() );
+        boost::filesystem::ensureFoldersExist( files.back() );
+        boost::filesystem::updateFileIfChanged( files.back(), os.str() + std::string( szFileSize - os.str().size(), '.' ) );
+    }
+
+    task::Stash stash( stashDir );
+    for( std::size_t sz = 0U; sz != szFiles; ++sz )
+    {
+        stash.stash( files[ sz ], task::DeterminantHash( sz ) );
+    }
+    // the first three are now the most recently used
+    for( std::size_t sz = 0U; sz != 3U; ++sz )
+    {
+        ASSERT_TRUE( stash.restore( files[ sz ], task::DeterminantHash( sz ) ) );
+    }
+
+    // evicts down to 90% of the budget
+    stash.setBudget( szFileSize * 5U );
+    stash.evict();
+
+    for( std::size_t sz = 0U; sz != szFiles; ++sz )
+    {
+        const bool bExpected = ( sz < 3U ) || ( sz == szFiles - 1U );
+        ASSERT_EQ( stash.restore( files[ sz ], task::DeterminantHash( sz ) ), bExpected ) << "File: " << sz;
+    }
+}
+
+TEST( Stash, SharedAccess )
+{
+    const boost::filesystem::path tempDir  = boost::filesystem::temp_directory_path() / "common_tests" / "stash_access";
+    const boost::filesystem::path stashDir = tempDir / "stash";
+    boost::filesystem::remove_all( tempDir );
+
+    static const std::size_t szFiles    = 10U;
+    static const std::size_t szFileSize = 1000U;
+
+    std::vector< boost::filesystem::path > files;
+    for( std::size_t sz = 0U; sz != szFiles; ++sz )
+    {
+        std::ostringstream os;
+        os << "file_" << sz << ".txt";
+        files.push_back( tempDir / "output" / os.str() );
+        boost::filesystem::ensureFoldersExist( files.back() );
+        boost::filesystem::updateFileIfChanged( files.back(), os.str() + std::string( szFileSize - os.str().size(), '.' ) );
+    }
+
+    task::Stash stash( stashDir );
+    for( std::size_t sz = 0U; sz != szFiles; ++sz )
+    {
+        stash.stash( files[ sz ], task::DeterminantHash( sz ) );
+    }
+    ASSERT_TRUE( stash.restore( files[ 5U ], task::DeterminantHash( std::size_t( 5U ) ) ) );
+    ASSERT_TRUE( stash.restore( files[ 6U ], task::DeterminantHash( std::size_t( 6U ) ) ) );
+
+    // the restores of another process on the directory count towards eviction
+    {
+        task::Stash other( stashDir );
+        for( std::size_t sz = 0U; sz != 3U; ++sz )
+        {
+            ASSERT_TRUE( other.restore( files[ sz ], task::DeterminantHash( sz ) ) );
+            ASSERT_TRUE( other.restore( files[ sz ], task::DeterminantHash( sz ) ) );
+        }
+    }
+
+    stash.setBudget( szFileSize * 5U, task::Stash::EvictionPolicy::eLFU );
+    stash.evict();
+
+    for( std::size_t sz : { 0U, 1U, 2U } )
+    {
+        ASSERT_TRUE( stash.restore( files[ sz ], task::DeterminantHash( std::size_t( sz ) ) ) ) << "File: " << sz;
+    }
+    for( std::size_t sz : { 3U, 4U, 7U, 8U, 9U } )
+    {
+        ASSERT_FALSE( stash.restore( files[ sz ], task::DeterminantHash( std::size_t( sz ) ) ) ) << "File: " << sz;
+    }
+}
+
+TEST( Stash, SharedDirectory )
+{
+    const boost::filesystem::path tempDir  = boost::filesystem::temp_directory_path() / "common_tests" / "stash_shared";
+    const boost::filesystem::path stashDir = tempDir / "stash";
+    boost::filesystem::remove_all( tempDir );
+
+    // enough entries between the two to force a compaction while both are in use
+    static const std::size_t szFilesPerStash = 600U;
+
+    auto getFile = [ &tempDir ]( std::size_t szIndex )
+    {
+        std::ostringstream os;
+        os << "file_" << szIndex << ".txt";
+        return tempDir / "output" / os.str();
+    };
+    for( std::size_t sz = 0U; sz != 2U * szFilesPerStash; ++sz )
+    {
+        boost::filesystem::ensureFoldersExist( getFile( sz ) );
+        boost::filesystem::updateFileIfChanged( getFile( sz ), getFile( sz ).string() );
+    }
+
+    // two stashes on one directory coordinate as separate processes would
+    task::Stash stashes[ 2 ] = { task::Stash( stashDir ), task::Stash( stashDir ) };
+
+    std::vector< std::thread > threads;
+    for( std::size_t szStash = 0U; szStash != 2U; ++szStash )
+    {
+        threads.emplace_back(
+            [ &, szStash ]()
+            {
+                for( std::size_t sz = szStash; sz < 2U * szFilesPerStash; sz += 2U )
+                {
+                    stashes[ szStash ].stash( getFile( sz ), task::DeterminantHash( sz ) );
+                }
+            } );
+    }
+    for( std::thread& thread : threads )
+    {
+        thread.join();
+    }
+
+    // each sees the entries written by the other
+    for( std::size_t sz = 0U; sz != 2U * szFilesPerStash; ++sz )
+    {
+        boost::filesystem::remove( getFile( sz ) );
+        ASSERT_TRUE( stashes[ ( sz + 1U ) % 2U ].restore( getFile( sz ), task::DeterminantHash( sz ) ) );
+    }
+}
+
+TEST( Stash, Daemon )
+{
+    const boost::filesystem::path tempDir    = boost::filesystem::temp_directory_path() / "common_tests" / "stash_daemon";
+    const boost::filesystem::path socketPath = tempDir / "stash.sock";
+    boost::filesystem::remove_all( tempDir );
+
+    // more than one request per batch so that requests are pipelined
+    static const std::size_t szFiles = task::StashDaemonClient::BATCH_SIZE * 2U + 10U;
+
+    task::StashKeys keys;
+    for( std::size_t sz = 0U; sz != szFiles; ++sz )
+    {
+        std::ostringstream os;
+        os << "file_" << sz << ".txt";
+        const boost::filesystem::path file = tempDir / "output" / os.str();
+        boost::filesystem::ensureFoldersExist( file );
+        boost::filesystem::updateFileIfChanged( file, os.str() );
+        keys.push_back( task::StashKey{ file, task::DeterminantHash( sz ).getDigest() } );
+    }
+
+    task::StashDaemon daemon( socketPath, tempDir / "stash" );
+    task::Stash       stash( std::make_shared< task::StashDaemonClient >( socketPath ) );
+
+    // only the owner may connect
+    ASSERT_EQ( boost::filesystem::status( socketPath ).permissions(),
+               boost::filesystem::owner_read | boost::filesystem::owner_write );
+
+    ASSERT_EQ( stash.has( keys ), std::vector< bool >( szFiles, false ) );
+    stash.stash( keys );
+    ASSERT_EQ( stash.has( keys ), std::vector< bool >( szFiles, true ) );
+
+    for( const task::StashKey& key : keys )
+    {
+        boost::filesystem::remove( key.m_file );
+    }
+    ASSERT_EQ( stash.restore( keys ), std::vector< bool >( szFiles, true ) );
+    ASSERT_TRUE( boost::filesystem::exists( keys.back().m_file ) );
+
+    // the daemon serves the same stash as the single file interface
+    ASSERT_TRUE( stash.restore( keys.front().m_file, task::DeterminantHash( std::size_t( 0U ) ) ) );
+    ASSERT_FALSE( stash.restore( keys.front().m_file, task::DeterminantHash( szFiles ) ) );
+
+    // errors are returned to the client
+    ASSERT_THROW( stash.stash( tempDir / "missing.txt", task::DeterminantHash( szTestValue1 ) ), std::runtime_error );
+    ASSERT_TRUE( stash.restore( keys.back().m_file, task::DeterminantHash( szFiles - 1U ) ) );
+}